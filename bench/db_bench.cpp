@@ -0,0 +1,133 @@
+#include "db.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+struct BenchResult {
+  const char *workload;
+  double ms;
+  long long ops;
+};
+
+static const char *words[] = {"love",  "night", "blue",  "fire", "dream",
+                              "river", "gold",  "heart", "rain", "light",
+                              "storm", "dance", "ghost", "sun",  "road"};
+static const int word_count = sizeof(words) / sizeof(words[0]);
+
+template <typename F> static double time_ms(F &&f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+static std::vector<BenchResult> run_profile(DbProfile profile, int tracks,
+                                            int playlists, unsigned seed) {
+  std::string path = std::string("bench_") + db_tuning(profile).name + ".db";
+  std::remove(path.c_str());
+  std::remove((path + "-wal").c_str());
+  std::remove((path + "-shm").c_str());
+
+  std::vector<BenchResult> results;
+  {
+    Database db(path.c_str(), profile);
+    std::mt19937 rng(seed);
+
+    results.push_back({"import", time_ms([&] {
+                         for (int i = 0; i < tracks; ++i) {
+                           AudioMetadata m;
+                           m.title = std::string(words[rng() % word_count]) +
+                                     " " + words[rng() % word_count];
+                           m.artist = words[rng() % word_count];
+                           m.length_in_seconds = 120 + rng() % 300;
+                           std::string file = "/library/" + m.artist + "/" +
+                                              std::to_string(i) + ".flac";
+                           db.add_track(file.c_str(), m);
+                         }
+                       }),
+                       tracks});
+
+    const int loads = 20;
+    results.push_back({"full load", time_ms([&] {
+                         for (int i = 0; i < loads; ++i) {
+                           db.get_all_tracks();
+                         }
+                       }),
+                       loads});
+
+    const int searches = 100;
+    results.push_back({"search", time_ms([&] {
+                         for (int i = 0; i < searches; ++i) {
+                           db.search_tracks(words[rng() % word_count]);
+                         }
+                       }),
+                       searches});
+
+    const int per_playlist = 200;
+    results.push_back(
+        {"playlist", time_ms([&] {
+           for (int p = 0; p < playlists; ++p) {
+             int id = -1;
+             std::string name = "bench " + std::to_string(p);
+             db.add_playlist(name.c_str(), &id);
+             for (int i = 0; i < per_playlist; ++i) {
+               int track_id = 1 + rng() % tracks;
+               db.add_track_to_playlist(id, track_id,
+                                        db.get_next_position(id));
+             }
+           }
+           db.get_all_playlist();
+         }),
+         static_cast<long long>(playlists) * per_playlist});
+  }
+
+  std::remove(path.c_str());
+  std::remove((path + "-wal").c_str());
+  std::remove((path + "-shm").c_str());
+  return results;
+}
+
+int main(int argc, char **argv) {
+  int tracks = 20000;
+  int playlists = 20;
+  unsigned seed = 42;
+  const char *only = nullptr;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--tracks") == 0) {
+      tracks = std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--playlists") == 0) {
+      playlists = std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--seed") == 0) {
+      seed = static_cast<unsigned>(std::atoi(argv[i + 1]));
+    } else if (std::strcmp(argv[i], "--profile") == 0) {
+      only = argv[i + 1];
+    }
+  }
+  if (tracks < 1) {
+    tracks = 1;
+  }
+
+  std::printf("tracks=%d playlists=%d seed=%u\n", tracks, playlists, seed);
+  std::printf("%-8s %-10s %12s %14s\n", "profile", "workload", "ms",
+              "ops/s");
+
+  const DbProfile profiles[] = {DbProfile::Laptop, DbProfile::Desktop,
+                                DbProfile::Server};
+  for (DbProfile profile : profiles) {
+    if (only != nullptr && profile != db_profile_from_name(only)) {
+      continue;
+    }
+    for (const auto &r : run_profile(profile, tracks, playlists, seed)) {
+      std::printf("%-8s %-10s %12.2f %14.1f\n", db_tuning(profile).name,
+                  r.workload, r.ms, r.ms > 0.0 ? r.ops * 1000.0 / r.ms : 0.0);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,122 @@
+#include "dsp.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static const int band_count = 10;
+static const double pi = 3.14159265358979323846;
+
+struct RunResult {
+  double us_per_second = 0.0;
+  double worst_callback_us = 0.0;
+};
+
+static void design_bands(Biquad *stages, bool *enabled, double rate) {
+  static const double frequencies[band_count] = {
+      31, 62, 125, 250, 500, 1000, 2000, 4000, 8000, 16000};
+  for (int i = 0; i < band_count; ++i) {
+    FilterType type = i == 0                ? FilterType::LowShelf
+                      : i == band_count - 1 ? FilterType::HighShelf
+                                            : FilterType::Peaking;
+    double gain = (i % 2 == 0) ? 6.0 : -4.5;
+    stages[i] = design_biquad(type, frequencies[i], gain, 1.41, rate);
+    enabled[i] = true;
+  }
+}
+
+template <typename F>
+static RunResult run(F &&process, std::vector<float> &signal, int channels,
+                     int block, double rate) {
+  RunResult r;
+  size_t frames = signal.size() / channels;
+  double total_us = 0.0;
+
+  for (size_t start = 0; start < frames; start += block) {
+    size_t n = std::min<size_t>(block, frames - start);
+    auto t0 = std::chrono::steady_clock::now();
+    process(signal.data() + start * channels, n);
+    double us = std::chrono::duration<double, std::micro>(
+                    std::chrono::steady_clock::now() - t0)
+                    .count();
+    total_us += us;
+    r.worst_callback_us = std::max(r.worst_callback_us, us);
+  }
+
+  r.us_per_second = total_us / (frames / rate);
+  return r;
+}
+
+int main(int argc, char **argv) {
+  double rate = 192000.0;
+  int channels = 2;
+  int block = 480;
+  double seconds = 30.0;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--rate") == 0) {
+      rate = std::atof(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--channels") == 0) {
+      channels = std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--block") == 0) {
+      block = std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--seconds") == 0) {
+      seconds = std::atof(argv[i + 1]);
+    }
+  }
+  channels = std::max(1, channels);
+  block = std::max(1, block);
+
+  size_t frames = static_cast<size_t>(rate * seconds);
+  std::vector<float> source(frames * channels);
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> noise(-0.25f, 0.25f);
+  for (size_t i = 0; i < frames; ++i) {
+    float tone =
+        0.5f * static_cast<float>(std::sin(2.0 * pi * 440.0 * i / rate));
+    for (int c = 0; c < channels; ++c) {
+      source[i * channels + c] = tone + noise(rng);
+    }
+  }
+
+  Biquad stages[band_count];
+  bool enabled[band_count];
+  design_bands(stages, enabled, rate);
+
+  BiquadCascade simd;
+  simd.init(channels);
+  simd.set(stages, enabled, band_count);
+  BiquadCascade scalar;
+  scalar.init(channels);
+  scalar.set(stages, enabled, band_count);
+
+  std::vector<float> a = source;
+  std::vector<float> b = source;
+  RunResult vr = run([&](float *f, size_t n) { simd.process(f, n); }, a,
+                     channels, block, rate);
+  RunResult sr = run([&](float *f, size_t n) { scalar.process_scalar(f, n); },
+                     b, channels, block, rate);
+
+  float max_diff = 0.0f;
+  for (size_t i = 0; i < a.size(); ++i) {
+    max_diff = std::max(max_diff, std::fabs(a[i] - b[i]));
+  }
+
+  double block_us = block / rate * 1e6;
+  std::printf("bands=%d rate=%.0f channels=%d block=%d (%.0f us) "
+              "seconds=%.0f\n",
+              band_count, rate, channels, block, block_us, seconds);
+  std::printf("%-8s %14s %10s %18s\n", "path", "us/s audio", "load %",
+              "worst block us");
+  std::printf("%-8s %14.1f %10.3f %18.1f\n", "simd", vr.us_per_second,
+              vr.us_per_second / 1e4, vr.worst_callback_us);
+  std::printf("%-8s %14.1f %10.3f %18.1f\n", "scalar", sr.us_per_second,
+              sr.us_per_second / 1e4, sr.worst_callback_us);
+  std::printf("max difference between paths: %g\n", max_diff);
+  return 0;
+}
@@ -1,34 +1,274 @@
 #pragma once
+#include "audio_tap.hpp"
+#include "crossfade.hpp"
 #include "db.hpp"
+#include "decode_policy.hpp"
+#include "equalizer.hpp"
+#include "limiter.hpp"
+#include "loudness.hpp"
 #include "miniaudio/miniaudio.h"
+#include "mmap_vfs.hpp"
+#include "mpsc_queue.hpp"
+#include "pcm_cache.hpp"
+#include "play_queue.hpp"
+#include "seek_index.hpp"
+#include "spsc_queue.hpp"
+#include "time_stretch.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 static float volume = 1.0f;
 
-enum class PlaybackState { Stopped, Playing, Paused };
+enum class PlaybackState { Stopped, Loading, Playing, Paused };
+
+struct DeckEvent {
+  int deck;
+  std::chrono::steady_clock::time_point at;
+};
+
+enum class CommandType {
+  Toggle,
+  PlayTrack,
+  Pause,
+  Stop,
+  Seek,
+  Next,
+  Previous,
+  SetVolume,
+  SetCrossfade,
+  SetMemoryBudget,
+  SetGainMode,
+  SetSkipSilence,
+  SetSpeed,
+  CancelNext
+};
+
+struct PlaybackCommand {
+  CommandType type = CommandType::Stop;
+  std::string path;
+  int track_id = -1;
+  float value = 0.0f;
+  std::uintmax_t bytes = 0;
+  GainMode gain_mode = GainMode::Off;
+  bool enabled = false;
+};
+
+struct DeckMemory {
+  bool loaded = false;
+  DecodeMode mode = DecodeMode::Stream;
+  std::uintmax_t resident_bytes = 0;
+};
+
+struct AudioMemoryStats {
+  std::uintmax_t budget_bytes = 0;
+  std::uintmax_t resident_bytes = 0;
+  std::uintmax_t cache_bytes = 0;
+  DeckMemory decks[2];
+};
+
+struct PlaybackSnapshot {
+  PlaybackState state = PlaybackState::Stopped;
+  int track_id = -1;
+  float position = 0.0f;
+  float length = 0.0f;
+  float volume = 1.0f;
+  float crossfade_seconds = 0.0f;
+  CrossfadeCurve crossfade_curve = CrossfadeCurve::EqualPower;
+  GainMode gain_mode = GainMode::Off;
+  float track_gain_db = 0.0f;
+  bool skip_silence = false;
+  float skipped_seconds = 0.0f;
+  float speed = 1.0f;
+  double advance_lag_ms = 0.0;
+  double last_open_ms = 0.0;
+  bool device_running = false;
+  long long device_stops = 0;
+  AudioMemoryStats memory;
+};
+
+// The control thread owns the engine and both decks. Other threads post
+// commands and read the snapshot it publishes after every pass, so the UI
+// never waits on file I/O or decoding.
 class Music {
 private:
   ma_engine engine;
-  ma_sound sound;
+  AudioTap tap;
+  Limiter limiter;
+  Equalizer equalizer;
+  Crossfader crossfader;
+  ma_sound decks[2];
+  bool deck_loaded[2] = {false, false};
+  int deck_track_id[2] = {-1, -1};
+  std::string deck_path[2];
+  DecodeChoice deck_choice[2];
+  ma_audio_buffer deck_buffer[2];
+  std::shared_ptr<const CachedPcm> deck_pcm[2];
+  ma_resource_manager_data_source deck_file[2];
+  // Bound to the deck's decoder, which keeps pointing into its points.
+  SeekIndex deck_index[2];
+  bool deck_file_open[2] = {false, false};
+  // Whether finish_open has created the deck's sound, which waits for its
+  // source to load.
+  bool deck_ready[2] = {false, false};
+  // Measured once by finish_open. Counting an in-memory MP3 without a Xing
+  // header walks its decoder, which must not happen while it plays.
+  ma_uint64 deck_length[2] = {0, 0};
+  TimeStretchSource deck_stretch[2];
+  StretchTimings stretch_timings;
+  TrackLoudness deck_loudness[2];
+  float deck_gain[2] = {1.0f, 1.0f};
+  AudibleRange deck_range[2];
+  float deck_skipped[2] = {0.0f, 0.0f};
+  GainMode gain_mode = GainMode::Off;
+  bool skip_silence = false;
+  float speed = 1.0f;
+  int active = 0;
   Database music_db;
+  PlayQueue *queue;
 
-  float paused_time = 0.0f;
+  bool next_scheduled = false;
+  int failed_next_id = -1;
+  std::string loading_path;
+  std::chrono::steady_clock::time_point loading_since;
+  long long last_open_us = 0;
+  long long advance_lag_us = 0;
+  std::uintmax_t memory_budget = audio_budget_from_env();
+  MmapVfs file_vfs;
+  PcmCache pcm_cache{memory_budget / 2, file_vfs.vfs()};
+  SeekIndexer seek_indexer{music_db.path()};
+  float gapless_lookahead = 5.0f;
+  float crossfade_seconds = 0.0f;
+  CrossfadeCurve crossfade_curve = CrossfadeCurve::EqualPower;
   PlaybackState state = PlaybackState::Stopped;
-  std::vector<Track> all_track_vector;
+
+  SpscQueue<DeckEvent, 16> events;
+  MpscQueue<PlaybackCommand, 64> commands;
+  std::mutex wake_mutex;
+  std::condition_variable wake;
+  std::thread control;
+  std::atomic<bool> control_running{false};
+  int control_interval_ms = 5;
+  bool device_running = false;
+  long long device_stops = 0;
+  std::chrono::milliseconds idle_timeout{0};
+  std::chrono::steady_clock::time_point idle_since;
+  std::atomic<int> advanced_track_id{-1};
+
+  mutable std::mutex snapshot_mutex;
+  PlaybackSnapshot published;
+
+  // Slider drags send a new value every frame; only the latest one matters,
+  // so at most one command per setting is queued at a time.
+  std::atomic<float> pending_volume{1.0f};
+  std::atomic<float> pending_crossfade{0.0f};
+  std::atomic<int> pending_curve{0};
+  std::atomic<float> pending_speed{1.0f};
+  std::atomic<bool> volume_posted{false};
+  std::atomic<bool> crossfade_posted{false};
+  std::atomic<bool> speed_posted{false};
+
+  ma_sound *current() { return &decks[active]; }
+  const ma_sound *current() const { return &decks[active]; }
+  ma_sound *upcoming() { return &decks[1 - active]; }
+  ma_result open_deck(int deck, const std::string &filepath, int track_id);
+  ma_result finish_open(int deck);
+  void close_sources(int deck);
+  ma_uint32 open_flags(int deck, const std::string &filepath);
+  bool load_seek_index(int deck, const std::string &filepath, int track_id);
+  void bind_seek_index(int deck);
+  void upgrade_to_indexed(int deck);
+  void apply_trim(int deck);
+  std::uintmax_t deck_resident(int deck);
+  ma_result load_result(int deck);
+  void unload(int deck);
+  bool start_track(const std::string &filepath, int track_id);
+  void poll_loading();
+  void cache_around();
+  bool wants_next() const;
+  bool prepare_next(const std::string &filepath, int track_id);
+  void schedule_next();
+  void unschedule_next();
+  void handle_end(const DeckEvent &event);
+  void handle_command(const PlaybackCommand &command);
+  void start_device();
+  void update_device();
+  void do_toggle(const std::string &filepath, int track_id);
+  void do_pause();
+  void do_stop();
+  void do_set_volume(float v);
+  void apply_volume(int deck);
+  void post(PlaybackCommand command);
+  void publish();
+  void control_loop();
+  float cursor_seconds() const;
+  float length_seconds() const;
+  static void on_sound_end(void *user_data, ma_sound *sound);
 
 public:
-  Music();
+  Music(PlayQueue *play_queue = nullptr);
   ~Music();
 
   void play(const std::string filepath, int track_id);
+  void play_track(const std::string filepath, int track_id);
   void pause(int track_id);
   void stop();
-  bool is_finished();
+  void next();
+  void previous();
+  void cancel_next();
+  int take_advanced();
   void set_volume(float v);
-  float get_volume() const;
-  float current_time() const;
-  float max_time() const;
+  void set_crossfade(float seconds, CrossfadeCurve curve);
+  void set_memory_budget(std::uintmax_t bytes);
+  void set_gain_mode(GainMode mode);
+  // Starts and ends tracks at their first and last audible frame, once the
+  // loudness pass has found them. Applies from the next track loaded.
+  void set_skip_silence(bool on);
+  // Plays both decks faster or slower at the same pitch, from 0.5x to 2x.
+  // Positions and lengths stay in track time.
+  void set_speed(float s);
   void set_position(float seek_point_in_seconds);
-  PlaybackState get_state() const { return state; }
-};
\ No newline at end of file
+
+  // EQ and limiter edits skip the command queue and go straight to the
+  // audio thread.
+  void set_eq_enabled(bool on) { equalizer.set_enabled(on); }
+  bool get_eq_enabled() const { return equalizer.is_enabled(); }
+  void set_eq_band(int index, const EqBand &band) {
+    equalizer.set_band(index, band);
+  }
+  EqBand get_eq_band(int index) const { return equalizer.get_band(index); }
+  void reset_eq() { equalizer.reset_bands(); }
+  void set_limiter_ceiling(float db) { limiter.set_ceiling(db); }
+  void set_limiter_release(float ms) { limiter.set_release(ms); }
+  void reset_limiter_meter() { limiter.reset_meter(); }
+  LimiterStats get_limiter_stats() const { return limiter.get_stats(); }
+  const AudioTap &get_output_tap() const { return tap; }
+
+  PlaybackSnapshot snapshot() const;
+  float get_volume() const { return snapshot().volume; }
+  float get_crossfade() const { return snapshot().crossfade_seconds; }
+  CrossfadeCurve get_crossfade_curve() const {
+    return snapshot().crossfade_curve;
+  }
+  GainMode get_gain_mode() const { return snapshot().gain_mode; }
+  bool get_skip_silence() const { return snapshot().skip_silence; }
+  float get_speed() const { return snapshot().speed; }
+  TimeStretchStats get_stretch_stats() const;
+  CrossfadeStats get_crossfade_stats() const { return crossfader.get_stats(); }
+  EqualizerStats get_eq_stats() const { return equalizer.get_stats(); }
+  double get_advance_lag_ms() const { return snapshot().advance_lag_ms; }
+  double get_last_open_ms() const { return snapshot().last_open_ms; }
+  AudioMemoryStats get_memory_stats() const { return snapshot().memory; }
+  PcmCacheStats get_cache_stats() { return pcm_cache.get_stats(); }
+  MmapVfsStats get_vfs_stats() const { return file_vfs.get_stats(); }
+  SeekIndexStats get_seek_stats();
+  float current_time() const { return snapshot().position; }
+  float max_time() const { return snapshot().length; }
+  PlaybackState get_state() const { return snapshot().state; }
+};
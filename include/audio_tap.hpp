@@ -0,0 +1,48 @@
+#pragma once
+#include "miniaudio/miniaudio.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Pass-through node in front of the endpoint that copies the first two
+// output channels into a ring the UI can read. The audio thread only copies
+// and bumps a counter; a reader that gets lapped mid-copy notices from the
+// counter and drops that read instead of making the writer wait.
+class AudioTap {
+public:
+  static const size_t capacity = 16384;
+
+private:
+  ma_node_base base;
+  bool initialized = false;
+  ma_uint32 channels = 2;
+  ma_uint32 sample_rate = 48000;
+
+  std::vector<float> ring;
+  std::atomic<std::uint64_t> written{0};
+
+  static ma_node_vtable vtable;
+
+  void process(const float *frames_in, float *frames_out, ma_uint32 count);
+  static void on_process(ma_node *node, const float **frames_in,
+                         ma_uint32 *frame_count_in, float **frames_out,
+                         ma_uint32 *frame_count_out);
+
+public:
+  AudioTap() = default;
+  ~AudioTap();
+  AudioTap(const AudioTap &) = delete;
+  AudioTap &operator=(const AudioTap &) = delete;
+
+  ma_result init(ma_engine *engine);
+  void uninit();
+  ma_node *node() { return &base; }
+
+  ma_uint32 get_sample_rate() const { return sample_rate; }
+  std::uint64_t frames_written() const {
+    return written.load(std::memory_order_acquire);
+  }
+  // Copies the most recent `count` stereo frames (count <= capacity / 2).
+  bool read_latest(float *frames, size_t count) const;
+};
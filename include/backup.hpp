@@ -0,0 +1,44 @@
+#pragma once
+#include <sqlite3.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+struct BackupProgress {
+  int total_pages = 0;
+  int remaining_pages = 0;
+  double bytes_per_second = 0.0;
+  bool running = false;
+  bool finished = false;
+  bool failed = false;
+};
+
+class DatabaseBackup {
+private:
+  std::string source_path;
+  std::string dest_path;
+  int pages_per_step;
+  int step_pause_ms;
+
+  std::thread worker;
+  std::atomic<bool> running{false};
+  std::atomic<bool> cancel_requested{false};
+  std::atomic<bool> finished{false};
+  std::atomic<bool> failed{false};
+  std::atomic<int> total_pages{0};
+  std::atomic<int> remaining_pages{0};
+  std::atomic<double> bytes_per_second{0.0};
+
+  void run();
+
+public:
+  DatabaseBackup(const std::string source, const std::string dest,
+                 int pages_per_step = 64, int step_pause_ms = 5);
+  ~DatabaseBackup();
+
+  bool start();
+  void cancel();
+  BackupProgress progress() const;
+  double hours_since_last_backup() const;
+};
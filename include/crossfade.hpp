@@ -0,0 +1,77 @@
+#pragma once
+#include "miniaudio/miniaudio.h"
+
+#include <atomic>
+
+enum class CrossfadeCurve { Linear, EqualPower };
+
+struct CrossfadeStats {
+  long long fades = 0;
+  double fade_seconds = 0.0;
+  double fade_us_per_second = 0.0;
+  double total_us_per_second = 0.0;
+};
+
+struct CrossfadeParams {
+  ma_uint64 start = 0;
+  ma_uint64 length = 0;
+  int incoming_bus = 1;
+  CrossfadeCurve curve = CrossfadeCurve::EqualPower;
+};
+
+// Two-input mixer sitting between the decks and the output node. Gains are
+// evaluated per frame against the engine clock on the audio thread, so a fade
+// lands on the frame it was scheduled for regardless of the UI frame rate.
+// The control thread hands schedules over through a triple buffer, so the
+// audio thread never reads one that is half written.
+class Crossfader {
+private:
+  ma_node_base base;
+  ma_engine *engine = nullptr;
+  bool initialized = false;
+  ma_uint32 channels = 2;
+  ma_uint32 sample_rate = 48000;
+
+  // Control side.
+  int back = 0;
+
+  // Bit 2 of shared marks a slot the audio thread has not picked up yet.
+  CrossfadeParams slots[3];
+  std::atomic<int> shared{1};
+
+  // Audio side.
+  int front = 2;
+
+  std::atomic<long long> fades{0};
+
+  ma_uint64 period_time = ~(ma_uint64)0;
+  ma_uint64 period_offset = 0;
+
+  std::atomic<long long> fade_frames{0};
+  std::atomic<long long> fade_ns{0};
+  std::atomic<long long> total_frames{0};
+  std::atomic<long long> total_ns{0};
+
+  static ma_node_vtable vtable;
+
+  void publish(const CrossfadeParams &p);
+  void process(const float **frames_in, float *frames_out, ma_uint32 count);
+  static void on_process(ma_node *node, const float **frames_in,
+                         ma_uint32 *frame_count_in, float **frames_out,
+                         ma_uint32 *frame_count_out);
+
+public:
+  Crossfader() = default;
+  ~Crossfader();
+  Crossfader(const Crossfader &) = delete;
+  Crossfader &operator=(const Crossfader &) = delete;
+
+  ma_result init(ma_engine *engine, ma_node *output);
+  void uninit();
+  ma_node *node() { return &base; }
+
+  void schedule(ma_uint64 start, ma_uint64 length, int incoming_bus,
+                CrossfadeCurve curve);
+  void cancel();
+  CrossfadeStats get_stats() const;
+};
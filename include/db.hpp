@@ -1,7 +1,10 @@
 #pragma once
 #include <sqlite3.h>
 
+#include <cstdint>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 struct AudioMetadata {
@@ -27,6 +30,41 @@ struct Track {
   std::string date_added;
   int last_played;
   int play_count;
+  double bpm = 0.0;
+  int musical_key = -1;
+};
+
+struct TrackLoudness {
+  bool analyzed = false;
+  double track_lufs = 0.0;
+  double track_peak_dbtp = 0.0;
+  bool has_album = false;
+  double album_lufs = 0.0;
+  double album_peak_dbtp = 0.0;
+};
+
+// Where the audio of a track starts and stops once leading and trailing
+// silence is left out. Both ends are 0 for a track that is silent throughout.
+struct AudibleRange {
+  bool analyzed = false;
+  double start_seconds = 0.0;
+  double end_seconds = 0.0;
+};
+
+// One entry of an MP3 seek table: where to restart decoding to reach
+// pcm_frame, and how much decoded audio to throw away once there.
+struct SeekPoint {
+  std::uint64_t byte_offset = 0;
+  std::uint64_t pcm_frame = 0;
+  std::uint16_t mp3_frames_to_discard = 0;
+  std::uint16_t pcm_frames_to_discard = 0;
+  std::uint32_t reserved = 0;
+};
+
+struct SeekIndex {
+  std::uintmax_t file_bytes = 0;
+  std::uint64_t total_frames = 0;
+  std::vector<SeekPoint> points;
 };
 
 struct AppState {
@@ -35,8 +73,26 @@ struct AppState {
   float volume = 1.0f;
   bool if_shuffled = false;
   bool is_repeat = false;
+  int normalization = 0;
+  bool skip_silence = false;
+  float playback_speed = 1.0f;
+};
+
+enum class DbProfile { Laptop, Desktop, Server };
+
+struct DbTuning {
+  const char *name;
+  long long mmap_size;
+  int cache_size_kib;
+  const char *temp_store;
+  int page_size;
+  const char *synchronous;
 };
 
+const DbTuning &db_tuning(DbProfile profile);
+DbProfile db_profile_from_name(const char *name);
+DbProfile db_profile_from_env();
+
 struct Playlist {
   int id;
   std::string name;
@@ -47,28 +103,59 @@ class Database {
 private:
   sqlite3 *db;
   AudioMetadata music_metadata;
-  const char *music_database = "music.db";
+  std::string music_database;
+  DbProfile profile;
   int rc;
+  void apply_profile();
   void create_tables();
+  void ensure_column(const char *table, const char *column,
+                     const char *definition);
+  int update_album_loudness(const std::string &album, const char *artist);
 
 public:
-  Database();
+  Database(const char *path = "music.db",
+           DbProfile profile = db_profile_from_env());
   ~Database();
 
+  const char *path() const { return music_database.c_str(); }
+  void explain_pending_queries();
+  DbProfile get_profile() const { return profile; }
   std::string current_datetime();
   AudioMetadata get_metadata(const char *file_path);
 
   int add_track(const char *__absolute_file_path);
+  int add_track(const char *__absolute_file_path,
+                const AudioMetadata &metadata);
   std::vector<Track> get_all_tracks();
+  std::vector<Track> search_tracks(const char *query);
   int get_track_by_id(int id);
   int delete_track(int id);
   int increase_play_count(int id);
   int add_last_played_timestamp(int id, int time);
   int last_played_timestamp(int id);
+  std::vector<Track> get_tracks_without_loudness();
+  int set_track_loudness(int id, double lufs, double true_peak_dbtp);
+  int fill_track_album(int id, const std::string &album);
+  bool get_track_loudness(int id, TrackLoudness &loudness);
+  int set_track_audible_range(int id, double start_seconds,
+                              double end_seconds);
+  bool get_track_audible_range(int id, AudibleRange &range);
+  std::vector<Track> get_tracks_without_tempo();
+  int set_track_tempo_key(int id, double bpm, int musical_key);
+  int set_track_fingerprint(int id, const std::vector<std::uint32_t> &words,
+                            const std::vector<std::int64_t> &buckets);
+  bool get_track_fingerprint(int id, std::vector<std::uint32_t> &words);
+  int count_fingerprints();
+  std::vector<std::pair<int, int>> get_fingerprint_candidates(int max_bucket);
+  bool get_seek_index(int id, SeekIndex &index);
+  int set_seek_index(int id, const SeekIndex &index);
   AppState load_app_state();
   void save_app_state(const AppState &s);
-  int add_playlist(const char *playlist_name);
+  std::unordered_map<std::string, int> get_track_path_index();
+  int add_playlist(const char *playlist_name, int *playlist_id = nullptr);
   int add_track_to_playlist(int playlist_id, int track_id, int position);
+  int add_tracks_to_playlist(int playlist_id,
+                             const std::vector<int> &track_ids);
   int remove_track_from_playlist(int playlist_id, int track_id);
   int delete_playlist(int id);
   int get_next_position(int playlist_id);
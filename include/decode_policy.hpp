@@ -0,0 +1,24 @@
+#pragma once
+#include "miniaudio/miniaudio.h"
+
+#include <cstdint>
+#include <string>
+
+enum class DecodeMode { Stream, Encoded, Decoded, Cached };
+
+struct DecodeChoice {
+  DecodeMode mode = DecodeMode::Stream;
+  std::uintmax_t file_bytes = 0;
+  std::uintmax_t estimated_bytes = 0;
+};
+
+const char *decode_mode_name(DecodeMode mode);
+ma_uint32 decode_mode_flags(DecodeMode mode);
+std::uintmax_t audio_budget_from_env();
+
+// Picks how a file is held in memory given what the other deck already uses.
+// Short compressed tracks are fully decoded for instant seeks, files that fit
+// the budget keep their encoded bytes resident, and everything else streams.
+DecodeChoice choose_decode_mode(const std::string &path,
+                                std::uintmax_t budget_bytes,
+                                std::uintmax_t used_bytes);
@@ -0,0 +1,130 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+struct Biquad {
+  double b0 = 1.0, b1 = 0.0, b2 = 0.0;
+  double a1 = 0.0, a2 = 0.0;
+};
+
+enum class FilterType { Peaking, LowShelf, HighShelf };
+
+// RBJ cookbook designs. q sets the bandwidth of a peaking band and the
+// resonance at a shelf's corner; 0 dB gives the identity filter.
+Biquad design_biquad(FilterType type, double frequency, double gain_db,
+                     double q, double sample_rate);
+bool is_identity(const Biquad &f);
+
+// The two stages of the ITU-R BS.1770 K-weighting curve at any sample rate.
+Biquad k_weighting_shelf(double sample_rate);
+Biquad k_weighting_highpass(double sample_rate);
+
+// K-weights interleaved audio and accumulates the squared output per channel.
+// Channels are filtered in pairs with SIMD lanes, which keeps the recursive
+// filters vectorized even though each channel depends on its own history.
+class KWeighting {
+private:
+  Biquad shelf;
+  Biquad highpass;
+  int channels = 0;
+  std::vector<double> state;
+
+public:
+  void init(int channels, double sample_rate);
+  void reset();
+  void process(const float *frames, size_t count, double *sum_squares);
+};
+
+// Up to max_stages biquads run in series over interleaved audio, in place.
+// State is kept in double so low bands stay stable at high sample rates.
+// Channels are grouped four to an AVX register, then in SSE2 pairs, with a
+// scalar loop for whatever is left. Inactive stages are skipped and their
+// history cleared, so a flat band costs nothing.
+class BiquadCascade {
+public:
+  static constexpr int max_stages = 16;
+
+private:
+  Biquad stages[max_stages];
+  bool active[max_stages] = {};
+  int stage_count = 0;
+  int channels = 0;
+  std::vector<double> state;
+
+  double *stage_state(int stage, int channel) {
+    return &state[(stage * channels + channel) * 2];
+  }
+  void process_channel(float *frames, size_t count, int c);
+  void process_sse2(float *frames, size_t count, int c);
+  void process_avx(float *frames, size_t count, int c);
+
+public:
+  void init(int channels);
+  void reset();
+  void set(const Biquad *coeffs, const bool *enabled, int count);
+  int active_stages() const;
+
+  void process(float *frames, size_t count);
+  void process_scalar(float *frames, size_t count);
+};
+
+// Sample peak plus 4x oversampled inter-sample peak (BS.1770 Annex 2), using
+// a 48-tap windowed-sinc interpolator split into four 12-tap phases.
+class TruePeak {
+public:
+  // Samples between an input sample and the interpolated points it affects.
+  static const int latency = 6;
+
+private:
+  static const int phases = 4;
+  static const int taps = 12;
+
+  float coeffs[phases][taps];
+  int channels = 0;
+  std::vector<float> history;
+  int position = 0;
+  float peak = 0.0f;
+
+  float push(int channel, float x);
+
+public:
+  void init(int channels);
+  void process(const float *frames, size_t count);
+  // Writes the highest sample or inter-sample magnitude of each frame.
+  void frame_peaks(const float *frames, size_t count, float *peaks);
+  float get_peak() const { return peak; }
+};
+
+// Running maximum over the last `window` values at constant cost per value
+// (van Herk / Gil-Werman): the stream is cut into blocks of `window`, and
+// each output is the larger of the current block's prefix maximum and the
+// previous block's suffix maximum, combined four at a time with SSE.
+class SlidingMax {
+private:
+  size_t window = 1;
+  size_t position = 0;
+  float running = 0.0f;
+  std::vector<float> block;
+  std::vector<float> suffix;
+
+public:
+  void init(size_t window);
+  void reset();
+  void process(const float *in, float *out, size_t count);
+};
+
+// Index of the first sample whose magnitude exceeds threshold, or count if
+// none does, and one past the last such sample, or 0. Both test sixteen
+// samples per step with SSE and stop at the first block that has a hit.
+size_t first_above(const float *samples, size_t count, float threshold);
+size_t end_above(const float *samples, size_t count, float threshold);
+
+// Sum of a[i] * b[i], in four SSE accumulators of four lanes each.
+float dot_product(const float *a, const float *b, size_t count);
+
+// out[i] = from[i] + (to[i] - from[i]) * ramp[i]; out may alias either input.
+void crossfade(const float *from, const float *to, const float *ramp,
+               float *out, size_t count);
+
+double to_db(double linear);
+double from_db(double db);
@@ -0,0 +1,83 @@
+#pragma once
+#include "dsp.hpp"
+#include "miniaudio/miniaudio.h"
+
+#include <atomic>
+
+struct EqBand {
+  FilterType type = FilterType::Peaking;
+  float frequency = 1000.0f;
+  float gain_db = 0.0f;
+  float q = 1.41f;
+  bool enabled = true;
+};
+
+struct EqualizerStats {
+  int active_bands = 0;
+  ma_uint32 sample_rate = 0;
+  double us_per_second = 0.0;
+};
+
+// Parametric EQ between the crossfader and the limiter. The UI thread edits
+// bands and designs the coefficients; the audio thread picks them up through
+// a triple buffer, so neither side ever waits on the other and a slider drag
+// can never hand the callback a half-written set.
+class Equalizer {
+public:
+  static const int band_count = 10;
+
+private:
+  struct Coefficients {
+    Biquad stages[band_count];
+    bool enabled[band_count] = {};
+  };
+
+  ma_node_base base;
+  bool initialized = false;
+  ma_uint32 channels = 2;
+  ma_uint32 sample_rate = 48000;
+
+  // UI side.
+  EqBand bands[band_count];
+  bool enabled = false;
+  int back = 0;
+
+  // Bit 2 of shared marks a slot the audio thread has not picked up yet.
+  Coefficients slots[3];
+  std::atomic<int> shared{1};
+
+  // Audio side.
+  int front = 2;
+  BiquadCascade cascade;
+
+  std::atomic<int> active_bands{0};
+  std::atomic<long long> total_frames{0};
+  std::atomic<long long> total_ns{0};
+
+  static ma_node_vtable vtable;
+
+  void publish();
+  void process(const float *frames_in, float *frames_out, ma_uint32 count);
+  static void on_process(ma_node *node, const float **frames_in,
+                         ma_uint32 *frame_count_in, float **frames_out,
+                         ma_uint32 *frame_count_out);
+
+public:
+  Equalizer();
+  ~Equalizer();
+  Equalizer(const Equalizer &) = delete;
+  Equalizer &operator=(const Equalizer &) = delete;
+
+  ma_result init(ma_engine *engine, ma_node *output);
+  void uninit();
+  ma_node *node() { return &base; }
+
+  // Called from one thread only (the UI).
+  void set_enabled(bool on);
+  bool is_enabled() const { return enabled; }
+  void set_band(int index, const EqBand &band);
+  EqBand get_band(int index) const { return bands[index]; }
+  void reset_bands();
+
+  EqualizerStats get_stats() const;
+};
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Forward FFT of real input with a power-of-two size. The input is packed as
+// a half-size complex transform (even samples real, odd samples imaginary),
+// run radix-2 on split real/imaginary arrays so each stage's butterflies
+// vectorize four at a time, then unpacked into the n/2 + 1 positive bins.
+class RealFft {
+private:
+  size_t n = 0;
+  size_t half = 0;
+  std::vector<size_t> bit_reverse;
+  std::vector<float> stage_cos;
+  std::vector<float> stage_sin;
+  std::vector<float> unpack_cos;
+  std::vector<float> unpack_sin;
+  std::vector<float> re;
+  std::vector<float> im;
+
+  void transform();
+
+public:
+  explicit RealFft(size_t size);
+
+  size_t size() const { return n; }
+  // Writes |X[k]|^2 for k = 0 .. n/2.
+  void power(const float *input, float *out);
+};
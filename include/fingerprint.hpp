@@ -0,0 +1,72 @@
+#pragma once
+#include "db.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One 32-bit word per chroma frame (about 5 a second, for up to two minutes
+// from the first audible frame). Each bit compares two smoothed chroma
+// values, so the words depend on the harmony and its movement rather than
+// on level, codec or sample rate: an MP3 and a FLAC of the same recording
+// produce nearly the same sequence.
+std::vector<std::uint32_t>
+chroma_fingerprint(const std::vector<float> &chroma);
+
+// Share of equal bits at the best alignment within a few seconds, from 0.5
+// for unrelated audio to 1.0 for identical. Alignments that cannot reach
+// floor are given up early; the result is then below floor but not exact.
+double fingerprint_similarity(const std::vector<std::uint32_t> &a,
+                              const std::vector<std::uint32_t> &b,
+                              double floor = 0.0);
+
+// MinHash signature of the fingerprint's pairs of word shapes, cut into
+// bands. Two tracks sharing any band are duplicate candidates; the bands
+// make the chance of that rise steeply with how many pairs they share.
+std::vector<std::int64_t>
+fingerprint_buckets(const std::vector<std::uint32_t> &fingerprint);
+
+struct DuplicatePair {
+  Track first;
+  Track second;
+  double similarity = 0.0;
+};
+
+struct DuplicateReport {
+  bool running = false;
+  bool finished = false;
+  int fingerprinted = 0;
+  int candidates = 0;
+  double seconds = 0.0;
+  std::vector<DuplicatePair> pairs;
+};
+
+// Builds the duplicates report on its own thread and connection. Candidate
+// pairs come from shared LSH buckets in one pass over the bucket table, and
+// only those pairs are compared word by word, so the cost follows the
+// number of likely duplicates rather than the square of the library.
+class DuplicateFinder {
+private:
+  std::string db_path;
+  double min_similarity;
+  std::thread worker;
+  std::atomic<bool> running{false};
+  std::atomic<bool> stopping{false};
+  std::mutex mutex;
+  DuplicateReport report;
+
+  void run();
+
+public:
+  explicit DuplicateFinder(const std::string &db_path,
+                           double min_similarity = 0.8);
+  ~DuplicateFinder();
+  DuplicateFinder(const DuplicateFinder &) = delete;
+  DuplicateFinder &operator=(const DuplicateFinder &) = delete;
+
+  bool start();
+  DuplicateReport get_report();
+};
@@ -0,0 +1,75 @@
+#pragma once
+#include "dsp.hpp"
+#include "miniaudio/miniaudio.h"
+
+#include <atomic>
+#include <vector>
+
+struct LimiterStats {
+  float ceiling_db = 0.0f;
+  float release_ms = 0.0f;
+  float lookahead_ms = 0.0f;
+  float gain_reduction_db = 0.0f;
+  float max_reduction_db = 0.0f;
+  double limited_seconds = 0.0;
+  double us_per_second = 0.0;
+};
+
+// Lookahead true-peak limiter at the end of the master bus. Audio runs
+// through a delay line while the gain is worked out ahead of it: the 4x
+// oversampled peak of each frame is held for the lookahead window by a
+// sliding max, then the gain eases back up at the release rate and is
+// box-smoothed over the lookahead, so it has reached its target by the time
+// the peak comes out.
+class Limiter {
+private:
+  ma_node_base base;
+  bool initialized = false;
+  ma_uint32 channels = 2;
+  ma_uint32 sample_rate = 48000;
+
+  std::atomic<float> ceiling_db{-1.0f};
+  std::atomic<float> release_ms{100.0f};
+
+  // Audio side.
+  TruePeak detector;
+  SlidingMax hold;
+  size_t lookahead = 0;
+  std::vector<float> delay;
+  size_t delay_frames = 0;
+  size_t delay_pos = 0;
+  std::vector<float> smooth;
+  size_t smooth_pos = 0;
+  double smooth_sum = 0.0;
+  float envelope = 1.0f;
+  size_t unity_run = 0;
+
+  std::atomic<float> gain_reduction_db{0.0f};
+  std::atomic<float> max_reduction_db{0.0f};
+  std::atomic<long long> limited_frames{0};
+  std::atomic<long long> total_frames{0};
+  std::atomic<long long> total_ns{0};
+
+  static ma_node_vtable vtable;
+
+  void process(const float *frames_in, float *frames_out, ma_uint32 count);
+  static void on_process(ma_node *node, const float **frames_in,
+                         ma_uint32 *frame_count_in, float **frames_out,
+                         ma_uint32 *frame_count_out);
+
+public:
+  Limiter() = default;
+  ~Limiter();
+  Limiter(const Limiter &) = delete;
+  Limiter &operator=(const Limiter &) = delete;
+
+  ma_result init(ma_engine *engine, ma_node *output,
+                 float lookahead_ms = 5.0f);
+  void uninit();
+  ma_node *node() { return &base; }
+
+  void set_ceiling(float db);
+  void set_release(float ms);
+  void reset_meter() { max_reduction_db.store(0.0f); }
+  LimiterStats get_stats() const;
+};
@@ -0,0 +1,93 @@
+#pragma once
+#include "db.hpp"
+#include "dsp.hpp"
+#include "worker_pool.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+enum class GainMode { Off, Track, Album };
+
+// Integrated loudness per EBU R128 / BS.1770-4: 400 ms blocks every 100 ms,
+// an absolute gate at -70 LUFS and a relative gate 10 LU below the mean.
+class LoudnessMeter {
+private:
+  KWeighting filter;
+  TruePeak true_peak;
+  int channels = 0;
+  size_t step_frames = 0;
+  size_t step_filled = 0;
+  std::vector<double> weights;
+  std::vector<double> step_sums;
+  std::vector<double> steps;
+  std::vector<double> blocks;
+
+  void finish_step();
+
+public:
+  LoudnessMeter(int channels, double sample_rate);
+
+  void add(const float *frames, size_t count);
+  double integrated_lufs() const;
+  double true_peak_dbtp() const { return to_db(true_peak.get_peak()); }
+};
+
+struct LoudnessResult {
+  double integrated_lufs = 0.0;
+  double true_peak_dbtp = 0.0;
+  double seconds = 0.0;
+  // First audible frame and one past the last, in seconds.
+  double audible_start = 0.0;
+  double audible_end = 0.0;
+};
+
+// Also finds where the audio rises above the silence threshold, on the same
+// decode, so trimming costs no extra pass over the file.
+bool measure_loudness(const std::string &path, LoudnessResult &result,
+                      const std::atomic<bool> *cancel = nullptr);
+
+// Linear gain bringing a track (or its album) to the -18 LUFS reference
+// while keeping the true peak at or below -1 dBTP.
+float loudness_gain(const TrackLoudness &loudness, GainMode mode);
+
+struct LoudnessStats {
+  int analyzed = 0;
+  int failed = 0;
+  int pending = 0;
+  double audio_seconds = 0.0;
+  double busy_seconds = 0.0;
+  int workers = 0;
+};
+
+// Measures every track that has no loudness or audible range yet on a
+// WorkerPool and stores the results. Each worker decodes with its own
+// decoder; writes go through one connection under a lock.
+class LoudnessAnalyzer {
+private:
+  WorkerPool &pool;
+  Database db;
+  std::mutex db_mutex;
+
+  std::mutex mutex;
+  std::condition_variable idle;
+  std::atomic<bool> stopping{false};
+  int in_flight = 0;
+  std::unordered_set<int> queued;
+  std::unordered_set<int> failed_ids;
+  LoudnessStats stats;
+
+  void analyze(int track_id, const std::string &path);
+
+public:
+  LoudnessAnalyzer(const std::string &db_path, WorkerPool &pool);
+  ~LoudnessAnalyzer();
+  LoudnessAnalyzer(const LoudnessAnalyzer &) = delete;
+  LoudnessAnalyzer &operator=(const LoudnessAnalyzer &) = delete;
+
+  void rescan();
+  LoudnessStats get_stats();
+};
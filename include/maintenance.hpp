@@ -0,0 +1,69 @@
+#pragma once
+#include <sqlite3.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct MaintenanceStats {
+  int checkpoints = 0;
+  int optimizes = 0;
+  int vacuums = 0;
+  int budget_overruns = 0;
+  int wal_frames_checkpointed = 0;
+  int pages_reclaimed = 0;
+  int freelist_pages = 0;
+  int auto_vacuum = 0;
+  bool vacuum_migrated = false;
+  double migration_ms = 0.0;
+  long long wal_bytes = 0;
+  double last_run_ms = 0.0;
+  double total_run_ms = 0.0;
+};
+
+class MaintenanceScheduler {
+private:
+  std::string db_path;
+  sqlite3 *db = nullptr;
+  int budget_ms;
+  int quiet_period_ms = 3000;
+  long long checkpoint_wal_bytes = 4 * 1024 * 1024;
+  int optimize_interval_s = 3600;
+  int vacuum_min_free_pages = 64;
+  int migrate_quiet_period_ms = 30000;
+  bool migration_failed = false;
+
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::atomic<bool> stop_requested{false};
+  std::atomic<long long> last_activity_ms{0};
+  std::atomic<bool> migrating{false};
+  long long migration_activity_ms = 0;
+  std::chrono::steady_clock::time_point deadline;
+  std::chrono::steady_clock::time_point last_optimize;
+  MaintenanceStats stats;
+
+  void run();
+  void run_due_tasks();
+  void checkpoint(MaintenanceStats &s);
+  void optimize(MaintenanceStats &s);
+  void incremental_vacuum(MaintenanceStats &s);
+  void enable_incremental_vacuum(MaintenanceStats &s);
+  int pragma_int(const char *sql);
+  bool over_budget() const;
+  static int progress_handler(void *self);
+  static long long now_ms();
+
+public:
+  MaintenanceScheduler(const std::string path, int budget_ms = 50);
+  ~MaintenanceScheduler();
+
+  void start();
+  void stop();
+  void touch();
+  MaintenanceStats get_stats();
+};
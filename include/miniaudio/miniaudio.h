@@ -9,6 +9,22 @@ Documentation: https://miniaud.io/docs
 GitHub:        https://github.com/mackron/miniaudio
 */
 
+/*
+music_playr patch
+=================
+This copy differs from upstream v0.11.23 in two places. Both are kept in
+patches/miniaudio-node-start-offset.patch, which applies to a pristine
+miniaudio.h; re-apply it after updating this file.
+
+1. ma_node_get_state_by_time_range(): a node whose start or stop time falls
+   inside the range counts as started, so ma_node_read_pcm_frames() trims to
+   the exact frame instead of snapping to the period boundary.
+2. ma_node_read_pcm_frames(): timeOffsetBeg is startTime - globalTimeBeg, the
+   number of leading frames to silence, rather than globalTimeEnd - startTime.
+
+Gapless playback and crossfades depend on both.
+*/
+
 /*
 1. Introduction
 ===============
@@ -74927,11 +74943,15 @@ MA_API ma_node_state ma_node_get_state_by_time_range(const ma_node* pNode, ma_ui
     its start time not having been reached yet. Also, the stop time may have also been reached in
     which case it'll be considered stopped.
     */
-    if (ma_node_get_state_time(pNode, ma_node_state_started) > globalTimeBeg) {
+    /*
+    A start or stop time that falls inside the range counts as started so that ma_node_read_pcm_frames()
+    can trim to the exact frame. Otherwise scheduled starts and stops snap to period boundaries.
+    */
+    if (ma_node_get_state_time(pNode, ma_node_state_started) > globalTimeBeg && ma_node_get_state_time(pNode, ma_node_state_started) >= globalTimeEnd) {
         return ma_node_state_stopped;   /* Start time has not yet been reached. */
     }
 
-    if (ma_node_get_state_time(pNode, ma_node_state_stopped) <= globalTimeEnd) {
+    if (ma_node_get_state_time(pNode, ma_node_state_stopped) <= globalTimeBeg) {
         return ma_node_state_stopped;   /* Stop time has been reached. */
     }
 
@@ -75032,7 +75052,7 @@ static ma_result ma_node_read_pcm_frames(ma_node* pNode, ma_uint32 outputBusInde
     therefore need to offset it by a number of frames to accommodate. The same thing applies for
     the stop time.
     */
-    timeOffsetBeg = (globalTimeBeg < startTime) ? (ma_uint32)(globalTimeEnd - startTime) : 0;
+    timeOffsetBeg = (globalTimeBeg < startTime) ? (ma_uint32)(startTime - globalTimeBeg) : 0;
     timeOffsetEnd = (globalTimeEnd > stopTime)  ? (ma_uint32)(globalTimeEnd - stopTime)  : 0;
 
     /* Trim based on the start offset. We need to silence the start of the buffer. */
@@ -0,0 +1,96 @@
+#pragma once
+#include "miniaudio/miniaudio.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct MmapVfsStats {
+  long long opens = 0;
+  int open_files = 0;
+  std::uintmax_t mapped_bytes = 0;
+  std::uintmax_t readahead_bytes = 0;
+  std::uintmax_t buffered_bytes = 0;
+  double min_fill = 1.0;
+  long long slow_reads = 0;
+  double max_read_ms = 0.0;
+};
+
+std::uintmax_t readahead_from_env();
+
+// Read-only ma_vfs that maps each audio file instead of going through stdio.
+// Decoder reads become a copy out of the page cache with no read() syscall,
+// and a replayed album is served from pages the kernel already holds.
+//
+// A read-ahead thread faults in a window of pages past each file's cursor, so
+// slow storage (NFS, USB disks) stalls that thread instead of the decoder.
+// A file truncated or lost while mapped fails its reads instead of taking the
+// process down. Files that cannot be mapped, and every file on Windows, are
+// read through stdio instead.
+class MmapVfs {
+private:
+  struct MappedFile {
+    const unsigned char *data = nullptr;
+    std::FILE *stream = nullptr;
+    size_t stream_at = 0;
+    size_t size = 0;
+    std::atomic<size_t> cursor{0};
+    std::atomic<size_t> prefetched_to{0};
+    size_t prefetched_from = 0;
+    std::atomic<bool> faulted{false};
+    ~MappedFile();
+  };
+
+  // miniaudio reads the callbacks through the ma_vfs pointer, so they come
+  // first; the owner is found behind them.
+  struct Callbacks {
+    ma_vfs_callbacks cb;
+    MmapVfs *self;
+  };
+
+  Callbacks callbacks;
+  std::atomic<long long> opens{0};
+  std::atomic<long long> slow_reads{0};
+  std::atomic<long long> max_read_us{0};
+  std::atomic<std::uintmax_t> readahead_bytes;
+
+  mutable std::mutex mutex;
+  std::vector<std::shared_ptr<MappedFile>> files;
+  std::condition_variable wake;
+  std::thread prefetcher;
+  std::atomic<bool> stop_requested{false};
+
+  void run();
+  bool prefetch(MappedFile &file, size_t window);
+  void note_read(MappedFile &file, size_t end, long long us);
+  static MmapVfs *owner(ma_vfs *vfs);
+
+  static ma_result on_open(ma_vfs *vfs, const char *path, ma_uint32 mode,
+                           ma_vfs_file *file);
+  static ma_result on_open_w(ma_vfs *vfs, const wchar_t *path, ma_uint32 mode,
+                             ma_vfs_file *file);
+  static ma_result on_close(ma_vfs *vfs, ma_vfs_file file);
+  static ma_result on_read(ma_vfs *vfs, ma_vfs_file file, void *dst,
+                           size_t bytes, size_t *bytes_read);
+  static ma_result on_write(ma_vfs *vfs, ma_vfs_file file, const void *src,
+                            size_t bytes, size_t *bytes_written);
+  static ma_result on_seek(ma_vfs *vfs, ma_vfs_file file, ma_int64 offset,
+                           ma_seek_origin origin);
+  static ma_result on_tell(ma_vfs *vfs, ma_vfs_file file, ma_int64 *cursor);
+  static ma_result on_info(ma_vfs *vfs, ma_vfs_file file, ma_file_info *info);
+
+public:
+  MmapVfs(std::uintmax_t readahead_bytes = readahead_from_env());
+  ~MmapVfs();
+  MmapVfs(const MmapVfs &) = delete;
+  MmapVfs &operator=(const MmapVfs &) = delete;
+
+  ma_vfs *vfs() { return &callbacks; }
+  void set_readahead(std::uintmax_t bytes);
+  MmapVfsStats get_stats() const;
+};
@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Bounded multi-producer/single-consumer ring (sequence-numbered cells), so
+// any thread can post without taking a lock while one consumer drains it.
+template <typename T, size_t Capacity> class MpscQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "MpscQueue capacity must be a power of two");
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  Cell cells[Capacity];
+  alignas(64) std::atomic<size_t> tail{0};
+  alignas(64) size_t head = 0;
+
+public:
+  MpscQueue() {
+    for (size_t i = 0; i < Capacity; ++i) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  bool push(T value) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+      cell = &cells[pos & (Capacity - 1)];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      long long diff =
+          static_cast<long long>(seq) - static_cast<long long>(pos);
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->value = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &value) {
+    Cell &cell = cells[head & (Capacity - 1)];
+    if (cell.sequence.load(std::memory_order_acquire) != head + 1) {
+      return false;
+    }
+
+    value = std::move(cell.value);
+    cell.sequence.store(head + Capacity, std::memory_order_release);
+    ++head;
+    return true;
+  }
+
+  bool empty() const {
+    const Cell &cell = cells[head & (Capacity - 1)];
+    return cell.sequence.load(std::memory_order_acquire) != head + 1;
+  }
+};
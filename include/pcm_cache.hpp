@@ -0,0 +1,77 @@
+#pragma once
+#include "miniaudio/miniaudio.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct CachedPcm {
+  ma_format format = ma_format_unknown;
+  ma_uint32 channels = 0;
+  ma_uint32 sample_rate = 0;
+  ma_uint64 frames = 0;
+  std::vector<unsigned char> data;
+};
+
+struct PcmCacheStats {
+  long long hits = 0;
+  long long misses = 0;
+  long long evictions = 0;
+  int entries = 0;
+  std::uintmax_t bytes = 0;
+  std::uintmax_t budget_bytes = 0;
+};
+
+// Byte-budgeted LRU of fully decoded tracks keyed by track id. Decoding for
+// requested tracks happens on a background worker; lookups never block on it.
+class PcmCache {
+private:
+  struct Entry {
+    int track_id;
+    std::shared_ptr<const CachedPcm> pcm;
+  };
+
+  struct Request {
+    int track_id;
+    std::string path;
+  };
+
+  std::mutex mutex;
+  std::list<Entry> lru;
+  std::unordered_map<int, std::list<Entry>::iterator> index;
+  std::uintmax_t budget_bytes;
+  ma_vfs *vfs;
+  std::uintmax_t used_bytes = 0;
+  long long hits = 0;
+  long long misses = 0;
+  long long evictions = 0;
+
+  std::deque<Request> pending;
+  std::condition_variable wake;
+  std::thread worker;
+  std::atomic<bool> stop_requested{false};
+
+  void run();
+  void insert(int track_id, std::shared_ptr<const CachedPcm> pcm);
+  void evict_to(std::uintmax_t limit);
+  std::shared_ptr<CachedPcm> decode(const std::string &path,
+                                    std::uintmax_t max_bytes);
+
+public:
+  PcmCache(std::uintmax_t budget_bytes, ma_vfs *vfs = nullptr);
+  ~PcmCache();
+
+  std::shared_ptr<const CachedPcm> get(int track_id);
+  void request(int track_id, const std::string &path);
+  void set_budget(std::uintmax_t bytes);
+  std::uintmax_t get_used_bytes();
+  PcmCacheStats get_stats();
+};
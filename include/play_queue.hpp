@@ -0,0 +1,31 @@
+#pragma once
+#include "db.hpp"
+
+#include <mutex>
+#include <random>
+#include <vector>
+
+// Track order shared by the UI and the playback control thread. The next
+// track is chosen once and remembered, so the track that was preloaded is
+// the one that is advanced to even in shuffle mode.
+class PlayQueue {
+private:
+  std::mutex mutex;
+  std::vector<Track> tracks;
+  int current_idx = -1;
+  int next_idx = -1;
+  bool shuffle = false;
+  bool repeat = false;
+  std::mt19937 rng{std::random_device{}()};
+
+  int index_of(int track_id) const;
+  int pick_next();
+
+public:
+  void set_tracks(const std::vector<Track> &all_tracks);
+  void set_modes(bool shuffle, bool repeat);
+  void set_current(int track_id);
+  bool peek_next(Track &track);
+  bool advance(Track &track);
+  bool step_back(Track &track);
+};
@@ -2,7 +2,13 @@
 
 #include "audio.hpp"
 #include "db.hpp"
+#include "fingerprint.hpp"
 #include "glad/glad.h"
+#include "loudness.hpp"
+#include "maintenance.hpp"
+#include "spectrum.hpp"
+#include "tempo.hpp"
+#include "waveform.hpp"
 #include <GLFW/glfw3.h>
 #include <string>
 
@@ -19,4 +25,15 @@ void render_playlist_track_list(Database &main_database, Music &main_player,
                                 std::vector<Playlist> &ALL_PLAYLISTS,
                                 Track &current_song,
                                 Playlist &current_playlist);
+void render_diagnostics(Database &main_database,
+                        MaintenanceScheduler &maintenance, Music &main_player,
+                        LoudnessAnalyzer &loudness, TempoKeyAnalyzer &tempo,
+                        const SpectrumAnalyzer &spectrum,
+                        WaveformCache &waveforms);
+void render_spectrum(const SpectrumAnalyzer &spectrum);
+bool render_waveform_seek(const WaveformView &waveform, float *value,
+                          float total);
+void render_equalizer(Music &main_player);
+void render_duplicates(DuplicateFinder &finder, Music &main_player,
+                       Track &current_song);
 std::string format_time(float seconds);
\ No newline at end of file
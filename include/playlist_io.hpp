@@ -0,0 +1,28 @@
+#pragma once
+#include "db.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+enum class PlaylistFormat { M3U, PLS, XSPF, Unknown };
+
+struct PlaylistEntry {
+  std::string location;
+  std::string title;
+  int duration = -1;
+};
+
+struct PlaylistImportResult {
+  int playlist_id = -1;
+  int entries = 0;
+  int matched = 0;
+  std::vector<std::string> unmatched;
+};
+
+PlaylistFormat playlist_format_from_path(const std::string &path);
+int parse_playlist(const std::string &path,
+                   const std::function<void(const PlaylistEntry &)> &on_entry);
+int import_playlist(Database &db, const std::string &path,
+                    PlaylistImportResult &result);
+int export_playlist(const Playlist &playlist, const std::string &path);
@@ -0,0 +1,71 @@
+#pragma once
+#include <sqlite3.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+constexpr int QUERY_HISTOGRAM_BUCKETS = 16;
+
+struct QueryStat {
+  std::string sql;
+  long long calls = 0;
+  long long rows = 0;
+  long long fullscan_steps = 0;
+  double total_ms = 0.0;
+  double max_ms = 0.0;
+  std::array<long long, QUERY_HISTOGRAM_BUCKETS> histogram{};
+};
+
+struct RunningQuery {
+  std::chrono::steady_clock::time_point started;
+  long long rows = 0;
+};
+
+class QueryStats;
+
+// Statements in flight on one connection. SQLite runs a connection's trace
+// callbacks on whichever thread is using it, one at a time, so this needs no
+// lock; only finished statements are merged into the shared totals.
+struct TracedConnection {
+  QueryStats *owner = nullptr;
+  std::unordered_map<sqlite3_stmt *, RunningQuery> running;
+};
+
+class QueryStats {
+private:
+  std::mutex mutex;
+  std::unordered_map<std::string, QueryStat> stats;
+  std::unordered_map<sqlite3 *, std::unique_ptr<TracedConnection>>
+      connections;
+  std::unordered_set<std::string> explained;
+  std::vector<std::string> pending_plans;
+  std::atomic<bool> debug{false};
+
+  static int trace(unsigned type, void *context, void *p, void *x);
+  void record(TracedConnection &connection, sqlite3_stmt *stmt, long long ns);
+
+public:
+  static QueryStats &instance();
+  static int bucket_for(double ms);
+  static double bucket_upper_ms(int bucket);
+  static double percentile_ms(const QueryStat &stat, double q);
+
+  void attach(sqlite3 *db);
+  void detach(sqlite3 *db);
+  void set_debug(bool enabled) { debug = enabled; }
+  bool get_debug() const { return debug; }
+  // Logs the plans of newly seen full-scan statements, prepared on db, which
+  // must belong to the calling thread.
+  void explain_pending(sqlite3 *db);
+  std::vector<QueryStat> snapshot();
+  void reset();
+  void dump(std::ostream &out);
+};
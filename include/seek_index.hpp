@@ -0,0 +1,67 @@
+#pragma once
+#include "db.hpp"
+#include "miniaudio/miniaudio.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// Only MP3 needs one: without a table dr_mp3 seeks by walking every frame
+// header from the start of the file. FLAC bisects on its frame headers and
+// WAV seeks by arithmetic, so both are already fast.
+bool supports_seek_index(const std::string &path);
+
+// Scans the frame headers once (nothing is decoded) and places a point every
+// points_per_second of audio. Defined in audio.cpp, the translation unit that
+// compiles miniaudio and so can see dr_mp3's types.
+bool build_mp3_seek_index(const std::string &path, SeekIndex &index,
+                          double points_per_second);
+// Hands the table to the decoder's dr_mp3 instance, which keeps a pointer to
+// it, so `points` must outlive the decoder. A nonzero total_frames also
+// stands in for the frame count of a file without a Xing header, which dr_mp3
+// would otherwise scan the whole file for; pass it only before the decoder is
+// first read. Fails if the decoder is not decoding MP3.
+bool bind_mp3_seek_index(ma_decoder *decoder, std::vector<SeekPoint> &points,
+                         ma_uint64 total_frames);
+
+struct SeekIndexStats {
+  int built = 0;
+  int failed = 0;
+  int pending = 0;
+  double busy_seconds = 0.0;
+};
+
+// Builds seek indexes the first time each MP3 plays, one at a time on a
+// low-priority thread, and stores them through its own connection.
+class SeekIndexer {
+private:
+  struct Request {
+    int track_id;
+    std::string path;
+  };
+
+  Database db;
+  std::mutex mutex;
+  std::deque<Request> pending;
+  std::unordered_set<int> done;
+  SeekIndexStats stats;
+  std::condition_variable wake;
+  std::thread worker;
+  std::atomic<bool> stop_requested{false};
+
+  void run();
+
+public:
+  explicit SeekIndexer(const char *db_path);
+  ~SeekIndexer();
+  SeekIndexer(const SeekIndexer &) = delete;
+  SeekIndexer &operator=(const SeekIndexer &) = delete;
+
+  void request(int track_id, const std::string &path);
+  SeekIndexStats get_stats();
+};
@@ -0,0 +1,54 @@
+#pragma once
+#include "audio_tap.hpp"
+#include "fft.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+struct SpectrumStats {
+  long long updates = 0;
+  double us_per_update = 0.0;
+  double core_percent = 0.0;
+};
+
+// UI-side consumer of the output tap: a Hann-windowed FFT of the latest
+// frames folded into log-spaced bands, plus RMS and peak meters for both
+// channels. All buffers are sized up front; update() runs on the UI thread
+// once per frame and never touches the audio thread beyond the tap's ring.
+class SpectrumAnalyzer {
+public:
+  static constexpr size_t fft_size = 2048;
+  static const int band_count = 48;
+  static constexpr float floor_db = -90.0f;
+
+private:
+  RealFft fft;
+  std::vector<float> window;
+  std::vector<float> frames;
+  std::vector<float> mono;
+  std::vector<float> power;
+  std::vector<size_t> band_edges;
+  ma_uint32 band_rate = 0;
+
+  float bands[band_count];
+  float rms_db[2] = {floor_db, floor_db};
+  float peak_db[2] = {floor_db, floor_db};
+  std::uint64_t last_written = 0;
+
+  long long updates = 0;
+  long long busy_ns = 0;
+  std::chrono::steady_clock::time_point first_update;
+
+  void layout_bands(ma_uint32 sample_rate);
+  void measure_levels(const float *recent, size_t count, float dt);
+
+public:
+  SpectrumAnalyzer();
+
+  void update(const AudioTap &tap, float dt);
+  const float *get_bands() const { return bands; }
+  float get_rms_db(int channel) const { return rms_db[channel]; }
+  float get_peak_db(int channel) const { return peak_db[channel]; }
+  SpectrumStats get_stats() const;
+};
@@ -0,0 +1,151 @@
+#pragma once
+#include "db.hpp"
+#include "fft.hpp"
+#include "worker_pool.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Keys are numbered 0-11 for C..B major and 12-23 for C..B minor; -1 is
+// unknown (silence, speech, unpitched material).
+const char *key_name(int key);
+const char *camelot_name(int key);
+
+// Estimates tempo and key from mono audio at analysis_rate.
+//
+// Tempo: a spectral-flux onset envelope (log-magnitude increases summed over
+// 24 log-spaced bands, 1024-point frames every 128 samples) is
+// autocorrelated; each lag in the 60-200 BPM range is scored together with
+// its multiples and weighted toward 120 BPM to settle octave ambiguity, then
+// refined to a fraction of a frame using the longer multiples.
+//
+// Key: 4096-point spectra between 100 Hz and 2.5 kHz are folded into a
+// per-frame normalized chroma vector, summed over the track and correlated
+// with the Krumhansl-Kessler major and minor profiles in all 12 rotations.
+class TempoKeyDetector {
+public:
+  static const int analysis_rate = 11025;
+
+private:
+  static const size_t onset_size = 1024;
+  static const size_t onset_hop = 128;
+  static const size_t chroma_size = 4096;
+  static const size_t chroma_hop = 2048;
+  static const int onset_bands = 24;
+  static const size_t max_print_frames = 646;
+
+  RealFft onset_fft;
+  RealFft chroma_fft;
+  std::vector<float> onset_window;
+  std::vector<float> chroma_window;
+  std::vector<float> frame;
+  std::vector<float> power;
+  std::vector<float> last_log;
+  std::vector<int> bin_band;
+  std::vector<int> bin_class;
+  std::vector<float> bin_weight;
+  std::vector<float> samples;
+  size_t onset_pos = 0;
+  size_t chroma_pos = 0;
+  std::vector<float> envelope;
+  double chroma[12] = {};
+  std::vector<float> print_chroma;
+
+  void onset_frame(const float *x);
+  void chroma_frame(const float *x);
+
+public:
+  TempoKeyDetector();
+
+  void add(const float *mono, size_t count);
+  // 0 when there is no steady beat.
+  double bpm() const;
+  int key() const;
+  // Unnormalized chroma of each frame, 12 values a frame, from the first
+  // audible frame through the next two minutes; input for the fingerprint.
+  const std::vector<float> &frame_chroma() const { return print_chroma; }
+};
+
+// Holds the calling thread to a share of one core by sleeping in proportion
+// to the CPU time it used since the last call.
+class CpuThrottle {
+private:
+  double share;
+  double last_cpu;
+  double owed = 0.0;
+
+public:
+  explicit CpuThrottle(double share);
+  void pace();
+};
+
+// Share of the machine the analysis may use, from
+// MUSIC_PLAYR_ANALYSIS_CPU_PERCENT (default 50).
+double analysis_cpu_fraction_from_env();
+
+struct TempoKeyResult {
+  double bpm = 0.0;
+  int key = -1;
+  double seconds = 0.0;
+  std::vector<std::uint32_t> fingerprint;
+};
+
+bool measure_tempo_key(const std::string &path, TempoKeyResult &result,
+                       const std::atomic<bool> *cancel = nullptr,
+                       CpuThrottle *throttle = nullptr);
+
+struct TempoKeyStats {
+  int analyzed = 0;
+  int failed = 0;
+  int pending = 0;
+  double audio_seconds = 0.0;
+  double busy_seconds = 0.0;
+  double cpu_percent = 0.0;
+  int workers = 0;
+};
+
+struct TrackTempoKey {
+  int track_id;
+  double bpm;
+  int key;
+};
+
+// Estimates tempo and key, and computes the acoustic fingerprint from the
+// same chroma, for every track missing either on a WorkerPool. Each result
+// is stored as soon as it is ready, so an interrupted run picks up where it
+// stopped. Each worker is throttled so that together they stay within the
+// configured share of the machine.
+class TempoKeyAnalyzer {
+private:
+  WorkerPool &pool;
+  Database db;
+  std::mutex db_mutex;
+  double worker_share = 1.0;
+
+  std::mutex mutex;
+  std::condition_variable idle;
+  std::atomic<bool> stopping{false};
+  int in_flight = 0;
+  std::unordered_set<int> queued;
+  std::unordered_set<int> failed_ids;
+  std::vector<TrackTempoKey> finished;
+  TempoKeyStats stats;
+
+  void analyze(int track_id, const std::string &path);
+
+public:
+  TempoKeyAnalyzer(const std::string &db_path, WorkerPool &pool);
+  ~TempoKeyAnalyzer();
+  TempoKeyAnalyzer(const TempoKeyAnalyzer &) = delete;
+  TempoKeyAnalyzer &operator=(const TempoKeyAnalyzer &) = delete;
+
+  void rescan();
+  // Results stored since the last call, for updating tracks already loaded.
+  std::vector<TrackTempoKey> take_finished();
+  TempoKeyStats get_stats();
+};
@@ -0,0 +1,112 @@
+#pragma once
+#include "miniaudio/miniaudio.h"
+
+#include <atomic>
+#include <vector>
+
+struct StretchTimings {
+  std::atomic<long long> audio_us{0};
+  std::atomic<long long> busy_ns{0};
+};
+
+struct TimeStretchStats {
+  float speed = 1.0f;
+  double stretched_seconds = 0.0;
+  double us_per_second = 0.0;
+};
+
+// ma_data_source that plays another one faster or slower at the same pitch,
+// by WSOLA: every hop of output is a raised-cosine crossfade from the natural
+// continuation of the last segment into a new one taken near where the speed
+// says playback should be, shifted within the search window to the offset
+// whose waveform best lines up with that continuation. The offset is found
+// on a 4x decimated mono mix first and refined at full rate.
+//
+// Input is pulled on demand, so there is no added latency, and the cursor and
+// length stay in the wrapped source's frames: a sound playing through it
+// reports its position in the track, not in elapsed time. At 1x it reads
+// straight through, once the frames it already holds have played out.
+class TimeStretchSource {
+public:
+  static constexpr float min_speed = 0.5f;
+  static constexpr float max_speed = 2.0f;
+
+private:
+  ma_data_source_base base;
+  ma_data_source *inner = nullptr;
+  ma_format inner_format = ma_format_unknown;
+  ma_uint32 channels = 0;
+  ma_uint32 sample_rate = 0;
+  StretchTimings *timings = nullptr;
+  bool initialized = false;
+
+  std::atomic<float> speed{1.0f};
+  std::atomic<bool> engaged{false};
+  std::atomic<ma_uint64> position{0};
+
+  // Audio side. Positions are in the wrapped source's frames.
+  size_t hop = 0;
+  size_t search = 0;
+  std::vector<float> ramp;
+  std::vector<unsigned char> raw;
+  std::vector<float> input;
+  size_t input_capacity = 0;
+  ma_uint64 input_start = 0;
+  size_t input_frames = 0;
+  bool input_ended = false;
+  ma_uint64 tail = 0;
+  double nominal = 0.0;
+  bool first_step = true;
+  bool finished = false;
+  bool leaving = false;
+  std::vector<float> block;
+  size_t block_frames = 0;
+  size_t block_pos = 0;
+  double block_start = 0.0;
+  float block_speed = 1.0f;
+  std::vector<float> reference;
+  std::vector<float> region;
+  std::vector<float> coarse_reference;
+  std::vector<float> coarse_region;
+  std::vector<double> coarse_energy;
+
+  void reset();
+  void engage();
+  ma_result read_inner(float *frames, ma_uint64 count, ma_uint64 *read);
+  void fill(ma_uint64 end);
+  bool step(float s);
+  void hand_back();
+  void mono(ma_uint64 from, size_t count, float *out) const;
+  ma_uint64 best_start(ma_uint64 lo, ma_uint64 hi);
+  ma_result read(float *frames, ma_uint64 count, ma_uint64 *read);
+
+  static ma_data_source_vtable vtable;
+  static ma_result on_read(ma_data_source *source, void *frames,
+                           ma_uint64 count, ma_uint64 *read);
+  static ma_result on_seek(ma_data_source *source, ma_uint64 frame);
+  static ma_result on_get_data_format(ma_data_source *source,
+                                      ma_format *format, ma_uint32 *channels,
+                                      ma_uint32 *sample_rate,
+                                      ma_channel *channel_map,
+                                      size_t channel_map_cap);
+  static ma_result on_get_cursor(ma_data_source *source, ma_uint64 *cursor);
+  static ma_result on_get_length(ma_data_source *source, ma_uint64 *length);
+
+public:
+  TimeStretchSource() = default;
+  TimeStretchSource(const TimeStretchSource &) = delete;
+  TimeStretchSource &operator=(const TimeStretchSource &) = delete;
+  ~TimeStretchSource() { uninit(); }
+
+  // The wrapped source must already know its format. Its range may still be
+  // set before playback starts; after that it is read and seeked only
+  // through this one.
+  ma_result init(ma_data_source *source, StretchTimings *timings);
+  void uninit();
+  ma_data_source *source() { return &base; }
+  ma_data_source *wrapped() { return inner; }
+
+  // Takes effect from the next hop, without a seek.
+  void set_speed(float s);
+  float get_speed() const { return speed.load(); }
+};
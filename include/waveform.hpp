@@ -0,0 +1,134 @@
+#pragma once
+#include "worker_pool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// On-disk peak pyramid. Level 0 summarizes every bucket_frames frames; each
+// level above merges pairs of the one below, down to a single bucket.
+//
+//   WaveformHeader
+//   WaveformLevel[levels]
+//   WaveformBucket[...]   every level back to back, finest first
+struct WaveformHeader {
+  char magic[4];
+  std::uint32_t version;
+  std::uint32_t sample_rate;
+  std::uint32_t bucket_frames;
+  std::uint64_t frames;
+  std::uint32_t levels;
+  std::uint32_t reserved;
+};
+
+struct WaveformLevel {
+  std::uint64_t first;
+  std::uint64_t count;
+};
+
+// Min and max as signed 8-bit sample values, RMS as unsigned 8-bit.
+struct WaveformBucket {
+  std::int8_t min;
+  std::int8_t max;
+  std::uint8_t rms;
+  std::uint8_t reserved;
+};
+
+struct WaveformSpan {
+  float min = 0.0f;
+  float max = 0.0f;
+  float rms = 0.0f;
+};
+
+// Read-only mapping of a peak file; on Windows, a copy of it in memory.
+class WaveformView {
+private:
+  const unsigned char *data = nullptr;
+  size_t size = 0;
+  std::vector<unsigned char> copy;
+  const WaveformHeader *header = nullptr;
+  const WaveformLevel *levels = nullptr;
+  const WaveformBucket *buckets = nullptr;
+
+  WaveformView() = default;
+
+public:
+  ~WaveformView();
+  WaveformView(const WaveformView &) = delete;
+  WaveformView &operator=(const WaveformView &) = delete;
+
+  static std::shared_ptr<const WaveformView> open(const std::string &file);
+
+  double seconds() const;
+  size_t mapped_bytes() const { return size; }
+  // Summary of [from, to) seconds from the coarsest level whose buckets
+  // still fit inside the span, so the cost per call stays small at any zoom.
+  WaveformSpan span(double from, double to) const;
+};
+
+// Sampled 64-bit FNV-1a over the file size and its first, middle and last
+// 64 KiB, as 16 hex digits. Retagging or replacing the file changes it;
+// renaming or moving it does not.
+std::string content_fingerprint(const std::string &path);
+
+bool build_waveform(const std::string &audio_path, const std::string &out_file,
+                    const std::atomic<bool> *cancel = nullptr);
+
+struct WaveformStats {
+  int mapped = 0;
+  int built = 0;
+  int loaded = 0;
+  int failed = 0;
+  int pending = 0;
+  std::uintmax_t mapped_bytes = 0;
+  double build_seconds = 0.0;
+};
+
+// Hands out peak pyramids for the UI without blocking it. A miss queues an
+// urgent job on the worker pool that fingerprints the file, builds the
+// pyramid if the cache directory has none, and maps it. A few recent
+// mappings are kept open. A file that failed is tried again after a while,
+// so one that was offline or still being copied gets its waveform later.
+class WaveformCache {
+private:
+  // An entry without a view is still loading, or failed to load.
+  struct Entry {
+    std::shared_ptr<const WaveformView> view;
+    std::list<std::string>::iterator lru;
+    bool failed = false;
+    std::chrono::steady_clock::time_point failed_at;
+  };
+
+  WorkerPool &pool;
+  std::string dir;
+
+  std::mutex mutex;
+  std::condition_variable idle;
+  std::atomic<bool> stopping{false};
+  int in_flight = 0;
+  std::unordered_map<std::string, Entry> entries;
+  std::list<std::string> lru;
+  WaveformStats stats;
+
+  void load(const std::string &audio_path);
+  void evict();
+
+public:
+  WaveformCache(const std::string &dir, WorkerPool &pool);
+  ~WaveformCache();
+  WaveformCache(const WaveformCache &) = delete;
+  WaveformCache &operator=(const WaveformCache &) = delete;
+
+  std::shared_ptr<const WaveformView> get(const std::string &audio_path);
+  WaveformStats get_stats();
+};
+
+// MUSIC_PLAYR_WAVEFORM_DIR, or a "waveforms" directory beside the database.
+std::string waveform_dir_from_env(const std::string &db_path);
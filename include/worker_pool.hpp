@@ -0,0 +1,41 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Drops the calling thread to the lowest scheduling priority the platform
+// offers: SCHED_IDLE on Linux, background QoS on macOS, idle on Windows.
+void lower_thread_priority();
+
+// Fixed set of background threads for batch work such as library analysis.
+// Workers run at idle scheduling priority so they only use CPU time that
+// playback and the UI leave free.
+class WorkerPool {
+private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> jobs;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stop_requested = false;
+  std::atomic<int> busy{0};
+
+  void run();
+
+public:
+  WorkerPool(int threads = default_threads());
+  ~WorkerPool();
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  // Urgent jobs go to the front of the queue, ahead of batch work.
+  void submit(std::function<void()> job, bool urgent = false);
+  int size() const { return static_cast<int>(workers.size()); }
+  int pending();
+  int active() const { return busy; }
+
+  static int default_threads();
+};
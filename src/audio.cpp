@@ -1,5 +1,8 @@
 #include "db.hpp"
 #include "miniaudio/miniaudio.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <cstdio>
 #include <cstdlib>
@@ -12,101 +15,1090 @@
 #define MINIAUDIO_IMPLEMENTATION
 #include "audio.hpp"
 
-Music::Music() {
-  if (ma_engine_init(NULL, &engine) != MA_SUCCESS) {
+static const ma_uint32 sound_flags =
+    MA_SOUND_FLAG_NO_PITCH | MA_SOUND_FLAG_NO_SPATIALIZATION;
+static const int default_idle_seconds = 10;
+static const ma_uint32 max_seek_points = 1 << 16;
+
+static_assert(sizeof(SeekPoint) == sizeof(ma_dr_mp3_seek_point) &&
+                  offsetof(SeekPoint, byte_offset) ==
+                      offsetof(ma_dr_mp3_seek_point, seekPosInBytes) &&
+                  offsetof(SeekPoint, pcm_frame) ==
+                      offsetof(ma_dr_mp3_seek_point, pcmFrameIndex) &&
+                  offsetof(SeekPoint, mp3_frames_to_discard) ==
+                      offsetof(ma_dr_mp3_seek_point, mp3FramesToDiscard) &&
+                  offsetof(SeekPoint, pcm_frames_to_discard) ==
+                      offsetof(ma_dr_mp3_seek_point, pcmFramesToDiscard),
+              "SeekPoint must match dr_mp3's seek point layout");
+
+bool build_mp3_seek_index(const std::string &path, SeekIndex &index,
+                          double points_per_second) {
+  auto mp3 = std::make_unique<ma_dr_mp3>();
+  if (!ma_dr_mp3_init_file(mp3.get(), path.c_str(), NULL)) {
+    return false;
+  }
+
+  // Free when the file has a Xing/LAME header, otherwise one extra pass.
+  ma_uint64 frames = ma_dr_mp3_get_pcm_frame_count(mp3.get());
+  double seconds =
+      mp3->sampleRate > 0 ? static_cast<double>(frames) / mp3->sampleRate : 0;
+  ma_uint32 count = static_cast<ma_uint32>(std::clamp(
+      seconds * points_per_second, 1.0, static_cast<double>(max_seek_points)));
+
+  std::vector<SeekPoint> points(count);
+  bool ok = frames > 0 &&
+            ma_dr_mp3_calculate_seek_points(
+                mp3.get(), &count,
+                reinterpret_cast<ma_dr_mp3_seek_point *>(points.data()));
+  ma_dr_mp3_uninit(mp3.get());
+  if (!ok) {
+    return false;
+  }
+
+  points.resize(count);
+  index.total_frames = frames;
+  index.points = std::move(points);
+  return true;
+}
+
+bool bind_mp3_seek_index(ma_decoder *decoder, std::vector<SeekPoint> &points,
+                         ma_uint64 total_frames) {
+  if (decoder->pBackend == NULL ||
+      decoder->pBackendVTable != &g_ma_decoding_backend_vtable_mp3 ||
+      points.empty()) {
+    return false;
+  }
+  ma_mp3 *mp3 = static_cast<ma_mp3 *>(decoder->pBackend);
+  // Only a file without a LAME header has an unknown count, and so no
+  // encoder delay or padding for dr_mp3 to take off it.
+  if (total_frames > 0 && mp3->dr.totalPCMFrameCount == MA_UINT64_MAX) {
+    mp3->dr.totalPCMFrameCount = total_frames;
+  }
+  return ma_dr_mp3_bind_seek_table(
+      &mp3->dr, static_cast<ma_uint32>(points.size()),
+      reinterpret_cast<ma_dr_mp3_seek_point *>(points.data()));
+}
+
+static std::chrono::milliseconds idle_timeout_from_env() {
+  const char *value = std::getenv("MUSIC_PLAYR_IDLE_SECONDS");
+  int seconds = value != nullptr ? std::atoi(value) : default_idle_seconds;
+  if (seconds < 0) {
+    seconds = default_idle_seconds;
+  }
+  return std::chrono::milliseconds(seconds * 1000);
+}
+
+Music::Music(PlayQueue *play_queue) : queue(play_queue) {
+  ma_engine_config config = ma_engine_config_init();
+  config.pResourceManagerVFS = file_vfs.vfs();
+
+  if (ma_engine_init(&config, &engine) != MA_SUCCESS) {
     std::cerr << "Failed to init engine\n";
+  } else if (tap.init(&engine) != MA_SUCCESS) {
+    std::cerr << "Failed to init output tap\n";
+  } else if (limiter.init(&engine, tap.node()) != MA_SUCCESS) {
+    std::cerr << "Failed to init limiter\n";
+  } else if (equalizer.init(&engine, limiter.node()) != MA_SUCCESS) {
+    std::cerr << "Failed to init equalizer\n";
+  } else if (crossfader.init(&engine, equalizer.node()) != MA_SUCCESS) {
+    std::cerr << "Failed to init crossfader\n";
+  } else {
+    device_running = true;
   }
-  all_track_vector = music_db.get_all_tracks();
+  idle_timeout = idle_timeout_from_env();
+  idle_since = std::chrono::steady_clock::now();
+  publish();
+
+  control_running = true;
+  control = std::thread(&Music::control_loop, this);
 };
 
 Music::~Music() {
-  ma_sound_uninit(&sound);
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex);
+    control_running = false;
+  }
+  wake.notify_all();
+  if (control.joinable()) {
+    control.join();
+  }
+
+  unload(0);
+  unload(1);
+  crossfader.uninit();
+  equalizer.uninit();
+  limiter.uninit();
+  tap.uninit();
   ma_engine_uninit(&engine);
 };
 
-void Music::play(const std::string filepath, int track_id) {
-  if (state == PlaybackState::Paused) {
-    ma_sound_start(&sound);
-    state = PlaybackState::Playing;
+void Music::on_sound_end(void *user_data, ma_sound *sound) {
+  Music *self = static_cast<Music *>(user_data);
+  DeckEvent event;
+  event.deck = static_cast<int>(sound - self->decks);
+  event.at = std::chrono::steady_clock::now();
+  self->events.push(event);
+}
+
+// Only starts the load: the deck's sound is created by finish_open once the
+// source is ready, so the control thread never waits on decoder setup.
+ma_result Music::open_deck(int deck, const std::string &filepath,
+                           int track_id) {
+  music_db.get_track_loudness(track_id, deck_loudness[deck]);
+  deck_gain[deck] = loudness_gain(deck_loudness[deck], gain_mode);
+  music_db.get_track_audible_range(track_id, deck_range[deck]);
+
+  deck_pcm[deck] = pcm_cache.get(track_id);
+  if (deck_pcm[deck] != nullptr) {
+    const CachedPcm &pcm = *deck_pcm[deck];
+    ma_audio_buffer_config buffer_config = ma_audio_buffer_config_init(
+        pcm.format, pcm.channels, pcm.frames, pcm.data.data(), NULL);
+    buffer_config.sampleRate = pcm.sample_rate;
+    if (ma_audio_buffer_init(&buffer_config, &deck_buffer[deck]) ==
+        MA_SUCCESS) {
+      deck_choice[deck] = DecodeChoice();
+      deck_choice[deck].mode = DecodeMode::Cached;
+    } else {
+      deck_pcm[deck].reset();
+    }
+  }
+
+  if (deck_pcm[deck] == nullptr) {
+    // The sound's own load flags are the resource manager's, bit for bit.
+    ma_resource_manager_data_source_config source_config =
+        ma_resource_manager_data_source_config_init();
+    source_config.pFilePath = filepath.c_str();
+    source_config.flags = open_flags(deck, filepath);
+    if (load_seek_index(deck, filepath, track_id) &&
+        deck_choice[deck].mode == DecodeMode::Stream) {
+      // The index already has the length the job thread would scan for.
+      source_config.flags |= MA_SOUND_FLAG_UNKNOWN_LENGTH;
+    }
+    ma_result result = ma_resource_manager_data_source_init_ex(
+        ma_engine_get_resource_manager(&engine), &source_config,
+        &deck_file[deck]);
+    if (result != MA_SUCCESS) {
+      deck_index[deck] = SeekIndex();
+      return result;
+    }
+    deck_file_open[deck] = true;
+  }
+
+  deck_path[deck] = filepath;
+  return MA_SUCCESS;
+}
+
+// Runs once load_result reports the source loaded. The stretcher needs the
+// source's format, which an asynchronous load only knows from here on.
+ma_result Music::finish_open(int deck) {
+  if (deck_ready[deck]) {
+    return MA_SUCCESS;
+  }
+
+  ma_data_source *source = &deck_buffer[deck];
+  if (deck_file_open[deck]) {
+    bind_seek_index(deck);
+    source = &deck_file[deck];
+  }
+
+  ma_sound_config config = ma_sound_config_init_2(&engine);
+  config.pInitialAttachment = crossfader.node();
+  config.initialAttachmentInputBusIndex = deck;
+  config.flags = sound_flags;
+
+  // Every deck plays through its stretcher, which passes audio straight
+  // through at 1x.
+  ma_result result = deck_stretch[deck].init(source, &stretch_timings);
+  if (result == MA_SUCCESS) {
+    deck_stretch[deck].set_speed(speed);
+    config.pDataSource = deck_stretch[deck].source();
+    result = ma_sound_init_ex(&engine, &config, &decks[deck]);
+  }
+  if (result != MA_SUCCESS) {
+    deck_stretch[deck].uninit();
+    return result;
+  }
+
+  deck_ready[deck] = true;
+  ma_sound_set_end_callback(&decks[deck], on_sound_end, this);
+  apply_volume(deck);
+  apply_trim(deck);
+  ma_data_source_get_length_in_pcm_frames(source, &deck_length[deck]);
+  return MA_SUCCESS;
+}
+
+void Music::close_sources(int deck) {
+  deck_stretch[deck].uninit();
+  if (deck_pcm[deck] != nullptr) {
+    ma_audio_buffer_uninit(&deck_buffer[deck]);
+    deck_pcm[deck].reset();
+  }
+  if (deck_file_open[deck]) {
+    ma_resource_manager_data_source_uninit(&deck_file[deck]);
+    deck_file_open[deck] = false;
+  }
+  deck_index[deck] = SeekIndex();
+}
+
+ma_uint32 Music::open_flags(int deck, const std::string &filepath) {
+  int other = 1 - deck;
+  std::uintmax_t used = pcm_cache.get_used_bytes();
+  if (deck_loaded[other] && deck_path[other] != filepath) {
+    used += deck_resident(other);
+  }
+
+  deck_choice[deck] = choose_decode_mode(filepath, memory_budget, used);
+  return MA_SOUND_FLAG_ASYNC | decode_mode_flags(deck_choice[deck].mode);
+}
+
+// Streamed and in-memory MP3s seek through their stored index. One without
+// an index yet is queued, so it has one the next time it plays or, via
+// upgrade_to_indexed, is seeked.
+bool Music::load_seek_index(int deck, const std::string &filepath,
+                            int track_id) {
+  const DecodeChoice &choice = deck_choice[deck];
+  if ((choice.mode != DecodeMode::Stream &&
+       choice.mode != DecodeMode::Encoded) ||
+      !supports_seek_index(filepath)) {
+    return false;
+  }
+
+  SeekIndex &index = deck_index[deck];
+  if (!music_db.get_seek_index(track_id, index) ||
+      index.file_bytes != choice.file_bytes) {
+    index = SeekIndex();
+    seek_indexer.request(track_id, filepath);
+    return false;
+  }
+  return true;
+}
+
+// The index goes to the decoder the resource manager already runs: a
+// stream's, which reads and seeks on the job thread, or the in-memory file's,
+// which never touches the disk. Seeks then jump to the nearest point instead
+// of walking the file from its start. Runs once the source has loaded and
+// before the deck plays, while nothing else reads the decoder.
+void Music::bind_seek_index(int deck) {
+  SeekIndex &index = deck_index[deck];
+  if (index.points.empty() || load_result(deck) != MA_SUCCESS) {
     return;
   }
 
-  if (state == PlaybackState::Playing) {
-    pause(track_id);
+  if (deck_choice[deck].mode == DecodeMode::Stream) {
+    ma_resource_manager_data_stream &stream = deck_file[deck].backend.stream;
+    if (!bind_mp3_seek_index(&stream.decoder, index.points,
+                             index.total_frames)) {
+      index.points.clear();
+    }
+    // Opened without the length scan, so the length comes from the index.
+    ma_decoder_get_length_in_pcm_frames(&stream.decoder,
+                                        &stream.totalLengthInPCMFrames);
     return;
   }
 
-  ma_result result =
-      ma_sound_init_from_file(&engine, filepath.c_str(), 0, NULL, NULL, &sound);
-  ma_sound_set_volume(&sound, volume);
+  ma_resource_manager_data_buffer &buffer = deck_file[deck].backend.buffer;
+  if (ma_resource_manager_data_buffer_node_get_data_supply_type(
+          buffer.pNode) != ma_resource_manager_data_supply_type_encoded ||
+      !bind_mp3_seek_index(&buffer.connector.decoder, index.points,
+                           index.total_frames)) {
+    index.points.clear();
+  }
+}
+
+// The stream's decoder belongs to the job thread, which may still be busy
+// with an earlier seek, so the table is bound there, between jobs.
+static ma_result bind_on_job_thread(ma_job *job) {
+  bind_mp3_seek_index(reinterpret_cast<ma_decoder *>(job->data.custom.data0),
+                      *reinterpret_cast<std::vector<SeekPoint> *>(
+                          job->data.custom.data1),
+                      0);
+  return MA_SUCCESS;
+}
+
+// A stream that started before its index existed picks it up in place. An
+// in-memory file is decoded on the audio thread, where a table cannot be
+// swapped in safely, so it waits for its next open.
+void Music::upgrade_to_indexed(int deck) {
+  if (!deck_loaded[deck] || !deck_file_open[deck] ||
+      deck_choice[deck].mode != DecodeMode::Stream ||
+      !deck_index[deck].points.empty() ||
+      !supports_seek_index(deck_path[deck]) ||
+      load_result(deck) != MA_SUCCESS) {
+    return;
+  }
+
+  SeekIndex &index = deck_index[deck];
+  if (!music_db.get_seek_index(deck_track_id[deck], index) ||
+      index.file_bytes != deck_choice[deck].file_bytes) {
+    index = SeekIndex();
+    return;
+  }
+
+  ma_job job = ma_job_init(MA_JOB_TYPE_CUSTOM);
+  job.data.custom.proc = bind_on_job_thread;
+  job.data.custom.data0 =
+      reinterpret_cast<ma_uintptr>(&deck_file[deck].backend.stream.decoder);
+  job.data.custom.data1 = reinterpret_cast<ma_uintptr>(&index.points);
+  if (ma_resource_manager_post_job(ma_engine_get_resource_manager(&engine),
+                                   &job) != MA_SUCCESS) {
+    index = SeekIndex();
+  }
+}
+
+// Narrows the deck's data source to the audible range, which moves its
+// start, its end and its reported length together, so the seek bar and the
+// gapless and crossfade scheduling all see the trimmed track. Done once the
+// source has loaded and before the deck starts, so the seek to the first
+// audible frame happens off the audio thread.
+void Music::apply_trim(int deck) {
+  const AudibleRange &range = deck_range[deck];
+  if (!skip_silence || !range.analyzed ||
+      range.end_seconds <= range.start_seconds) {
+    return;
+  }
+
+  ma_data_source *source = deck_stretch[deck].wrapped();
+  ma_uint64 begin = 0;
+  ma_uint64 end = 0;
+  ma_data_source_get_range_in_pcm_frames(source, &begin, &end);
+  if (begin != 0 || end != ~(ma_uint64)0) {
+    return;
+  }
+
+  // Resource manager sources run at the engine rate and cached ones at the
+  // file's own, so the range is stored in seconds.
+  ma_uint32 rate = 0;
+  ma_uint64 length = 0;
+  if (ma_data_source_get_data_format(source, NULL, NULL, &rate, NULL, 0) !=
+          MA_SUCCESS ||
+      rate == 0 ||
+      ma_data_source_get_length_in_pcm_frames(source, &length) != MA_SUCCESS ||
+      length == 0) {
+    return;
+  }
+
+  begin = static_cast<ma_uint64>(range.start_seconds * rate);
+  end = std::min(length,
+                 static_cast<ma_uint64>(std::ceil(range.end_seconds * rate)));
+  if (begin >= end || (begin == 0 && end == length)) {
+    return;
+  }
+
+  if (ma_data_source_set_range_in_pcm_frames(source, begin, end) ==
+      MA_SUCCESS) {
+    deck_skipped[deck] = static_cast<float>(begin + (length - end)) / rate;
+  }
+}
+
+std::uintmax_t Music::deck_resident(int deck) {
+  if (!deck_loaded[deck]) {
+    return 0;
+  }
+
+  const DecodeChoice &choice = deck_choice[deck];
+  if (choice.mode == DecodeMode::Cached) {
+    return 0;
+  }
+
+  ma_format format = ma_format_unknown;
+  ma_uint32 channels = 0;
+  ma_uint32 rate = 0;
+  ma_uint64 length = 0;
+  if (load_result(deck) != MA_SUCCESS ||
+      ma_data_source_get_data_format(&deck_file[deck], &format, &channels,
+                                     &rate, NULL, 0) != MA_SUCCESS) {
+    return choice.estimated_bytes;
+  }
+
+  ma_uint32 frame_bytes = ma_get_bytes_per_frame(format, channels);
+  switch (choice.mode) {
+  case DecodeMode::Decoded:
+    ma_data_source_get_length_in_pcm_frames(&deck_file[deck], &length);
+    return length * frame_bytes;
+  case DecodeMode::Encoded:
+    return choice.file_bytes;
+  default:
+    // A stream keeps two pages of decoded audio in flight.
+    return 2ULL * rate * MA_RESOURCE_MANAGER_PAGE_SIZE_IN_MILLISECONDS / 1000 *
+           frame_bytes;
+  }
+}
+
+ma_result Music::load_result(int deck) {
+  if (!deck_file_open[deck]) {
+    return MA_SUCCESS;
+  }
+  return ma_resource_manager_data_source_result(&deck_file[deck]);
+}
+
+// A track that finishes or is replaced is kept decoded, so repeat-one and
+// replays open from memory; on shutdown there is nothing left to replay.
+void Music::unload(int deck) {
+  if (deck_loaded[deck]) {
+    if (control_running && deck_track_id[deck] >= 0) {
+      pcm_cache.request(deck_track_id[deck], deck_path[deck]);
+    }
+    if (deck_ready[deck]) {
+      ma_sound_uninit(&decks[deck]);
+      deck_ready[deck] = false;
+    }
+    close_sources(deck);
+    deck_length[deck] = 0;
+    deck_skipped[deck] = 0.0f;
+    deck_loaded[deck] = false;
+    deck_track_id[deck] = -1;
+    deck_path[deck].clear();
+  }
+}
+
+bool Music::start_track(const std::string &filepath, int track_id) {
+  unload(active);
+  loading_since = std::chrono::steady_clock::now();
+  ma_result result = open_deck(active, filepath, track_id);
 
   if (result != MA_SUCCESS) {
     std::cerr << "Failed to load sound: " << filepath << std::endl;
-    return;
+    state = PlaybackState::Stopped;
+    return false;
   }
 
-  ma_sound_start(&sound);
+  deck_loaded[active] = true;
+  deck_track_id[active] = track_id;
+  loading_path = filepath;
   music_db.increase_play_count(track_id);
+  state = PlaybackState::Loading;
+  if (queue != nullptr) {
+    queue->set_current(track_id);
+  }
+  poll_loading();
+  cache_around();
+  return true;
+}
+
+// Keep the track queued after the one that just started decoded, so the
+// next advance opens without touching the file. Under repeat-one that is the
+// playing track itself. The cache's byte budget bounds what stays resident.
+void Music::cache_around() {
+  Track next;
+  if (queue != nullptr && queue->peek_next(next)) {
+    pcm_cache.request(next.id, next.file_path);
+  }
+}
+
+void Music::poll_loading() {
+  if (state != PlaybackState::Loading) {
+    return;
+  }
+
+  ma_result result = load_result(active);
+  if (result == MA_BUSY) {
+    return;
+  }
+
+  last_open_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - loading_since)
+                     .count();
+
+  if (result != MA_SUCCESS || finish_open(active) != MA_SUCCESS) {
+    std::cerr << "Failed to load sound: " << loading_path << std::endl;
+    unload(active);
+    state = PlaybackState::Stopped;
+    return;
+  }
+
+  start_device();
+  ma_sound_start(current());
   state = PlaybackState::Playing;
 }
 
-void Music::pause(int track_id) {
-  if (ma_sound_is_playing(&sound)) {
-    ma_sound_stop(&sound);
+void Music::do_toggle(const std::string &filepath, int track_id) {
+  if (state == PlaybackState::Paused) {
+    start_device();
+    ma_sound_start(current());
+    state = PlaybackState::Playing;
+    return;
+  }
+
+  if (state == PlaybackState::Loading) {
+    return;
+  }
+
+  if (state == PlaybackState::Playing) {
+    do_pause();
+    return;
+  }
+
+  start_track(filepath, track_id);
+}
+
+void Music::do_pause() {
+  if (deck_ready[active] && ma_sound_is_playing(current())) {
+    unschedule_next();
+    ma_sound_stop(current());
     state = PlaybackState::Paused;
   }
 }
 
-void Music::stop() {
-  ma_sound_uninit(&sound);
+void Music::do_stop() {
+  unload(0);
+  unload(1);
+  crossfader.cancel();
+  next_scheduled = false;
+  failed_next_id = -1;
   state = PlaybackState::Stopped;
 }
 
-bool Music::is_finished() {
-  if (state == PlaybackState::Playing && !ma_sound_is_playing(&sound)) {
-    state = PlaybackState::Stopped;
-    return true;
+bool Music::wants_next() const {
+  if (state != PlaybackState::Playing || deck_loaded[1 - active]) {
+    return false;
   }
-  return false;
+
+  float remaining = (length_seconds() - cursor_seconds()) / speed;
+  return remaining > 0.0f &&
+         remaining <= gapless_lookahead + crossfade_seconds;
 }
 
+bool Music::prepare_next(const std::string &filepath, int track_id) {
+  int deck = 1 - active;
+  unload(deck);
+
+  ma_result result = open_deck(deck, filepath, track_id);
+  if (result != MA_SUCCESS) {
+    std::cerr << "Failed to preload sound: " << filepath << std::endl;
+    failed_next_id = track_id;
+    return false;
+  }
+
+  deck_loaded[deck] = true;
+  deck_track_id[deck] = track_id;
+  next_scheduled = false;
+  return true;
+}
+
+void Music::schedule_next() {
+  if (next_scheduled || !deck_loaded[1 - active] ||
+      state != PlaybackState::Playing) {
+    return;
+  }
+
+  ma_result loading = load_result(1 - active);
+  if (loading == MA_BUSY) {
+    return;
+  }
+  if (loading != MA_SUCCESS || finish_open(1 - active) != MA_SUCCESS) {
+    unload(1 - active);
+    return;
+  }
+
+  ma_uint32 rate = 0;
+  ma_uint64 length = deck_length[active];
+  ma_uint64 cursor = 0;
+  ma_uint64 now = 0;
+  ma_uint64 before = 0;
+  if (ma_sound_get_data_format(current(), NULL, NULL, &rate, NULL, 0) !=
+          MA_SUCCESS ||
+      rate == 0 || length == 0) {
+    return;
+  }
+
+  // The cursor and the engine clock are advanced by the audio thread, so only
+  // trust a cursor read that did not straddle a period.
+  do {
+    before = ma_engine_get_time_in_pcm_frames(&engine);
+    ma_sound_get_cursor_in_pcm_frames(current(), &cursor);
+    now = ma_engine_get_time_in_pcm_frames(&engine);
+  } while (before != now);
+
+  if (cursor >= length) {
+    return;
+  }
+
+  ma_uint32 engine_rate = ma_engine_get_sample_rate(&engine);
+  // Track frames play out faster or slower than real time by the speed.
+  ma_uint64 remaining =
+      (ma_uint64)((double)(length - cursor) * engine_rate / rate / speed);
+  ma_uint64 boundary = now + remaining;
+
+  // The fade may not run past either end of the overlap: it is bounded by
+  // what is left of this track and by half of the next one.
+  ma_uint64 fade = (ma_uint64)(crossfade_seconds * engine_rate);
+  ma_uint64 next_length = deck_length[1 - active];
+  ma_uint32 next_rate = 0;
+  if (fade > 0 && next_length > 0 &&
+      ma_sound_get_data_format(upcoming(), NULL, NULL, &next_rate, NULL, 0) ==
+          MA_SUCCESS &&
+      next_rate > 0) {
+    ma_uint64 half_next =
+        (ma_uint64)((double)next_length * engine_rate / next_rate / speed / 2);
+    if (fade > half_next) {
+      fade = half_next;
+    }
+  }
+  if (fade > remaining) {
+    fade = remaining;
+  }
+
+  ma_sound_set_start_time_in_pcm_frames(upcoming(), boundary - fade);
+  if (fade > 0) {
+    crossfader.schedule(boundary - fade, fade, 1 - active, crossfade_curve);
+  }
+  ma_sound_start(upcoming());
+  next_scheduled = true;
+}
+
+void Music::unschedule_next() {
+  if (!next_scheduled) {
+    return;
+  }
+
+  ma_sound_stop(upcoming());
+  ma_sound_seek_to_pcm_frame(upcoming(), 0);
+  ma_sound_set_start_time_in_pcm_frames(upcoming(), 0);
+  crossfader.cancel();
+  next_scheduled = false;
+}
+
+void Music::handle_end(const DeckEvent &event) {
+  if (event.deck != active || state != PlaybackState::Playing ||
+      !ma_sound_at_end(current())) {
+    return;
+  }
+
+  int track_id = -1;
+  if (next_scheduled && deck_loaded[1 - active]) {
+    unload(active);
+    active = 1 - active;
+    next_scheduled = false;
+    track_id = deck_track_id[active];
+    music_db.increase_play_count(track_id);
+    if (queue != nullptr) {
+      queue->set_current(track_id);
+    }
+    cache_around();
+  } else {
+    Track next;
+    unload(1 - active);
+    if (queue != nullptr && queue->advance(next) &&
+        start_track(next.file_path, next.id)) {
+      track_id = next.id;
+    } else {
+      unload(active);
+      state = PlaybackState::Stopped;
+    }
+  }
+
+  advance_lag_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - event.at)
+                       .count();
+  if (track_id >= 0) {
+    failed_next_id = -1;
+    advanced_track_id = track_id;
+  }
+}
+
+void Music::handle_command(const PlaybackCommand &command) {
+  Track track;
+
+  switch (command.type) {
+  case CommandType::Toggle:
+    do_toggle(command.path, command.track_id);
+    break;
+  case CommandType::PlayTrack:
+    do_stop();
+    start_track(command.path, command.track_id);
+    break;
+  case CommandType::Pause:
+    do_pause();
+    break;
+  case CommandType::Stop:
+    do_stop();
+    break;
+  case CommandType::Seek:
+    if (state == PlaybackState::Playing || state == PlaybackState::Paused) {
+      unschedule_next();
+      upgrade_to_indexed(active);
+      ma_sound_seek_to_second(current(), command.value);
+    }
+    break;
+  case CommandType::Next:
+    if (queue != nullptr && queue->advance(track)) {
+      do_stop();
+      if (start_track(track.file_path, track.id)) {
+        advanced_track_id = track.id;
+      }
+    }
+    break;
+  case CommandType::Previous:
+    if (queue != nullptr && queue->step_back(track)) {
+      do_stop();
+      if (start_track(track.file_path, track.id)) {
+        advanced_track_id = track.id;
+      }
+    }
+    break;
+  case CommandType::SetVolume:
+    volume_posted = false;
+    do_set_volume(pending_volume);
+    break;
+  case CommandType::SetCrossfade:
+    crossfade_posted = false;
+    crossfade_seconds = pending_crossfade;
+    crossfade_curve = static_cast<CrossfadeCurve>(pending_curve.load());
+    break;
+  case CommandType::SetMemoryBudget:
+    memory_budget = command.bytes;
+    pcm_cache.set_budget(command.bytes / 2);
+    break;
+  case CommandType::SetGainMode:
+    gain_mode = command.gain_mode;
+    for (int deck = 0; deck < 2; ++deck) {
+      deck_gain[deck] = loudness_gain(deck_loudness[deck], gain_mode);
+      if (deck_ready[deck]) {
+        apply_volume(deck);
+      }
+    }
+    break;
+  case CommandType::SetSkipSilence:
+    skip_silence = command.enabled;
+    break;
+  case CommandType::SetSpeed:
+    speed_posted = false;
+    for (int deck = 0; deck < 2; ++deck) {
+      deck_stretch[deck].set_speed(pending_speed);
+    }
+    speed = deck_stretch[0].get_speed();
+    // The next track's start was worked out at the old speed.
+    unschedule_next();
+    break;
+  case CommandType::CancelNext:
+    unschedule_next();
+    unload(1 - active);
+    break;
+  }
+}
+
+void Music::do_set_volume(float v) {
+  volume = v;
+
+  for (int deck = 0; deck < 2; ++deck) {
+    if (deck_ready[deck]) {
+      apply_volume(deck);
+    }
+  }
+}
+
+void Music::apply_volume(int deck) {
+  ma_sound_set_volume(&decks[deck], volume * deck_gain[deck]);
+}
+
+void Music::start_device() {
+  if (device_running) {
+    return;
+  }
+
+  if (ma_engine_start(&engine) != MA_SUCCESS) {
+    std::cerr << "Failed to restart audio device\n";
+    return;
+  }
+  device_running = true;
+}
+
+// Once nothing has played for the idle timeout the device is stopped, so the
+// backend stops waking up to mix silence. The next play restarts it.
+void Music::update_device() {
+  auto now = std::chrono::steady_clock::now();
+  bool idle = state == PlaybackState::Stopped || state == PlaybackState::Paused;
+  if (!idle) {
+    idle_since = now;
+    return;
+  }
+
+  if (device_running && now - idle_since >= idle_timeout) {
+    if (ma_engine_stop(&engine) == MA_SUCCESS) {
+      device_running = false;
+      ++device_stops;
+    }
+  }
+}
+
+void Music::control_loop() {
+  while (control_running) {
+    {
+      std::unique_lock<std::mutex> lock(wake_mutex);
+      auto ready = [this] { return !commands.empty() || !control_running; };
+      bool idle =
+          state == PlaybackState::Stopped || state == PlaybackState::Paused;
+      if (idle && !device_running) {
+        wake.wait(lock, ready);
+      } else if (idle) {
+        wake.wait_until(lock, idle_since + idle_timeout, ready);
+      } else {
+        wake.wait_for(lock, std::chrono::milliseconds(control_interval_ms),
+                      ready);
+      }
+    }
+
+    PlaybackCommand command;
+    while (commands.pop(command)) {
+      handle_command(command);
+    }
+
+    DeckEvent event;
+    while (events.pop(event)) {
+      handle_end(event);
+    }
+
+    poll_loading();
+
+    Track next;
+    if (queue != nullptr && wants_next() && queue->peek_next(next) &&
+        next.id != failed_next_id) {
+      prepare_next(next.file_path, next.id);
+    }
+    schedule_next();
+    update_device();
+
+    publish();
+  }
+}
+
+void Music::publish() {
+  PlaybackSnapshot s;
+  s.state = state;
+  s.track_id = deck_loaded[active] ? deck_track_id[active] : -1;
+  s.position = cursor_seconds();
+  s.length = length_seconds();
+  s.volume = volume;
+  s.crossfade_seconds = crossfade_seconds;
+  s.crossfade_curve = crossfade_curve;
+  s.gain_mode = gain_mode;
+  s.track_gain_db = deck_loaded[active]
+                        ? static_cast<float>(to_db(deck_gain[active]))
+                        : 0.0f;
+  s.skip_silence = skip_silence;
+  s.skipped_seconds = deck_loaded[active] ? deck_skipped[active] : 0.0f;
+  s.speed = speed;
+  s.advance_lag_ms = advance_lag_us / 1000.0;
+  s.last_open_ms = last_open_us / 1000.0;
+  s.device_running = device_running;
+  s.device_stops = device_stops;
+
+  AudioMemoryStats &stats = s.memory;
+  stats.budget_bytes = memory_budget;
+  for (int deck = 0; deck < 2; ++deck) {
+    DeckMemory &m = stats.decks[deck];
+    m.loaded = deck_loaded[deck];
+    m.mode = deck_choice[deck].mode;
+    m.resident_bytes = deck_resident(deck);
+    if (deck == 1 && deck_loaded[0] && deck_path[0] == deck_path[1] &&
+        m.mode != DecodeMode::Stream) {
+      continue;
+    }
+    stats.resident_bytes += m.resident_bytes;
+  }
+  stats.cache_bytes = pcm_cache.get_used_bytes();
+  stats.resident_bytes += stats.cache_bytes;
+
+  std::lock_guard<std::mutex> lock(snapshot_mutex);
+  published = s;
+}
+
+SeekIndexStats Music::get_seek_stats() {
+  return seek_indexer.get_stats();
+}
+
+TimeStretchStats Music::get_stretch_stats() const {
+  TimeStretchStats s;
+  s.speed = get_speed();
+  s.stretched_seconds = stretch_timings.audio_us / 1e6;
+  s.us_per_second = s.stretched_seconds > 0.0
+                        ? stretch_timings.busy_ns / 1000.0 / s.stretched_seconds
+                        : 0.0;
+  return s;
+}
+
+PlaybackSnapshot Music::snapshot() const {
+  std::lock_guard<std::mutex> lock(snapshot_mutex);
+  return published;
+}
+
+void Music::post(PlaybackCommand command) {
+  if (!commands.push(std::move(command))) {
+    std::cerr << "Playback command queue is full\n";
+    return;
+  }
+  // Taking the lock orders this push against the control thread's check of
+  // the queue, so the wakeup cannot fall between its check and its wait.
+  { std::lock_guard<std::mutex> lock(wake_mutex); }
+  wake.notify_one();
+}
+
+void Music::play(const std::string filepath, int track_id) {
+  PlaybackCommand command;
+  command.type = CommandType::Toggle;
+  command.path = filepath;
+  command.track_id = track_id;
+  post(std::move(command));
+}
+
+void Music::play_track(const std::string filepath, int track_id) {
+  PlaybackCommand command;
+  command.type = CommandType::PlayTrack;
+  command.path = filepath;
+  command.track_id = track_id;
+  post(std::move(command));
+}
+
+void Music::pause(int track_id) {
+  PlaybackCommand command;
+  command.type = CommandType::Pause;
+  command.track_id = track_id;
+  post(std::move(command));
+}
+
+void Music::stop() {
+  PlaybackCommand command;
+  command.type = CommandType::Stop;
+  post(std::move(command));
+}
+
+void Music::next() {
+  PlaybackCommand command;
+  command.type = CommandType::Next;
+  post(std::move(command));
+}
+
+void Music::previous() {
+  PlaybackCommand command;
+  command.type = CommandType::Previous;
+  post(std::move(command));
+}
+
+void Music::cancel_next() {
+  PlaybackCommand command;
+  command.type = CommandType::CancelNext;
+  post(std::move(command));
+}
+
+int Music::take_advanced() { return advanced_track_id.exchange(-1); }
+
 void Music::set_volume(float v) {
   if (v < 0.0f)
     v = 0.0f;
   else if (v > 1.0f)
     v = 1.0f;
 
-  volume = v;
+  {
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    published.volume = v;
+  }
 
-  if (state == PlaybackState::Playing || state == PlaybackState::Paused) {
-    ma_sound_set_volume(&sound, volume);
+  pending_volume = v;
+  if (!volume_posted.exchange(true)) {
+    PlaybackCommand command;
+    command.type = CommandType::SetVolume;
+    post(std::move(command));
+  }
+}
+
+void Music::set_crossfade(float seconds, CrossfadeCurve curve) {
+  if (seconds < 0.0f)
+    seconds = 0.0f;
+  else if (seconds > 12.0f)
+    seconds = 12.0f;
+
+  {
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    published.crossfade_seconds = seconds;
+    published.crossfade_curve = curve;
+  }
+
+  pending_crossfade = seconds;
+  pending_curve = static_cast<int>(curve);
+  if (!crossfade_posted.exchange(true)) {
+    PlaybackCommand command;
+    command.type = CommandType::SetCrossfade;
+    post(std::move(command));
+  }
+}
+
+void Music::set_memory_budget(std::uintmax_t bytes) {
+  PlaybackCommand command;
+  command.type = CommandType::SetMemoryBudget;
+  command.bytes = bytes;
+  post(std::move(command));
+}
+
+void Music::set_gain_mode(GainMode mode) {
+  {
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    published.gain_mode = mode;
+  }
+
+  PlaybackCommand command;
+  command.type = CommandType::SetGainMode;
+  command.gain_mode = mode;
+  post(std::move(command));
+}
+
+void Music::set_skip_silence(bool on) {
+  {
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    published.skip_silence = on;
   }
+
+  PlaybackCommand command;
+  command.type = CommandType::SetSkipSilence;
+  command.enabled = on;
+  post(std::move(command));
 }
 
-float Music::get_volume() const { return volume; }
+void Music::set_speed(float s) {
+  if (s < TimeStretchSource::min_speed)
+    s = TimeStretchSource::min_speed;
+  else if (s > TimeStretchSource::max_speed)
+    s = TimeStretchSource::max_speed;
+
+  {
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    published.speed = s;
+  }
+
+  pending_speed = s;
+  if (!speed_posted.exchange(true)) {
+    PlaybackCommand command;
+    command.type = CommandType::SetSpeed;
+    post(std::move(command));
+  }
+}
 
-float Music::current_time() const {
+void Music::set_position(float seek_point_in_seconds) {
+  PlaybackCommand command;
+  command.type = CommandType::Seek;
+  command.value = seek_point_in_seconds;
+  post(std::move(command));
+}
+
+float Music::cursor_seconds() const {
   float curr_time = 0.0f;
 
   if (state == PlaybackState::Playing || state == PlaybackState::Paused) {
-    ma_sound_get_cursor_in_seconds(&sound, &curr_time);
+    ma_sound_get_cursor_in_seconds(current(), &curr_time);
   }
 
   return curr_time;
 }
 
-float Music::max_time() const {
+float Music::length_seconds() const {
   float total_time = 0.0f;
+  ma_uint32 rate = 0;
 
-  if (state == PlaybackState::Playing || state == PlaybackState::Paused) {
-    ma_sound_get_length_in_seconds(&sound, &total_time);
+  if ((state == PlaybackState::Playing || state == PlaybackState::Paused) &&
+      ma_sound_get_data_format(current(), NULL, NULL, &rate, NULL, 0) ==
+          MA_SUCCESS &&
+      rate > 0) {
+    total_time = static_cast<float>(deck_length[active]) / rate;
   }
 
   return total_time;
 }
-
-void Music::set_position(float seek_point_in_seconds) {
-  if (state == PlaybackState::Playing || state == PlaybackState::Paused) {
-    ma_sound_seek_to_second(&sound, seek_point_in_seconds);
-  }
-}
\ No newline at end of file
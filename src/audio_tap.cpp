@@ -0,0 +1,90 @@
+#include "audio_tap.hpp"
+
+#include <cstring>
+
+ma_node_vtable AudioTap::vtable = {on_process, NULL, 1, 1, 0};
+
+AudioTap::~AudioTap() { uninit(); }
+
+ma_result AudioTap::init(ma_engine *engine) {
+  channels = ma_engine_get_channels(engine);
+  sample_rate = ma_engine_get_sample_rate(engine);
+  ring.assign(capacity * 2, 0.0f);
+
+  ma_uint32 input_channels[1] = {channels};
+  ma_uint32 output_channels[1] = {channels};
+  ma_node_config config = ma_node_config_init();
+  config.vtable = &vtable;
+  config.pInputChannels = input_channels;
+  config.pOutputChannels = output_channels;
+
+  ma_result result = ma_node_init(ma_engine_get_node_graph(engine), &config,
+                                  NULL, &base);
+  if (result != MA_SUCCESS) {
+    return result;
+  }
+  initialized = true;
+
+  return ma_node_attach_output_bus(&base, 0, ma_engine_get_endpoint(engine),
+                                   0);
+}
+
+void AudioTap::uninit() {
+  if (initialized) {
+    ma_node_uninit(&base, NULL);
+    initialized = false;
+  }
+}
+
+void AudioTap::on_process(ma_node *node, const float **frames_in,
+                          ma_uint32 *frame_count_in, float **frames_out,
+                          ma_uint32 *frame_count_out) {
+  ma_uint32 count = *frame_count_out;
+  if (*frame_count_in < count) {
+    count = *frame_count_in;
+  }
+
+  reinterpret_cast<AudioTap *>(node)->process(frames_in[0], frames_out[0],
+                                              count);
+  *frame_count_in = count;
+  *frame_count_out = count;
+}
+
+void AudioTap::process(const float *frames_in, float *frames_out,
+                       ma_uint32 count) {
+  if (frames_out != frames_in) {
+    std::memcpy(frames_out, frames_in,
+                sizeof(float) * (size_t)count * channels);
+  }
+
+  std::uint64_t w = written.load(std::memory_order_relaxed);
+  size_t right = channels > 1 ? 1 : 0;
+  for (ma_uint32 i = 0; i < count; ++i) {
+    size_t slot = ((w + i) & (capacity - 1)) * 2;
+    const float *frame = frames_in + (size_t)i * channels;
+    ring[slot] = frame[0];
+    ring[slot + 1] = frame[right];
+  }
+  written.store(w + count, std::memory_order_release);
+}
+
+bool AudioTap::read_latest(float *frames, size_t count) const {
+  if (ring.empty() || count > capacity / 2) {
+    return false;
+  }
+  std::uint64_t end = written.load(std::memory_order_acquire);
+  if (end < count) {
+    return false;
+  }
+
+  std::uint64_t start = end - count;
+  for (size_t i = 0; i < count; ++i) {
+    size_t slot = ((start + i) & (capacity - 1)) * 2;
+    frames[2 * i] = ring[slot];
+    frames[2 * i + 1] = ring[slot + 1];
+  }
+
+  // The writer may have wrapped onto the oldest frames while we copied.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return written.load(std::memory_order_relaxed) - start <= capacity;
+}
@@ -0,0 +1,144 @@
+#include "backup.hpp"
+
+#include <sqlite3.h>
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+
+DatabaseBackup::DatabaseBackup(const std::string source, const std::string dest,
+                               int pages_per_step, int step_pause_ms)
+    : source_path(source), dest_path(dest), pages_per_step(pages_per_step),
+      step_pause_ms(step_pause_ms) {}
+
+DatabaseBackup::~DatabaseBackup() {
+  cancel();
+  if (worker.joinable()) {
+    worker.join();
+  }
+}
+
+bool DatabaseBackup::start() {
+  if (running) {
+    return false;
+  }
+  if (worker.joinable()) {
+    worker.join();
+  }
+
+  cancel_requested = false;
+  finished = false;
+  failed = false;
+  total_pages = 0;
+  remaining_pages = 0;
+  bytes_per_second = 0.0;
+  running = true;
+  worker = std::thread(&DatabaseBackup::run, this);
+  return true;
+}
+
+void DatabaseBackup::cancel() { cancel_requested = true; }
+
+BackupProgress DatabaseBackup::progress() const {
+  BackupProgress p;
+  p.total_pages = total_pages;
+  p.remaining_pages = remaining_pages;
+  p.bytes_per_second = bytes_per_second;
+  p.running = running;
+  p.finished = finished;
+  p.failed = failed;
+  return p;
+}
+
+double DatabaseBackup::hours_since_last_backup() const {
+  std::error_code ec;
+  auto modified = std::filesystem::last_write_time(dest_path, ec);
+  if (ec) {
+    return -1.0;
+  }
+  return std::chrono::duration<double, std::ratio<3600>>(
+             std::filesystem::file_time_type::clock::now() - modified)
+      .count();
+}
+
+void DatabaseBackup::run() {
+  std::string part_path = dest_path + ".part";
+  std::remove(part_path.c_str());
+
+  sqlite3 *src = nullptr;
+  sqlite3 *dst = nullptr;
+  int rc = sqlite3_open_v2(source_path.c_str(), &src, SQLITE_OPEN_READWRITE,
+                           nullptr);
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_open(part_path.c_str(), &dst);
+  }
+
+  sqlite3_backup *backup = nullptr;
+  if (rc == SQLITE_OK) {
+    // Hold one WAL read snapshot for the whole copy. Writers on other
+    // connections keep committing, and the backup never restarts.
+    rc = sqlite3_exec(src, "BEGIN; SELECT count(*) FROM sqlite_master;",
+                      nullptr, nullptr, nullptr);
+  }
+  if (rc == SQLITE_OK) {
+    backup = sqlite3_backup_init(dst, "main", src, "main");
+  }
+
+  if (backup == nullptr) {
+    std::cerr << "Failed to start backup: "
+              << sqlite3_errmsg(dst ? dst : src) << std::endl;
+    rc = SQLITE_ERROR;
+  } else {
+    int page_size = 4096;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(src, "PRAGMA page_size;", -1, &stmt, nullptr) ==
+        SQLITE_OK) {
+      if (sqlite3_step(stmt) == SQLITE_ROW) {
+        page_size = sqlite3_column_int(stmt, 0);
+      }
+      sqlite3_finalize(stmt);
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    do {
+      rc = sqlite3_backup_step(backup, pages_per_step);
+
+      int total = sqlite3_backup_pagecount(backup);
+      int remaining = sqlite3_backup_remaining(backup);
+      total_pages = total;
+      remaining_pages = remaining;
+
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - started;
+      if (elapsed.count() > 0.0) {
+        bytes_per_second =
+            static_cast<double>(total - remaining) * page_size /
+            elapsed.count();
+      }
+
+      if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(step_pause_ms));
+      }
+    } while ((rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) &&
+             !cancel_requested);
+
+    sqlite3_backup_finish(backup);
+    if (rc != SQLITE_DONE && !cancel_requested) {
+      std::cerr << "Backup failed: " << sqlite3_errstr(rc) << std::endl;
+    }
+  }
+
+  sqlite3_exec(src, "COMMIT;", nullptr, nullptr, nullptr);
+  sqlite3_close(dst);
+  sqlite3_close(src);
+
+  if (rc == SQLITE_DONE &&
+      std::rename(part_path.c_str(), dest_path.c_str()) == 0) {
+    finished = true;
+  } else {
+    std::remove(part_path.c_str());
+    failed = !cancel_requested;
+  }
+  running = false;
+}
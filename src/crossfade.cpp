@@ -0,0 +1,157 @@
+#include "crossfade.hpp"
+
+#include <chrono>
+#include <cmath>
+
+static const float half_pi = 1.57079632679489661923f;
+
+ma_node_vtable Crossfader::vtable = {on_process, NULL, 2, 1, 0};
+
+Crossfader::~Crossfader() { uninit(); }
+
+ma_result Crossfader::init(ma_engine *e, ma_node *output) {
+  engine = e;
+  channels = ma_engine_get_channels(engine);
+  sample_rate = ma_engine_get_sample_rate(engine);
+
+  ma_uint32 input_channels[2] = {channels, channels};
+  ma_uint32 output_channels[1] = {channels};
+  ma_node_config config = ma_node_config_init();
+  config.vtable = &vtable;
+  config.pInputChannels = input_channels;
+  config.pOutputChannels = output_channels;
+
+  ma_result result = ma_node_init(ma_engine_get_node_graph(engine), &config,
+                                  NULL, &base);
+  if (result != MA_SUCCESS) {
+    return result;
+  }
+  initialized = true;
+
+  return ma_node_attach_output_bus(&base, 0, output, 0);
+}
+
+void Crossfader::uninit() {
+  if (initialized) {
+    ma_node_uninit(&base, NULL);
+    initialized = false;
+  }
+}
+
+void Crossfader::publish(const CrossfadeParams &p) {
+  slots[back] = p;
+  back = shared.exchange(back | 4, std::memory_order_acq_rel) & 3;
+}
+
+void Crossfader::schedule(ma_uint64 start, ma_uint64 length, int incoming_bus,
+                          CrossfadeCurve curve) {
+  CrossfadeParams p;
+  p.start = start;
+  p.length = length;
+  p.incoming_bus = incoming_bus;
+  p.curve = curve;
+  publish(p);
+  fades.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Crossfader::cancel() { publish(CrossfadeParams()); }
+
+void Crossfader::on_process(ma_node *node, const float **frames_in,
+                            ma_uint32 *frame_count_in, float **frames_out,
+                            ma_uint32 *frame_count_out) {
+  ma_uint32 count = *frame_count_out;
+  if (*frame_count_in < count) {
+    count = *frame_count_in;
+  }
+
+  reinterpret_cast<Crossfader *>(node)->process(frames_in, frames_out[0],
+                                                count);
+  *frame_count_in = count;
+  *frame_count_out = count;
+}
+
+void Crossfader::process(const float **frames_in, float *frames_out,
+                         ma_uint32 count) {
+  auto started = std::chrono::steady_clock::now();
+
+  // The engine clock only moves once per graph read, but a read can be split
+  // into several process calls, so track how far into the read we are.
+  ma_uint64 now = ma_engine_get_time_in_pcm_frames(engine);
+  if (now != period_time) {
+    period_time = now;
+    period_offset = 0;
+  }
+  ma_uint64 first = now + period_offset;
+  period_offset += count;
+
+  if (shared.load(std::memory_order_relaxed) & 4) {
+    front = shared.exchange(front, std::memory_order_acq_rel) & 3;
+  }
+  const CrossfadeParams &p = slots[front];
+  ma_uint64 fade_end = p.start + p.length;
+  bool fading = p.length > 0 && first < fade_end && first + count > p.start;
+
+  if (!fading) {
+    const float *a = frames_in[0];
+    const float *b = frames_in[1];
+    ma_uint64 samples = (ma_uint64)count * channels;
+    for (ma_uint64 i = 0; i < samples; ++i) {
+      frames_out[i] = a[i] + b[i];
+    }
+  } else {
+    const float *incoming = frames_in[p.incoming_bus];
+    const float *outgoing = frames_in[1 - p.incoming_bus];
+    float inv_length = 1.0f / static_cast<float>(p.length);
+
+    for (ma_uint32 frame = 0; frame < count; ++frame) {
+      ma_uint64 t = first + frame;
+      float gain_in = 1.0f;
+      float gain_out = 1.0f;
+
+      if (t >= p.start && t < fade_end) {
+        float x = static_cast<float>(t - p.start) * inv_length;
+        if (p.curve == CrossfadeCurve::EqualPower) {
+          gain_in = std::sin(x * half_pi);
+          gain_out = std::cos(x * half_pi);
+        } else {
+          gain_in = x;
+          gain_out = 1.0f - x;
+        }
+      }
+
+      ma_uint64 base_sample = (ma_uint64)frame * channels;
+      for (ma_uint32 c = 0; c < channels; ++c) {
+        ma_uint64 i = base_sample + c;
+        frames_out[i] = outgoing[i] * gain_out + incoming[i] * gain_in;
+      }
+    }
+  }
+
+  long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - started)
+                     .count();
+  total_frames.fetch_add(count, std::memory_order_relaxed);
+  total_ns.fetch_add(ns, std::memory_order_relaxed);
+  if (fading) {
+    fade_frames.fetch_add(count, std::memory_order_relaxed);
+    fade_ns.fetch_add(ns, std::memory_order_relaxed);
+  }
+}
+
+CrossfadeStats Crossfader::get_stats() const {
+  CrossfadeStats s;
+  long long ff = fade_frames.load(std::memory_order_relaxed);
+  long long tf = total_frames.load(std::memory_order_relaxed);
+
+  s.fades = fades.load(std::memory_order_relaxed);
+  s.fade_seconds = static_cast<double>(ff) / sample_rate;
+  if (ff > 0) {
+    s.fade_us_per_second =
+        fade_ns.load(std::memory_order_relaxed) / 1000.0 / s.fade_seconds;
+  }
+  if (tf > 0) {
+    s.total_us_per_second = total_ns.load(std::memory_order_relaxed) /
+                            1000.0 / (static_cast<double>(tf) / sample_rate);
+  }
+  return s;
+}
@@ -1,27 +1,97 @@
 #include "db.hpp"
 
+#include "query_stats.hpp"
+
 #include <sqlite3.h>
 #include <taglib/fileref.h>
 #include <taglib/tag.h>
 
+#include <algorithm>
+#include <cctype>
+#include <cmath>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 
-Database::Database() {
-  rc = sqlite3_open("music.db", &db);
-  sqlite3_exec(db, "PRAGMA journal_mode=WAL;", nullptr, nullptr, nullptr);
-  sqlite3_exec(db, "PRAGMA synchronous=NORMAL;", nullptr, nullptr, nullptr);
+static const DbTuning db_tunings[] = {
+    {"laptop", 64LL << 20, 8 * 1024, "DEFAULT", 4096, "NORMAL"},
+    {"desktop", 256LL << 20, 32 * 1024, "MEMORY", 4096, "NORMAL"},
+    {"server", 1LL << 30, 128 * 1024, "MEMORY", 8192, "FULL"},
+};
+
+const DbTuning &db_tuning(DbProfile profile) {
+  return db_tunings[static_cast<int>(profile)];
+}
+
+DbProfile db_profile_from_name(const char *name) {
+  if (name != nullptr) {
+    std::string lower(name);
+    for (auto &c : lower) {
+      c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    for (int i = 0; i < 3; ++i) {
+      if (lower == db_tunings[i].name) {
+        return static_cast<DbProfile>(i);
+      }
+    }
+  }
+  return DbProfile::Desktop;
+}
+
+DbProfile db_profile_from_env() {
+  return db_profile_from_name(std::getenv("MUSIC_PLAYR_DB_PROFILE"));
+}
+
+Database::Database(const char *path, DbProfile profile)
+    : music_database(path), profile(profile) {
+  rc = sqlite3_open(music_database.c_str(), &db);
   if (rc != SQLITE_OK) {
     fprintf(stderr, "Can't open your music files : %s\n", sqlite3_errmsg(db));
     exit(EXIT_FAILURE);
   }
+  QueryStats::instance().attach(db);
+  // The player, the maintenance thread and background analysis each hold a
+  // connection, so let a writer wait briefly for another instead of failing.
+  sqlite3_busy_timeout(db, 2000);
 
+  apply_profile();
   create_tables();
 }
 
-Database::~Database() { sqlite3_close(db); }
+void Database::apply_profile() {
+  const DbTuning &tuning = db_tuning(profile);
+  std::ostringstream sql;
+
+  // page_size and auto_vacuum only take effect before the first table exists.
+  sql << "PRAGMA page_size=" << tuning.page_size << ";"
+      << "PRAGMA auto_vacuum=INCREMENTAL;"
+      << "PRAGMA journal_mode=WAL;"
+      << "PRAGMA synchronous=" << tuning.synchronous << ";"
+      << "PRAGMA journal_size_limit=8388608;"
+      << "PRAGMA mmap_size=" << tuning.mmap_size << ";"
+      << "PRAGMA cache_size=-" << tuning.cache_size_kib << ";"
+      << "PRAGMA temp_store=" << tuning.temp_store << ";";
+
+  char *err_msg = nullptr;
+  if (sqlite3_exec(db, sql.str().c_str(), nullptr, nullptr, &err_msg) !=
+      SQLITE_OK) {
+    fprintf(stderr, "Failed to apply %s profile: %s\n", tuning.name, err_msg);
+    sqlite3_free(err_msg);
+  }
+}
+
+void Database::explain_pending_queries() {
+  QueryStats::instance().explain_pending(db);
+}
+
+Database::~Database() {
+  QueryStats::instance().detach(db);
+  sqlite3_close(db);
+}
 
 void Database::create_tables() {
   const char *sql = "CREATE TABLE IF NOT EXISTS tracks ("
@@ -49,6 +119,29 @@ void Database::create_tables() {
                     "   FOREIGN KEY(track_id) REFERENCES tracks(id)"
                     ");"
 
+                    "CREATE TABLE IF NOT EXISTS seek_index ("
+                    "   track_id INTEGER PRIMARY KEY,"
+                    "   file_bytes INTEGER,"
+                    "   total_frames INTEGER,"
+                    "   points BLOB,"
+                    "   FOREIGN KEY(track_id) REFERENCES tracks(id)"
+                    ");"
+
+                    "CREATE TABLE IF NOT EXISTS fingerprints ("
+                    "   track_id INTEGER PRIMARY KEY,"
+                    "   words BLOB,"
+                    "   FOREIGN KEY(track_id) REFERENCES tracks(id)"
+                    ");"
+
+                    "CREATE TABLE IF NOT EXISTS fingerprint_buckets ("
+                    "   bucket INTEGER,"
+                    "   track_id INTEGER,"
+                    "   PRIMARY KEY(bucket, track_id)"
+                    ") WITHOUT ROWID;"
+
+                    "CREATE INDEX IF NOT EXISTS fingerprint_buckets_track "
+                    "ON fingerprint_buckets(track_id);"
+
                     "CREATE TABLE IF NOT EXISTS app_state ("
                     "   id INTEGER PRIMARY KEY CHECK (id = 1),"
                     "   last_track_id INTEGER,"
@@ -66,12 +159,73 @@ void Database::create_tables() {
     sqlite3_free(err_msg);
     exit(EXIT_FAILURE);
   }
+
+  ensure_column("tracks", "album", "TEXT");
+  ensure_column("tracks", "loudness_lufs", "REAL");
+  ensure_column("tracks", "true_peak_dbtp", "REAL");
+  ensure_column("tracks", "album_loudness_lufs", "REAL");
+  ensure_column("tracks", "album_peak_dbtp", "REAL");
+  ensure_column("tracks", "bpm", "REAL");
+  ensure_column("tracks", "musical_key", "INTEGER");
+  ensure_column("tracks", "audible_start", "REAL");
+  ensure_column("tracks", "audible_end", "REAL");
+  ensure_column("app_state", "normalization", "INTEGER DEFAULT 0");
+  ensure_column("app_state", "skip_silence", "INTEGER DEFAULT 0");
+  ensure_column("app_state", "playback_speed", "REAL DEFAULT 1");
+
+  // Needs the album column, which older databases only gain just above.
+  if (sqlite3_exec(db,
+                   "CREATE INDEX IF NOT EXISTS tracks_album "
+                   "ON tracks(album, artist);",
+                   nullptr, nullptr, &err_msg) != SQLITE_OK) {
+    fprintf(stderr, "SQL error: %s\n", err_msg);
+    sqlite3_free(err_msg);
+    exit(EXIT_FAILURE);
+  }
+}
+
+// CREATE TABLE IF NOT EXISTS leaves older databases without columns added
+// since, so add any that are missing.
+void Database::ensure_column(const char *table, const char *column,
+                             const char *definition) {
+  std::string sql = std::string("PRAGMA table_info(") + table + ");";
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return;
+  }
+
+  bool found = false;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    if (get_text(stmt, 1) == column) {
+      found = true;
+      break;
+    }
+  }
+  sqlite3_finalize(stmt);
+  if (found) {
+    return;
+  }
+
+  sql = std::string("ALTER TABLE ") + table + " ADD COLUMN " + column + " " +
+        definition + ";";
+  char *err_msg = nullptr;
+  if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &err_msg) != SQLITE_OK) {
+    fprintf(stderr, "Failed to add %s.%s: %s\n", table, column, err_msg);
+    sqlite3_free(err_msg);
+  }
 }
 
 int Database::add_track(const char *_absolute_file_path) {
-  music_metadata = get_metadata(_absolute_file_path);
+  return add_track(_absolute_file_path, get_metadata(_absolute_file_path));
+}
+
+int Database::add_track(const char *_absolute_file_path,
+                        const AudioMetadata &metadata) {
+  music_metadata = metadata;
   const char *sql = "INSERT INTO tracks (file_path, title, artist, duration, "
-                    "date_added) VALUES (?,?,?,?,?)";
+                    "date_added, album) VALUES (?,?,?,?,?,?)";
 
   sqlite3_stmt *stmt;
   rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
@@ -87,6 +241,7 @@ int Database::add_track(const char *_absolute_file_path) {
   sqlite3_bind_text(stmt, 3, music_metadata.artist.c_str(), -1, SQLITE_STATIC);
   sqlite3_bind_int(stmt, 4, music_metadata.length_in_seconds);
   sqlite3_bind_text(stmt, 5, current_datetime().c_str(), -1, SQLITE_TRANSIENT);
+  sqlite3_bind_text(stmt, 6, music_metadata.album.c_str(), -1, SQLITE_STATIC);
 
   rc = sqlite3_step(stmt);
   if (rc != SQLITE_DONE) {
@@ -100,7 +255,8 @@ int Database::add_track(const char *_absolute_file_path) {
 std::vector<Track> Database::get_all_tracks() {
   std::vector<Track> tracks;
   const char *sql = "SELECT id, file_path, title, artist, duration, "
-                    "date_added, last_played, play_count FROM tracks";
+                    "date_added, last_played, play_count, IFNULL(bpm, 0), "
+                    "IFNULL(musical_key, -1) FROM tracks";
 
   sqlite3_stmt *stmt;
   rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
@@ -119,6 +275,50 @@ std::vector<Track> Database::get_all_tracks() {
     t.date_added = get_text(stmt, 5);
     t.last_played = sqlite3_column_int(stmt, 6);
     t.play_count = sqlite3_column_int(stmt, 7);
+    t.bpm = sqlite3_column_double(stmt, 8);
+    t.musical_key = sqlite3_column_int(stmt, 9);
+
+    tracks.push_back(t);
+  }
+
+  if (rc != SQLITE_DONE) {
+    std::cerr << "Select failed: " << sqlite3_errmsg(db) << std::endl;
+  }
+
+  sqlite3_finalize(stmt);
+  return tracks;
+}
+
+std::vector<Track> Database::search_tracks(const char *query) {
+  std::vector<Track> tracks;
+  const char *sql = "SELECT id, file_path, title, artist, duration, "
+                    "date_added, last_played, play_count, IFNULL(bpm, 0), "
+                    "IFNULL(musical_key, -1) FROM tracks "
+                    "WHERE title LIKE ?1 OR artist LIKE ?1";
+
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return tracks;
+  }
+
+  std::string pattern = std::string("%") + query + "%";
+  sqlite3_bind_text(stmt, 1, pattern.c_str(), -1, SQLITE_TRANSIENT);
+
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    Track t;
+    t.id = sqlite3_column_int(stmt, 0);
+    t.file_path = get_text(stmt, 1);
+    t.title = get_text(stmt, 2);
+    t.artist = get_text(stmt, 3);
+    t.duration = sqlite3_column_int(stmt, 4);
+    t.date_added = get_text(stmt, 5);
+    t.last_played = sqlite3_column_int(stmt, 6);
+    t.play_count = sqlite3_column_int(stmt, 7);
+    t.bpm = sqlite3_column_double(stmt, 8);
+    t.musical_key = sqlite3_column_int(stmt, 9);
 
     tracks.push_back(t);
   }
@@ -167,6 +367,12 @@ int Database::delete_track(int id) {
   const char *delete_track_sql = "DELETE FROM tracks WHERE id = ?";
   const char *delete_from_playlists_sql =
       "DELETE FROM playlist_tracks WHERE track_id = ?";
+  const char *delete_seek_index_sql =
+      "DELETE FROM seek_index WHERE track_id = ?";
+  const char *delete_fingerprint_sql =
+      "DELETE FROM fingerprints WHERE track_id = ?";
+  const char *delete_buckets_sql =
+      "DELETE FROM fingerprint_buckets WHERE track_id = ?";
 
   sqlite3_stmt *stmt;
 
@@ -177,6 +383,15 @@ int Database::delete_track(int id) {
     sqlite3_finalize(stmt);
   }
 
+  for (const char *sql :
+       {delete_seek_index_sql, delete_fingerprint_sql, delete_buckets_sql}) {
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+      sqlite3_bind_int(stmt, 1, id);
+      sqlite3_step(stmt);
+      sqlite3_finalize(stmt);
+    }
+  }
+
   if (sqlite3_prepare_v2(db, delete_track_sql, -1, &stmt, nullptr) ==
       SQLITE_OK) {
     sqlite3_bind_int(stmt, 1, id);
@@ -261,10 +476,549 @@ int Database::last_played_timestamp(int id) {
   return timestamp;
 }
 
+// The silence scan shares the loudness pass, so tracks analyzed before it
+// existed are measured once more.
+std::vector<Track> Database::get_tracks_without_loudness() {
+  std::vector<Track> tracks;
+  const char *sql = "SELECT id, file_path, title, artist, duration, "
+                    "date_added, last_played, play_count FROM tracks "
+                    "WHERE loudness_lufs IS NULL OR audible_end IS NULL";
+
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return tracks;
+  }
+
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    Track t;
+    t.id = sqlite3_column_int(stmt, 0);
+    t.file_path = get_text(stmt, 1);
+    t.title = get_text(stmt, 2);
+    t.artist = get_text(stmt, 3);
+    t.duration = sqlite3_column_int(stmt, 4);
+    t.date_added = get_text(stmt, 5);
+    t.last_played = sqlite3_column_int(stmt, 6);
+    t.play_count = sqlite3_column_int(stmt, 7);
+
+    tracks.push_back(t);
+  }
+
+  if (rc != SQLITE_DONE) {
+    std::cerr << "Select failed: " << sqlite3_errmsg(db) << std::endl;
+  }
+
+  sqlite3_finalize(stmt);
+  return tracks;
+}
+
+std::vector<Track> Database::get_tracks_without_tempo() {
+  std::vector<Track> tracks;
+  const char *sql = "SELECT id, file_path, title, artist, duration, "
+                    "date_added, last_played, play_count FROM tracks "
+                    "WHERE bpm IS NULL OR id NOT IN "
+                    "(SELECT track_id FROM fingerprints)";
+
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return tracks;
+  }
+
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    Track t;
+    t.id = sqlite3_column_int(stmt, 0);
+    t.file_path = get_text(stmt, 1);
+    t.title = get_text(stmt, 2);
+    t.artist = get_text(stmt, 3);
+    t.duration = sqlite3_column_int(stmt, 4);
+    t.date_added = get_text(stmt, 5);
+    t.last_played = sqlite3_column_int(stmt, 6);
+    t.play_count = sqlite3_column_int(stmt, 7);
+
+    tracks.push_back(t);
+  }
+
+  if (rc != SQLITE_DONE) {
+    std::cerr << "Select failed: " << sqlite3_errmsg(db) << std::endl;
+  }
+
+  sqlite3_finalize(stmt);
+  return tracks;
+}
+
+// A bpm of 0 records that the track was analyzed and has no steady beat, so
+// it is not picked up again on the next run.
+int Database::set_track_tempo_key(int id, double bpm, int musical_key) {
+  const char *sql =
+      "UPDATE tracks SET bpm = ?, musical_key = ? WHERE id = ?;";
+
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return 1;
+  }
+
+  sqlite3_bind_double(stmt, 1, bpm);
+  if (musical_key >= 0) {
+    sqlite3_bind_int(stmt, 2, musical_key);
+  } else {
+    sqlite3_bind_null(stmt, 2);
+  }
+  sqlite3_bind_int(stmt, 3, id);
+
+  rc = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (rc != SQLITE_DONE) {
+    std::cerr << "Update failed: " << sqlite3_errmsg(db) << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// The words and their LSH buckets are replaced together, so a track is never
+// findable through buckets of an older fingerprint.
+int Database::set_track_fingerprint(int id,
+                                    const std::vector<std::uint32_t> &words,
+                                    const std::vector<std::int64_t> &buckets) {
+  const char *print_sql = "INSERT OR REPLACE INTO fingerprints "
+                          "(track_id, words) VALUES (?, ?);";
+  const char *clear_sql = "DELETE FROM fingerprint_buckets WHERE track_id = ?;";
+  const char *bucket_sql = "INSERT OR IGNORE INTO fingerprint_buckets "
+                           "(bucket, track_id) VALUES (?, ?);";
+
+  rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to begin transaction: " << sqlite3_errmsg(db)
+              << std::endl;
+    return 1;
+  }
+
+  sqlite3_stmt *stmt;
+  bool ok = sqlite3_prepare_v2(db, print_sql, -1, &stmt, nullptr) == SQLITE_OK;
+  if (ok) {
+    sqlite3_bind_int(stmt, 1, id);
+    sqlite3_bind_blob(stmt, 2, words.data(),
+                      static_cast<int>(words.size() * sizeof(std::uint32_t)),
+                      SQLITE_STATIC);
+    ok = sqlite3_step(stmt) == SQLITE_DONE;
+    sqlite3_finalize(stmt);
+  }
+
+  if (ok &&
+      sqlite3_prepare_v2(db, clear_sql, -1, &stmt, nullptr) == SQLITE_OK) {
+    sqlite3_bind_int(stmt, 1, id);
+    ok = sqlite3_step(stmt) == SQLITE_DONE;
+    sqlite3_finalize(stmt);
+  }
+
+  if (ok &&
+      sqlite3_prepare_v2(db, bucket_sql, -1, &stmt, nullptr) == SQLITE_OK) {
+    for (std::int64_t bucket : buckets) {
+      sqlite3_bind_int64(stmt, 1, bucket);
+      sqlite3_bind_int(stmt, 2, id);
+      if (sqlite3_step(stmt) != SQLITE_DONE) {
+        ok = false;
+        break;
+      }
+      sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+  }
+
+  if (!ok) {
+    std::cerr << "Failed to store fingerprint: " << sqlite3_errmsg(db)
+              << std::endl;
+    sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    return 1;
+  }
+
+  rc = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Commit failed: " << sqlite3_errmsg(db) << std::endl;
+    sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    return 1;
+  }
+  return 0;
+}
+
+bool Database::get_track_fingerprint(int id,
+                                     std::vector<std::uint32_t> &words) {
+  const char *sql = "SELECT words FROM fingerprints WHERE track_id = ?;";
+
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return false;
+  }
+
+  sqlite3_bind_int(stmt, 1, id);
+
+  words.clear();
+  bool found = false;
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    const void *blob = sqlite3_column_blob(stmt, 0);
+    int bytes = sqlite3_column_bytes(stmt, 0);
+    if (bytes % sizeof(std::uint32_t) == 0) {
+      words.resize(bytes / sizeof(std::uint32_t));
+      if (bytes > 0) {
+        std::memcpy(words.data(), blob, bytes);
+      }
+      found = true;
+    }
+  }
+
+  sqlite3_finalize(stmt);
+  return found;
+}
+
+int Database::count_fingerprints() {
+  const char *sql = "SELECT COUNT(*) FROM fingerprints;";
+
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return 0;
+  }
+
+  int count = 0;
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    count = sqlite3_column_int(stmt, 0);
+  }
+
+  sqlite3_finalize(stmt);
+  return count;
+}
+
+// Every pair of tracks sharing at least one bucket, each pair once. Buckets
+// holding more than max_bucket tracks come from near-constant fingerprints
+// (tones, test signals) and would add pairs quadratically, so they are
+// skipped. Both passes walk the bucket-ordered primary key.
+std::vector<std::pair<int, int>>
+Database::get_fingerprint_candidates(int max_bucket) {
+  std::vector<std::pair<int, int>> pairs;
+  const char *sql =
+      "WITH shared AS (SELECT bucket FROM fingerprint_buckets "
+      "GROUP BY bucket HAVING COUNT(*) BETWEEN 2 AND ?) "
+      "SELECT DISTINCT a.track_id, b.track_id FROM shared "
+      "JOIN fingerprint_buckets a ON a.bucket = shared.bucket "
+      "JOIN fingerprint_buckets b ON b.bucket = shared.bucket "
+      "AND b.track_id > a.track_id;";
+
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return pairs;
+  }
+
+  sqlite3_bind_int(stmt, 1, max_bucket);
+
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    pairs.emplace_back(sqlite3_column_int(stmt, 0),
+                       sqlite3_column_int(stmt, 1));
+  }
+
+  if (rc != SQLITE_DONE) {
+    std::cerr << "Select failed: " << sqlite3_errmsg(db) << std::endl;
+  }
+
+  sqlite3_finalize(stmt);
+  return pairs;
+}
+
+int Database::set_track_loudness(int id, double lufs, double true_peak_dbtp) {
+  const char *sql =
+      "UPDATE tracks SET loudness_lufs = ?, true_peak_dbtp = ? WHERE id = ?;";
+  const char *album_sql =
+      "SELECT IFNULL(album, ''), artist FROM tracks WHERE id = ?;";
+
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return 1;
+  }
+
+  sqlite3_bind_double(stmt, 1, lufs);
+  sqlite3_bind_double(stmt, 2, true_peak_dbtp);
+  sqlite3_bind_int(stmt, 3, id);
+
+  rc = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (rc != SQLITE_DONE) {
+    std::cerr << "Update failed: " << sqlite3_errmsg(db) << std::endl;
+    return 1;
+  }
+
+  std::string album;
+  std::string artist;
+  bool has_artist = false;
+  if (sqlite3_prepare_v2(db, album_sql, -1, &stmt, nullptr) == SQLITE_OK) {
+    sqlite3_bind_int(stmt, 1, id);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+      album = get_text(stmt, 0);
+      has_artist = sqlite3_column_type(stmt, 1) != SQLITE_NULL;
+      artist = get_text(stmt, 1);
+    }
+    sqlite3_finalize(stmt);
+  }
+
+  if (album.empty()) {
+    return 0;
+  }
+  return update_album_loudness(album, has_artist ? artist.c_str() : nullptr);
+}
+
+// Rows imported before the album column existed have it NULL; fill those in
+// without touching albums that were already stored.
+int Database::fill_track_album(int id, const std::string &album) {
+  const char *sql =
+      "UPDATE tracks SET album = ? WHERE id = ? AND album IS NULL;";
+
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return 1;
+  }
+
+  sqlite3_bind_text(stmt, 1, album.c_str(), -1, SQLITE_TRANSIENT);
+  sqlite3_bind_int(stmt, 2, id);
+
+  rc = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (rc != SQLITE_DONE) {
+    std::cerr << "Update failed: " << sqlite3_errmsg(db) << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Album loudness is the duration-weighted power mean of the analyzed tracks,
+// and the album peak their maximum, both refreshed as each track finishes.
+// Albums are keyed by title and artist, so two artists' "Greatest Hits" are
+// not levelled as one. A null artist is bound as NULL and matched with IS.
+int Database::update_album_loudness(const std::string &album,
+                                    const char *artist) {
+  const char *select_sql = "SELECT duration, loudness_lufs, true_peak_dbtp "
+                           "FROM tracks WHERE album = ? AND artist IS ? AND "
+                           "loudness_lufs IS NOT NULL;";
+  const char *update_sql = "UPDATE tracks SET album_loudness_lufs = ?, "
+                           "album_peak_dbtp = ? WHERE album = ? AND "
+                           "artist IS ?;";
+
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db, select_sql, -1, &stmt, nullptr) != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return 1;
+  }
+  sqlite3_bind_text(stmt, 1, album.c_str(), -1, SQLITE_TRANSIENT);
+  sqlite3_bind_text(stmt, 2, artist, -1, SQLITE_TRANSIENT);
+
+  double weighted_power = 0.0;
+  double total_weight = 0.0;
+  double peak = -HUGE_VAL;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    double weight = std::max(1.0, sqlite3_column_double(stmt, 0));
+    weighted_power +=
+        weight * std::pow(10.0, sqlite3_column_double(stmt, 1) / 10.0);
+    total_weight += weight;
+    peak = std::max(peak, sqlite3_column_double(stmt, 2));
+  }
+  sqlite3_finalize(stmt);
+  if (total_weight <= 0.0) {
+    return 0;
+  }
+
+  if (sqlite3_prepare_v2(db, update_sql, -1, &stmt, nullptr) != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return 1;
+  }
+  sqlite3_bind_double(stmt, 1,
+                      10.0 * std::log10(weighted_power / total_weight));
+  sqlite3_bind_double(stmt, 2, peak);
+  sqlite3_bind_text(stmt, 3, album.c_str(), -1, SQLITE_TRANSIENT);
+  sqlite3_bind_text(stmt, 4, artist, -1, SQLITE_TRANSIENT);
+
+  rc = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (rc != SQLITE_DONE) {
+    std::cerr << "Update failed: " << sqlite3_errmsg(db) << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+bool Database::get_track_loudness(int id, TrackLoudness &loudness) {
+  const char *sql = "SELECT loudness_lufs, true_peak_dbtp, "
+                    "album_loudness_lufs, album_peak_dbtp FROM tracks "
+                    "WHERE id = ?;";
+
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return false;
+  }
+
+  sqlite3_bind_int(stmt, 1, id);
+
+  loudness = TrackLoudness();
+  if (sqlite3_step(stmt) == SQLITE_ROW &&
+      sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+    loudness.analyzed = true;
+    loudness.track_lufs = sqlite3_column_double(stmt, 0);
+    loudness.track_peak_dbtp = sqlite3_column_double(stmt, 1);
+    if (sqlite3_column_type(stmt, 2) != SQLITE_NULL) {
+      loudness.has_album = true;
+      loudness.album_lufs = sqlite3_column_double(stmt, 2);
+      loudness.album_peak_dbtp = sqlite3_column_double(stmt, 3);
+    }
+  }
+
+  sqlite3_finalize(stmt);
+  return loudness.analyzed;
+}
+
+int Database::set_track_audible_range(int id, double start_seconds,
+                                      double end_seconds) {
+  const char *sql =
+      "UPDATE tracks SET audible_start = ?, audible_end = ? WHERE id = ?;";
+
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return 1;
+  }
+
+  sqlite3_bind_double(stmt, 1, start_seconds);
+  sqlite3_bind_double(stmt, 2, end_seconds);
+  sqlite3_bind_int(stmt, 3, id);
+
+  rc = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (rc != SQLITE_DONE) {
+    std::cerr << "Update failed: " << sqlite3_errmsg(db) << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+bool Database::get_track_audible_range(int id, AudibleRange &range) {
+  const char *sql =
+      "SELECT audible_start, audible_end FROM tracks WHERE id = ?;";
+
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return false;
+  }
+
+  sqlite3_bind_int(stmt, 1, id);
+
+  range = AudibleRange();
+  if (sqlite3_step(stmt) == SQLITE_ROW &&
+      sqlite3_column_type(stmt, 1) != SQLITE_NULL) {
+    range.analyzed = true;
+    range.start_seconds = sqlite3_column_double(stmt, 0);
+    range.end_seconds = sqlite3_column_double(stmt, 1);
+  }
+
+  sqlite3_finalize(stmt);
+  return range.analyzed;
+}
+
+// The points are stored as the raw array; the index is a cache that is
+// rebuilt whenever it fails to load, so the blob never leaves this machine.
+bool Database::get_seek_index(int id, SeekIndex &index) {
+  const char *sql = "SELECT file_bytes, total_frames, points FROM seek_index "
+                    "WHERE track_id = ?;";
+
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return false;
+  }
+
+  sqlite3_bind_int(stmt, 1, id);
+
+  index = SeekIndex();
+  bool found = false;
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    const void *blob = sqlite3_column_blob(stmt, 2);
+    int bytes = sqlite3_column_bytes(stmt, 2);
+    if (blob != nullptr && bytes > 0 && bytes % sizeof(SeekPoint) == 0) {
+      index.file_bytes =
+          static_cast<std::uintmax_t>(sqlite3_column_int64(stmt, 0));
+      index.total_frames =
+          static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 1));
+      index.points.resize(bytes / sizeof(SeekPoint));
+      std::memcpy(index.points.data(), blob, bytes);
+      found = true;
+    }
+  }
+
+  sqlite3_finalize(stmt);
+  return found;
+}
+
+int Database::set_seek_index(int id, const SeekIndex &index) {
+  const char *sql = "INSERT OR REPLACE INTO seek_index "
+                    "(track_id, file_bytes, total_frames, points) "
+                    "VALUES (?, ?, ?, ?);";
+
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return 1;
+  }
+
+  sqlite3_bind_int(stmt, 1, id);
+  sqlite3_bind_int64(stmt, 2, static_cast<sqlite3_int64>(index.file_bytes));
+  sqlite3_bind_int64(stmt, 3, static_cast<sqlite3_int64>(index.total_frames));
+  sqlite3_bind_blob(stmt, 4, index.points.data(),
+                    static_cast<int>(index.points.size() * sizeof(SeekPoint)),
+                    SQLITE_STATIC);
+
+  rc = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (rc != SQLITE_DONE) {
+    std::cerr << "Insert failed: " << sqlite3_errmsg(db) << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
 AppState Database::load_app_state() {
   AppState state{};
   const char *sql = "SELECT last_track_id, last_playlist_id, volume, "
-                    "if_shuffled, is_repeat FROM app_state WHERE id = 1;";
+                    "if_shuffled, is_repeat, normalization, skip_silence, "
+                    "playback_speed FROM app_state WHERE id = 1;";
   sqlite3_stmt *stmt;
   int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
 
@@ -281,6 +1035,9 @@ AppState Database::load_app_state() {
     state.volume = static_cast<float>(sqlite3_column_double(stmt, 2));
     state.if_shuffled = sqlite3_column_int(stmt, 3);
     state.is_repeat = sqlite3_column_int(stmt, 4);
+    state.normalization = sqlite3_column_int(stmt, 5);
+    state.skip_silence = sqlite3_column_int(stmt, 6);
+    state.playback_speed = static_cast<float>(sqlite3_column_double(stmt, 7));
   } else {
     const char *insert_sql =
         "INSERT INTO app_state (id, last_track_id, last_playlist_id, volume, "
@@ -302,7 +1059,8 @@ AppState Database::load_app_state() {
 void Database::save_app_state(const AppState &s) {
   const char *sql =
       "UPDATE app_state SET last_track_id = ?, last_playlist_id = ?, volume = "
-      "?, if_shuffled = ?, is_repeat = ? WHERE id = 1;";
+      "?, if_shuffled = ?, is_repeat = ?, normalization = ?, skip_silence = ?, "
+      "playback_speed = ? WHERE id = 1;";
 
   sqlite3_stmt *stmt;
   int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
@@ -318,12 +1076,15 @@ void Database::save_app_state(const AppState &s) {
   sqlite3_bind_double(stmt, 3, s.volume);
   sqlite3_bind_int(stmt, 4, s.if_shuffled);
   sqlite3_bind_int(stmt, 5, s.is_repeat);
+  sqlite3_bind_int(stmt, 6, s.normalization);
+  sqlite3_bind_int(stmt, 7, s.skip_silence);
+  sqlite3_bind_double(stmt, 8, s.playback_speed);
 
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
 }
 
-int Database::add_playlist(const char *playlist_name) {
+int Database::add_playlist(const char *playlist_name, int *playlist_id) {
   const char *sql = "INSERT INTO playlists (name, created_at) VALUES (?,?);";
 
   sqlite3_stmt *stmt;
@@ -344,6 +1105,10 @@ int Database::add_playlist(const char *playlist_name) {
     return 1;
   }
 
+  if (playlist_id != nullptr) {
+    *playlist_id = static_cast<int>(sqlite3_last_insert_rowid(db));
+  }
+
   sqlite3_finalize(stmt);
   return 0;
 }
@@ -411,6 +1176,56 @@ int Database::add_track_to_playlist(int playlist_id, int track_id,
   return 0;
 }
 
+int Database::add_tracks_to_playlist(int playlist_id,
+                                     const std::vector<int> &track_ids) {
+  if (track_ids.empty()) {
+    return 0;
+  }
+
+  rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to begin transaction: " << sqlite3_errmsg(db)
+              << std::endl;
+    return 1;
+  }
+
+  int position = get_next_position(playlist_id);
+  const char *sql = "INSERT INTO playlist_tracks (playlist_id, track_id, "
+                    "position) VALUES (?,?,?);";
+  sqlite3_stmt *stmt;
+
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare: " << sqlite3_errmsg(db) << std::endl;
+    sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    return 1;
+  }
+
+  sqlite3_bind_int(stmt, 1, playlist_id);
+  for (int track_id : track_ids) {
+    sqlite3_bind_int(stmt, 2, track_id);
+    sqlite3_bind_int(stmt, 3, position++);
+
+    rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE) {
+      std::cerr << "Insert failed: " << sqlite3_errmsg(db) << std::endl;
+      sqlite3_finalize(stmt);
+      sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+      return 1;
+    }
+    sqlite3_reset(stmt);
+  }
+
+  sqlite3_finalize(stmt);
+  rc = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Commit failed: " << sqlite3_errmsg(db) << std::endl;
+    sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    return 1;
+  }
+  return 0;
+}
+
 int Database::remove_track_from_playlist(int playlist_id, int track_id) {
   const char *sql =
       "DELETE FROM playlist_tracks WHERE playlist_id = ? AND track_id =?;";
@@ -457,6 +1272,31 @@ int Database::get_next_position(int playlist_id) {
   return pos;
 }
 
+std::unordered_map<std::string, int> Database::get_track_path_index() {
+  std::unordered_map<std::string, int> index;
+  const char *sql = "SELECT id, file_path FROM tracks";
+
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return index;
+  }
+
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    std::filesystem::path p(get_text(stmt, 1));
+    index.emplace(p.lexically_normal().string(), sqlite3_column_int(stmt, 0));
+  }
+
+  if (rc != SQLITE_DONE) {
+    std::cerr << "Select failed: " << sqlite3_errmsg(db) << std::endl;
+  }
+
+  sqlite3_finalize(stmt);
+  return index;
+}
+
 std::vector<Playlist> Database::get_all_playlist() {
   std::vector<Playlist> playlists;
   const char *sql = "SELECT id, name FROM playlists";
@@ -488,7 +1328,8 @@ std::vector<Track> Database::get_all_tracks_by_playlist(int playlist_id) {
   std::vector<Track> playlist_tracks;
   const char *sql =
       "SELECT t.id, t.file_path, t.title, t.artist, t.duration, t.date_added, "
-      "t.last_played, t.play_count FROM playlist_tracks pt JOIN tracks t ON "
+      "t.last_played, t.play_count, IFNULL(t.bpm, 0), "
+      "IFNULL(t.musical_key, -1) FROM playlist_tracks pt JOIN tracks t ON "
       "pt.track_id = t.id WHERE pt.playlist_id = ? ORDER BY pt.position;";
 
   sqlite3_stmt *stmt;
@@ -510,6 +1351,8 @@ std::vector<Track> Database::get_all_tracks_by_playlist(int playlist_id) {
     t.date_added = get_text(stmt, 5);
     t.last_played = sqlite3_column_int(stmt, 6);
     t.play_count = sqlite3_column_int(stmt, 7);
+    t.bpm = sqlite3_column_double(stmt, 8);
+    t.musical_key = sqlite3_column_int(stmt, 9);
 
     playlist_tracks.push_back(t);
   }
@@ -0,0 +1,108 @@
+#include "decode_policy.hpp"
+
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+
+struct CodecInfo {
+  const char *extension;
+  double decoded_ratio;
+  bool compressed;
+};
+
+// Rough decoded-to-encoded size ratios at the codec's native sample format.
+static const CodecInfo codecs[] = {
+    {".wav", 1.0, false}, {".aif", 1.0, false}, {".aiff", 1.0, false},
+    {".flac", 1.8, true}, {".mp3", 11.0, true}, {".ogg", 10.0, true},
+};
+
+static const double default_decoded_ratio = 10.0;
+static const std::uintmax_t decode_limit_bytes = 48ULL << 20;
+static const std::uintmax_t stream_estimate_bytes = 768ULL << 10;
+static const std::uintmax_t default_budget_bytes = 256ULL << 20;
+
+const char *decode_mode_name(DecodeMode mode) {
+  switch (mode) {
+  case DecodeMode::Decoded:
+    return "decoded";
+  case DecodeMode::Encoded:
+    return "in memory";
+  case DecodeMode::Cached:
+    return "cached";
+  default:
+    return "streaming";
+  }
+}
+
+ma_uint32 decode_mode_flags(DecodeMode mode) {
+  switch (mode) {
+  case DecodeMode::Decoded:
+    return MA_SOUND_FLAG_DECODE;
+  case DecodeMode::Stream:
+    return MA_SOUND_FLAG_STREAM;
+  default:
+    return 0;
+  }
+}
+
+std::uintmax_t audio_budget_from_env() {
+  const char *value = std::getenv("MUSIC_PLAYR_AUDIO_BUDGET_MB");
+  if (value != nullptr) {
+    long long mb = std::atoll(value);
+    if (mb > 0) {
+      return static_cast<std::uintmax_t>(mb) << 20;
+    }
+  }
+  return default_budget_bytes;
+}
+
+static CodecInfo codec_for(const std::string &path) {
+  std::string ext = std::filesystem::path(path).extension().string();
+  for (auto &c : ext) {
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  }
+  for (const auto &codec : codecs) {
+    if (ext == codec.extension) {
+      return codec;
+    }
+  }
+  return {"", default_decoded_ratio, true};
+}
+
+DecodeChoice choose_decode_mode(const std::string &path,
+                                std::uintmax_t budget_bytes,
+                                std::uintmax_t used_bytes) {
+  DecodeChoice choice;
+  std::error_code ec;
+  choice.file_bytes = std::filesystem::file_size(path, ec);
+  if (ec) {
+    choice.file_bytes = 0;
+    choice.estimated_bytes = stream_estimate_bytes;
+    return choice;
+  }
+
+  std::uintmax_t available =
+      budget_bytes > used_bytes ? budget_bytes - used_bytes : 0;
+  CodecInfo codec = codec_for(path);
+  std::uintmax_t decoded_bytes =
+      static_cast<std::uintmax_t>(choice.file_bytes * codec.decoded_ratio);
+
+  std::uintmax_t decode_cap = budget_bytes / 4;
+  if (decode_cap > decode_limit_bytes) {
+    decode_cap = decode_limit_bytes;
+  }
+
+  if (codec.compressed && decoded_bytes <= decode_cap &&
+      decoded_bytes <= available) {
+    choice.mode = DecodeMode::Decoded;
+    choice.estimated_bytes = decoded_bytes;
+  } else if (choice.file_bytes <= budget_bytes / 2 &&
+             choice.file_bytes <= available) {
+    choice.mode = DecodeMode::Encoded;
+    choice.estimated_bytes = choice.file_bytes;
+  } else {
+    choice.mode = DecodeMode::Stream;
+    choice.estimated_bytes = stream_estimate_bytes;
+  }
+  return choice;
+}
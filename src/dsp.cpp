@@ -0,0 +1,676 @@
+#include "dsp.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+static const double pi = 3.14159265358979323846;
+static const size_t cascade_chunk = 256;
+
+// Coefficients from the BS.1770 reference filters, re-derived for the given
+// rate through the bilinear transform so 44.1 kHz material is not measured
+// with 48 kHz coefficients.
+Biquad k_weighting_shelf(double sample_rate) {
+  const double f0 = 1681.974450955533;
+  const double gain_db = 3.999843853973347;
+  const double q = 0.7071752369554196;
+
+  double k = std::tan(pi * f0 / sample_rate);
+  double vh = std::pow(10.0, gain_db / 20.0);
+  double vb = std::pow(vh, 0.4996667741545416);
+  double a0 = 1.0 + k / q + k * k;
+
+  Biquad f;
+  f.b0 = (vh + vb * k / q + k * k) / a0;
+  f.b1 = 2.0 * (k * k - vh) / a0;
+  f.b2 = (vh - vb * k / q + k * k) / a0;
+  f.a1 = 2.0 * (k * k - 1.0) / a0;
+  f.a2 = (1.0 - k / q + k * k) / a0;
+  return f;
+}
+
+Biquad k_weighting_highpass(double sample_rate) {
+  const double f0 = 38.13547087602444;
+  const double q = 0.5003270373238773;
+
+  double k = std::tan(pi * f0 / sample_rate);
+  double a0 = 1.0 + k / q + k * k;
+
+  Biquad f;
+  f.b0 = 1.0;
+  f.b1 = -2.0;
+  f.b2 = 1.0;
+  f.a1 = 2.0 * (k * k - 1.0) / a0;
+  f.a2 = (1.0 - k / q + k * k) / a0;
+  return f;
+}
+
+Biquad design_biquad(FilterType type, double frequency, double gain_db,
+                     double q, double sample_rate) {
+  if (gain_db == 0.0 || sample_rate <= 0.0) {
+    return Biquad();
+  }
+  frequency = std::max(1.0, std::min(frequency, sample_rate * 0.49));
+  q = std::max(0.05, q);
+
+  double a = std::pow(10.0, gain_db / 40.0);
+  double w0 = 2.0 * pi * frequency / sample_rate;
+  double cw = std::cos(w0);
+  double alpha = std::sin(w0) / (2.0 * q);
+  double sa = 2.0 * std::sqrt(a) * alpha;
+
+  double b0, b1, b2, a0, a1, a2;
+  switch (type) {
+  case FilterType::LowShelf:
+    b0 = a * ((a + 1.0) - (a - 1.0) * cw + sa);
+    b1 = 2.0 * a * ((a - 1.0) - (a + 1.0) * cw);
+    b2 = a * ((a + 1.0) - (a - 1.0) * cw - sa);
+    a0 = (a + 1.0) + (a - 1.0) * cw + sa;
+    a1 = -2.0 * ((a - 1.0) + (a + 1.0) * cw);
+    a2 = (a + 1.0) + (a - 1.0) * cw - sa;
+    break;
+  case FilterType::HighShelf:
+    b0 = a * ((a + 1.0) + (a - 1.0) * cw + sa);
+    b1 = -2.0 * a * ((a - 1.0) + (a + 1.0) * cw);
+    b2 = a * ((a + 1.0) + (a - 1.0) * cw - sa);
+    a0 = (a + 1.0) - (a - 1.0) * cw + sa;
+    a1 = 2.0 * ((a - 1.0) - (a + 1.0) * cw);
+    a2 = (a + 1.0) - (a - 1.0) * cw - sa;
+    break;
+  default:
+    b0 = 1.0 + alpha * a;
+    b1 = -2.0 * cw;
+    b2 = 1.0 - alpha * a;
+    a0 = 1.0 + alpha / a;
+    a1 = -2.0 * cw;
+    a2 = 1.0 - alpha / a;
+    break;
+  }
+
+  Biquad f;
+  f.b0 = b0 / a0;
+  f.b1 = b1 / a0;
+  f.b2 = b2 / a0;
+  f.a1 = a1 / a0;
+  f.a2 = a2 / a0;
+  return f;
+}
+
+bool is_identity(const Biquad &f) {
+  return f.b0 == 1.0 && f.b1 == 0.0 && f.b2 == 0.0 && f.a1 == 0.0 &&
+         f.a2 == 0.0;
+}
+
+double to_db(double linear) {
+  return linear > 0.0 ? 20.0 * std::log10(linear) : -HUGE_VAL;
+}
+
+double from_db(double db) { return std::pow(10.0, db / 20.0); }
+
+void KWeighting::init(int channel_count, double sample_rate) {
+  channels = channel_count;
+  shelf = k_weighting_shelf(sample_rate);
+  highpass = k_weighting_highpass(sample_rate);
+  reset();
+}
+
+void KWeighting::reset() { state.assign(channels * 4, 0.0); }
+
+void KWeighting::process(const float *frames, size_t count,
+                         double *sum_squares) {
+  int c = 0;
+
+#if defined(__SSE2__)
+  // Flush denormals while the filters ring down through silence.
+  unsigned int csr = _mm_getcsr();
+  _mm_setcsr(csr | 0x8040);
+
+  const __m128d sb0 = _mm_set1_pd(shelf.b0), sb1 = _mm_set1_pd(shelf.b1),
+                sb2 = _mm_set1_pd(shelf.b2), sa1 = _mm_set1_pd(shelf.a1),
+                sa2 = _mm_set1_pd(shelf.a2);
+  const __m128d hb0 = _mm_set1_pd(highpass.b0),
+                hb1 = _mm_set1_pd(highpass.b1),
+                hb2 = _mm_set1_pd(highpass.b2),
+                ha1 = _mm_set1_pd(highpass.a1),
+                ha2 = _mm_set1_pd(highpass.a2);
+
+  for (; c + 1 < channels; c += 2) {
+    double *s = &state[c * 4];
+    __m128d s1 = _mm_set_pd(s[4], s[0]);
+    __m128d s2 = _mm_set_pd(s[5], s[1]);
+    __m128d h1 = _mm_set_pd(s[6], s[2]);
+    __m128d h2 = _mm_set_pd(s[7], s[3]);
+    __m128d acc = _mm_setzero_pd();
+
+    const float *in = frames + c;
+    for (size_t i = 0; i < count; ++i, in += channels) {
+      __m128d x = _mm_set_pd(in[1], in[0]);
+
+      __m128d y = _mm_add_pd(_mm_mul_pd(sb0, x), s1);
+      s1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(sb1, x), _mm_mul_pd(sa1, y)), s2);
+      s2 = _mm_sub_pd(_mm_mul_pd(sb2, x), _mm_mul_pd(sa2, y));
+
+      __m128d z = _mm_add_pd(_mm_mul_pd(hb0, y), h1);
+      h1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(hb1, y), _mm_mul_pd(ha1, z)), h2);
+      h2 = _mm_sub_pd(_mm_mul_pd(hb2, y), _mm_mul_pd(ha2, z));
+
+      acc = _mm_add_pd(acc, _mm_mul_pd(z, z));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    sum_squares[c] += lanes[0];
+    sum_squares[c + 1] += lanes[1];
+
+    _mm_storel_pd(&s[0], s1);
+    _mm_storeh_pd(&s[4], s1);
+    _mm_storel_pd(&s[1], s2);
+    _mm_storeh_pd(&s[5], s2);
+    _mm_storel_pd(&s[2], h1);
+    _mm_storeh_pd(&s[6], h1);
+    _mm_storel_pd(&s[3], h2);
+    _mm_storeh_pd(&s[7], h2);
+  }
+#endif
+
+  for (; c < channels; ++c) {
+    double *s = &state[c * 4];
+    double acc = 0.0;
+
+    const float *in = frames + c;
+    for (size_t i = 0; i < count; ++i, in += channels) {
+      double x = *in;
+
+      double y = shelf.b0 * x + s[0];
+      s[0] = shelf.b1 * x - shelf.a1 * y + s[1];
+      s[1] = shelf.b2 * x - shelf.a2 * y;
+
+      double z = highpass.b0 * y + s[2];
+      s[2] = highpass.b1 * y - highpass.a1 * z + s[3];
+      s[3] = highpass.b2 * y - highpass.a2 * z;
+
+      acc += z * z;
+    }
+    sum_squares[c] += acc;
+  }
+
+#if defined(__SSE2__)
+  _mm_setcsr(csr);
+#endif
+}
+
+void BiquadCascade::init(int channel_count) {
+  channels = channel_count;
+  reset();
+}
+
+void BiquadCascade::reset() { state.assign(max_stages * channels * 2, 0.0); }
+
+void BiquadCascade::set(const Biquad *coeffs, const bool *enabled, int count) {
+  stage_count = std::min(count, max_stages);
+  for (int i = 0; i < stage_count; ++i) {
+    bool on = enabled[i] && !is_identity(coeffs[i]);
+    if (on && !active[i]) {
+      for (int c = 0; c < channels; ++c) {
+        double *s = stage_state(i, c);
+        s[0] = s[1] = 0.0;
+      }
+    }
+    stages[i] = coeffs[i];
+    active[i] = on;
+  }
+}
+
+int BiquadCascade::active_stages() const {
+  int n = 0;
+  for (int i = 0; i < stage_count; ++i) {
+    n += active[i] ? 1 : 0;
+  }
+  return n;
+}
+
+void BiquadCascade::process(float *frames, size_t count) {
+  if (active_stages() == 0) {
+    return;
+  }
+
+#if defined(__SSE2__)
+  unsigned int csr = _mm_getcsr();
+  _mm_setcsr(csr | 0x8040);
+#endif
+
+  int c = 0;
+#if defined(__AVX__)
+  for (; c + 3 < channels; c += 4) {
+    process_avx(frames, count, c);
+  }
+#endif
+#if defined(__SSE2__)
+  for (; c + 1 < channels; c += 2) {
+    process_sse2(frames, count, c);
+  }
+#endif
+  for (; c < channels; ++c) {
+    process_channel(frames, count, c);
+  }
+
+#if defined(__SSE2__)
+  _mm_setcsr(csr);
+#endif
+}
+
+void BiquadCascade::process_scalar(float *frames, size_t count) {
+#if defined(__SSE2__)
+  unsigned int csr = _mm_getcsr();
+  _mm_setcsr(csr | 0x8040);
+#endif
+
+  for (int c = 0; c < channels; ++c) {
+    process_channel(frames, count, c);
+  }
+
+#if defined(__SSE2__)
+  _mm_setcsr(csr);
+#endif
+}
+
+// Each group of channels is widened to double once per chunk, run through
+// every stage with that stage's history held in registers, then narrowed
+// back, so no stage sees float rounding from the one before it.
+void BiquadCascade::process_channel(float *frames, size_t count, int c) {
+  double buf[cascade_chunk];
+
+  for (size_t start = 0; start < count; start += cascade_chunk) {
+    size_t n = std::min(cascade_chunk, count - start);
+    float *io = frames + start * channels + c;
+    for (size_t i = 0; i < n; ++i) {
+      buf[i] = io[i * channels];
+    }
+
+    for (int st = 0; st < stage_count; ++st) {
+      if (!active[st]) {
+        continue;
+      }
+      const Biquad &f = stages[st];
+      double *s = stage_state(st, c);
+      double s1 = s[0], s2 = s[1];
+      for (size_t i = 0; i < n; ++i) {
+        double x = buf[i];
+        double y = f.b0 * x + s1;
+        s1 = f.b1 * x - f.a1 * y + s2;
+        s2 = f.b2 * x - f.a2 * y;
+        buf[i] = y;
+      }
+      s[0] = s1;
+      s[1] = s2;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      io[i * channels] = static_cast<float>(buf[i]);
+    }
+  }
+}
+
+void BiquadCascade::process_sse2(float *frames, size_t count, int c) {
+#if defined(__SSE2__)
+  __m128d buf[cascade_chunk];
+
+  for (size_t start = 0; start < count; start += cascade_chunk) {
+    size_t n = std::min(cascade_chunk, count - start);
+    float *io = frames + start * channels + c;
+    for (size_t i = 0; i < n; ++i) {
+      const float *in = io + i * channels;
+      buf[i] = _mm_set_pd(in[1], in[0]);
+    }
+
+    for (int st = 0; st < stage_count; ++st) {
+      if (!active[st]) {
+        continue;
+      }
+      const Biquad &f = stages[st];
+      const __m128d b0 = _mm_set1_pd(f.b0), b1 = _mm_set1_pd(f.b1),
+                    b2 = _mm_set1_pd(f.b2), a1 = _mm_set1_pd(f.a1),
+                    a2 = _mm_set1_pd(f.a2);
+      double *l = stage_state(st, c);
+      double *r = stage_state(st, c + 1);
+      __m128d s1 = _mm_set_pd(r[0], l[0]);
+      __m128d s2 = _mm_set_pd(r[1], l[1]);
+
+      for (size_t i = 0; i < n; ++i) {
+        __m128d x = buf[i];
+        __m128d y = _mm_add_pd(_mm_mul_pd(b0, x), s1);
+        s1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1, x), _mm_mul_pd(a1, y)), s2);
+        s2 = _mm_sub_pd(_mm_mul_pd(b2, x), _mm_mul_pd(a2, y));
+        buf[i] = y;
+      }
+
+      _mm_storel_pd(&l[0], s1);
+      _mm_storeh_pd(&r[0], s1);
+      _mm_storel_pd(&l[1], s2);
+      _mm_storeh_pd(&r[1], s2);
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      _mm_storel_pi(reinterpret_cast<__m64 *>(io + i * channels),
+                    _mm_cvtpd_ps(buf[i]));
+    }
+  }
+#else
+  process_channel(frames, count, c);
+  process_channel(frames, count, c + 1);
+#endif
+}
+
+void BiquadCascade::process_avx(float *frames, size_t count, int c) {
+#if defined(__AVX__)
+  __m256d buf[cascade_chunk];
+
+  for (size_t start = 0; start < count; start += cascade_chunk) {
+    size_t n = std::min(cascade_chunk, count - start);
+    float *io = frames + start * channels + c;
+    for (size_t i = 0; i < n; ++i) {
+      buf[i] = _mm256_cvtps_pd(_mm_loadu_ps(io + i * channels));
+    }
+
+    for (int st = 0; st < stage_count; ++st) {
+      if (!active[st]) {
+        continue;
+      }
+      const Biquad &f = stages[st];
+      const __m256d b0 = _mm256_set1_pd(f.b0), b1 = _mm256_set1_pd(f.b1),
+                    b2 = _mm256_set1_pd(f.b2), a1 = _mm256_set1_pd(f.a1),
+                    a2 = _mm256_set1_pd(f.a2);
+      double *s[4] = {stage_state(st, c), stage_state(st, c + 1),
+                      stage_state(st, c + 2), stage_state(st, c + 3)};
+      __m256d s1 = _mm256_set_pd(s[3][0], s[2][0], s[1][0], s[0][0]);
+      __m256d s2 = _mm256_set_pd(s[3][1], s[2][1], s[1][1], s[0][1]);
+
+      for (size_t i = 0; i < n; ++i) {
+        __m256d x = buf[i];
+        __m256d y = _mm256_add_pd(_mm256_mul_pd(b0, x), s1);
+        s1 = _mm256_add_pd(
+            _mm256_sub_pd(_mm256_mul_pd(b1, x), _mm256_mul_pd(a1, y)), s2);
+        s2 = _mm256_sub_pd(_mm256_mul_pd(b2, x), _mm256_mul_pd(a2, y));
+        buf[i] = y;
+      }
+
+      double lanes1[4], lanes2[4];
+      _mm256_storeu_pd(lanes1, s1);
+      _mm256_storeu_pd(lanes2, s2);
+      for (int k = 0; k < 4; ++k) {
+        s[k][0] = lanes1[k];
+        s[k][1] = lanes2[k];
+      }
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      _mm_storeu_ps(io + i * channels, _mm256_cvtpd_ps(buf[i]));
+    }
+  }
+#else
+  process_sse2(frames, count, c);
+  process_sse2(frames, count, c + 2);
+#endif
+}
+
+void TruePeak::init(int channel_count) {
+  channels = channel_count;
+  history.assign(channels * taps * 2, 0.0f);
+  position = 0;
+  peak = 0.0f;
+
+  // Prototype low-pass at the original Nyquist, 48 taps centred between
+  // samples, Blackman-windowed. Phase p, tap k multiplies the sample k steps
+  // from the oldest in the 12-sample window.
+  const int length = phases * taps;
+  double h[phases * taps];
+  for (int n = 0; n < length; ++n) {
+    double t = (n - (length - 1) / 2.0) / phases;
+    double sinc = t == 0.0 ? 1.0 : std::sin(pi * t) / (pi * t);
+    double w = 0.42 - 0.5 * std::cos(2.0 * pi * (n + 0.5) / length) +
+               0.08 * std::cos(4.0 * pi * (n + 0.5) / length);
+    h[n] = sinc * w;
+  }
+
+  for (int p = 0; p < phases; ++p) {
+    double sum = 0.0;
+    for (int k = 0; k < taps; ++k) {
+      sum += h[phases * (taps - 1 - k) + p];
+    }
+    for (int k = 0; k < taps; ++k) {
+      coeffs[p][k] = static_cast<float>(h[phases * (taps - 1 - k) + p] / sum);
+    }
+  }
+}
+
+float TruePeak::push(int channel, float x) {
+  float *h = &history[channel * taps * 2];
+  h[position] = x;
+  h[position + taps] = x;
+  const float *window = h + position + 1;
+
+  float max = std::fabs(x);
+  for (int p = 0; p < phases; ++p) {
+#if defined(__SSE2__)
+    __m128 acc = _mm_mul_ps(_mm_loadu_ps(window), _mm_loadu_ps(coeffs[p]));
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(window + 4),
+                                     _mm_loadu_ps(coeffs[p] + 4)));
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(window + 8),
+                                     _mm_loadu_ps(coeffs[p] + 8)));
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    float y = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#else
+    float y = 0.0f;
+    for (int k = 0; k < taps; ++k) {
+      y += window[k] * coeffs[p][k];
+    }
+#endif
+    float a = std::fabs(y);
+    if (a > max) {
+      max = a;
+    }
+  }
+  return max;
+}
+
+void TruePeak::process(const float *frames, size_t count) {
+  float max = peak;
+
+  for (size_t i = 0; i < count; ++i) {
+    for (int c = 0; c < channels; ++c) {
+      float a = push(c, frames[i * channels + c]);
+      if (a > max) {
+        max = a;
+      }
+    }
+    position = position + 1 == taps ? 0 : position + 1;
+  }
+
+  peak = max;
+}
+
+void TruePeak::frame_peaks(const float *frames, size_t count, float *peaks) {
+  float max = peak;
+
+  for (size_t i = 0; i < count; ++i) {
+    float frame_max = 0.0f;
+    for (int c = 0; c < channels; ++c) {
+      float a = push(c, frames[i * channels + c]);
+      if (a > frame_max) {
+        frame_max = a;
+      }
+    }
+    peaks[i] = frame_max;
+    if (frame_max > max) {
+      max = frame_max;
+    }
+    position = position + 1 == taps ? 0 : position + 1;
+  }
+
+  peak = max;
+}
+
+void SlidingMax::init(size_t length) {
+  window = length > 0 ? length : 1;
+  block.assign(window, 0.0f);
+  reset();
+}
+
+void SlidingMax::reset() {
+  const float lowest = -std::numeric_limits<float>::infinity();
+  suffix.assign(window + 1, lowest);
+  position = 0;
+  running = lowest;
+}
+
+void SlidingMax::process(const float *in, float *out, size_t count) {
+  while (count > 0) {
+    size_t n = std::min(count, window - position);
+
+    for (size_t k = 0; k < n; ++k) {
+      running = std::max(running, in[k]);
+      block[position + k] = in[k];
+      out[k] = running;
+    }
+
+    // The window ending at block offset j starts at offset j + 1 of the
+    // previous block.
+    const float *tail = &suffix[position + 1];
+    size_t k = 0;
+#if defined(__SSE2__)
+    for (; k + 4 <= n; k += 4) {
+      _mm_storeu_ps(out + k,
+                    _mm_max_ps(_mm_loadu_ps(out + k), _mm_loadu_ps(tail + k)));
+    }
+#endif
+    for (; k < n; ++k) {
+      out[k] = std::max(out[k], tail[k]);
+    }
+
+    position += n;
+    in += n;
+    out += n;
+    count -= n;
+
+    if (position == window) {
+      suffix[window] = -std::numeric_limits<float>::infinity();
+      for (size_t j = window; j-- > 0;) {
+        suffix[j] = std::max(block[j], suffix[j + 1]);
+      }
+      position = 0;
+      running = -std::numeric_limits<float>::infinity();
+    }
+  }
+}
+
+#if defined(__SSE2__)
+// Bit i set when |x[i]| > threshold, for sixteen samples.
+static inline int above_mask16(const float *x, __m128 limit, __m128 abs_mask) {
+  __m128 a = _mm_and_ps(_mm_loadu_ps(x), abs_mask);
+  __m128 b = _mm_and_ps(_mm_loadu_ps(x + 4), abs_mask);
+  __m128 c = _mm_and_ps(_mm_loadu_ps(x + 8), abs_mask);
+  __m128 d = _mm_and_ps(_mm_loadu_ps(x + 12), abs_mask);
+  return _mm_movemask_ps(_mm_cmpgt_ps(a, limit)) |
+         _mm_movemask_ps(_mm_cmpgt_ps(b, limit)) << 4 |
+         _mm_movemask_ps(_mm_cmpgt_ps(c, limit)) << 8 |
+         _mm_movemask_ps(_mm_cmpgt_ps(d, limit)) << 12;
+}
+#endif
+
+size_t first_above(const float *samples, size_t count, float threshold) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128 limit = _mm_set1_ps(threshold);
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  for (; i + 16 <= count; i += 16) {
+    int mask = above_mask16(samples + i, limit, abs_mask);
+    if (mask != 0) {
+      return i + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    if (std::fabs(samples[i]) > threshold) {
+      return i;
+    }
+  }
+  return count;
+}
+
+size_t end_above(const float *samples, size_t count, float threshold) {
+  size_t i = count;
+#if defined(__SSE2__)
+  const __m128 limit = _mm_set1_ps(threshold);
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  size_t body = count - count % 16;
+  for (; i > body; --i) {
+    if (std::fabs(samples[i - 1]) > threshold) {
+      return i;
+    }
+  }
+  for (; i >= 16; i -= 16) {
+    int mask = above_mask16(samples + i - 16, limit, abs_mask);
+    if (mask != 0) {
+      return i - 16 + 32 - __builtin_clz(static_cast<unsigned>(mask));
+    }
+  }
+#endif
+  for (; i > 0; --i) {
+    if (std::fabs(samples[i - 1]) > threshold) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+float dot_product(const float *a, const float *b, size_t count) {
+  size_t i = 0;
+  float sum = 0.0f;
+#if defined(__SSE2__)
+  __m128 s0 = _mm_setzero_ps();
+  __m128 s1 = _mm_setzero_ps();
+  __m128 s2 = _mm_setzero_ps();
+  __m128 s3 = _mm_setzero_ps();
+  for (; i + 16 <= count; i += 16) {
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                                   _mm_loadu_ps(b + i + 4)));
+    s2 = _mm_add_ps(s2, _mm_mul_ps(_mm_loadu_ps(a + i + 8),
+                                   _mm_loadu_ps(b + i + 8)));
+    s3 = _mm_add_ps(s3, _mm_mul_ps(_mm_loadu_ps(a + i + 12),
+                                   _mm_loadu_ps(b + i + 12)));
+  }
+  __m128 total = _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3));
+  float lanes[4];
+  _mm_storeu_ps(lanes, total);
+  sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+  for (; i < count; ++i) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+void crossfade(const float *from, const float *to, const float *ramp,
+               float *out, size_t count) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 4 <= count; i += 4) {
+    __m128 f = _mm_loadu_ps(from + i);
+    __m128 d = _mm_sub_ps(_mm_loadu_ps(to + i), f);
+    __m128 r = _mm_loadu_ps(ramp + i);
+    _mm_storeu_ps(out + i, _mm_add_ps(f, _mm_mul_ps(d, r)));
+  }
+#endif
+  for (; i < count; ++i) {
+    out[i] = from[i] + (to[i] - from[i]) * ramp[i];
+  }
+}
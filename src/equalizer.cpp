@@ -0,0 +1,133 @@
+#include "equalizer.hpp"
+
+#include <chrono>
+#include <cstring>
+
+static const float default_frequencies[Equalizer::band_count] = {
+    31.0f,   62.0f,   125.0f,  250.0f,  500.0f,
+    1000.0f, 2000.0f, 4000.0f, 8000.0f, 16000.0f};
+
+ma_node_vtable Equalizer::vtable = {on_process, NULL, 1, 1, 0};
+
+Equalizer::Equalizer() {
+  for (int i = 0; i < band_count; ++i) {
+    bands[i].frequency = default_frequencies[i];
+  }
+  bands[0].type = FilterType::LowShelf;
+  bands[0].q = 0.71f;
+  bands[band_count - 1].type = FilterType::HighShelf;
+  bands[band_count - 1].q = 0.71f;
+}
+
+Equalizer::~Equalizer() { uninit(); }
+
+ma_result Equalizer::init(ma_engine *engine, ma_node *output) {
+  channels = ma_engine_get_channels(engine);
+  sample_rate = ma_engine_get_sample_rate(engine);
+  cascade.init(static_cast<int>(channels));
+
+  ma_uint32 input_channels[1] = {channels};
+  ma_uint32 output_channels[1] = {channels};
+  ma_node_config config = ma_node_config_init();
+  config.vtable = &vtable;
+  config.pInputChannels = input_channels;
+  config.pOutputChannels = output_channels;
+
+  ma_result result = ma_node_init(ma_engine_get_node_graph(engine), &config,
+                                  NULL, &base);
+  if (result != MA_SUCCESS) {
+    return result;
+  }
+  initialized = true;
+  publish();
+
+  return ma_node_attach_output_bus(&base, 0, output, 0);
+}
+
+void Equalizer::uninit() {
+  if (initialized) {
+    ma_node_uninit(&base, NULL);
+    initialized = false;
+  }
+}
+
+void Equalizer::publish() {
+  Coefficients &c = slots[back];
+  for (int i = 0; i < band_count; ++i) {
+    const EqBand &b = bands[i];
+    c.enabled[i] = enabled && b.enabled;
+    c.stages[i] = design_biquad(b.type, b.frequency, b.gain_db, b.q,
+                                sample_rate);
+  }
+  back = shared.exchange(back | 4, std::memory_order_acq_rel) & 3;
+}
+
+void Equalizer::set_enabled(bool on) {
+  enabled = on;
+  publish();
+}
+
+void Equalizer::set_band(int index, const EqBand &band) {
+  if (index < 0 || index >= band_count) {
+    return;
+  }
+  bands[index] = band;
+  publish();
+}
+
+void Equalizer::reset_bands() {
+  for (int i = 0; i < band_count; ++i) {
+    bands[i].gain_db = 0.0f;
+  }
+  publish();
+}
+
+void Equalizer::on_process(ma_node *node, const float **frames_in,
+                           ma_uint32 *frame_count_in, float **frames_out,
+                           ma_uint32 *frame_count_out) {
+  ma_uint32 count = *frame_count_out;
+  if (*frame_count_in < count) {
+    count = *frame_count_in;
+  }
+
+  reinterpret_cast<Equalizer *>(node)->process(frames_in[0], frames_out[0],
+                                               count);
+  *frame_count_in = count;
+  *frame_count_out = count;
+}
+
+void Equalizer::process(const float *frames_in, float *frames_out,
+                        ma_uint32 count) {
+  auto started = std::chrono::steady_clock::now();
+
+  if (shared.load(std::memory_order_relaxed) & 4) {
+    front = shared.exchange(front, std::memory_order_acq_rel) & 3;
+    const Coefficients &c = slots[front];
+    cascade.set(c.stages, c.enabled, band_count);
+    active_bands.store(cascade.active_stages(), std::memory_order_relaxed);
+  }
+
+  if (frames_out != frames_in) {
+    std::memcpy(frames_out, frames_in,
+                sizeof(float) * (size_t)count * channels);
+  }
+  cascade.process(frames_out, count);
+
+  long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - started)
+                     .count();
+  total_frames.fetch_add(count, std::memory_order_relaxed);
+  total_ns.fetch_add(ns, std::memory_order_relaxed);
+}
+
+EqualizerStats Equalizer::get_stats() const {
+  EqualizerStats s;
+  s.active_bands = active_bands.load(std::memory_order_relaxed);
+  s.sample_rate = sample_rate;
+  long long tf = total_frames.load(std::memory_order_relaxed);
+  if (tf > 0) {
+    s.us_per_second = total_ns.load(std::memory_order_relaxed) / 1000.0 /
+                      (static_cast<double>(tf) / sample_rate);
+  }
+  return s;
+}
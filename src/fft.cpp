@@ -0,0 +1,118 @@
+#include "fft.hpp"
+
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const double pi = 3.14159265358979323846;
+
+RealFft::RealFft(size_t size) : n(size), half(size / 2) {
+  size_t bits = 0;
+  while ((size_t(1) << bits) < half) {
+    ++bits;
+  }
+  bit_reverse.resize(half);
+  for (size_t i = 0; i < half; ++i) {
+    size_t r = 0;
+    for (size_t b = 0; b < bits; ++b) {
+      r |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    bit_reverse[i] = r;
+  }
+
+  // Twiddles laid out stage after stage so each stage reads them
+  // contiguously: the stage with span s uses exp(-i*pi*k/s) for k < s.
+  for (size_t span = 1; span < half; span *= 2) {
+    for (size_t k = 0; k < span; ++k) {
+      double angle = -pi * static_cast<double>(k) / static_cast<double>(span);
+      stage_cos.push_back(static_cast<float>(std::cos(angle)));
+      stage_sin.push_back(static_cast<float>(std::sin(angle)));
+    }
+  }
+
+  unpack_cos.resize(half + 1);
+  unpack_sin.resize(half + 1);
+  for (size_t k = 0; k <= half; ++k) {
+    double angle = -2.0 * pi * static_cast<double>(k) / static_cast<double>(n);
+    unpack_cos[k] = static_cast<float>(std::cos(angle));
+    unpack_sin[k] = static_cast<float>(std::sin(angle));
+  }
+
+  re.resize(half);
+  im.resize(half);
+}
+
+void RealFft::transform() {
+  const float *tw_cos = stage_cos.data();
+  const float *tw_sin = stage_sin.data();
+
+  for (size_t span = 1; span < half; span *= 2) {
+    for (size_t start = 0; start < half; start += span * 2) {
+      float *ar = &re[start];
+      float *ai = &im[start];
+      float *br = &re[start + span];
+      float *bi = &im[start + span];
+      size_t k = 0;
+
+#if defined(__SSE2__)
+      for (; k + 4 <= span; k += 4) {
+        __m128 wr = _mm_loadu_ps(tw_cos + k);
+        __m128 wi = _mm_loadu_ps(tw_sin + k);
+        __m128 xr = _mm_loadu_ps(br + k);
+        __m128 xi = _mm_loadu_ps(bi + k);
+        __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, wr), _mm_mul_ps(xi, wi));
+        __m128 ti = _mm_add_ps(_mm_mul_ps(xr, wi), _mm_mul_ps(xi, wr));
+        __m128 ur = _mm_loadu_ps(ar + k);
+        __m128 ui = _mm_loadu_ps(ai + k);
+        _mm_storeu_ps(ar + k, _mm_add_ps(ur, tr));
+        _mm_storeu_ps(ai + k, _mm_add_ps(ui, ti));
+        _mm_storeu_ps(br + k, _mm_sub_ps(ur, tr));
+        _mm_storeu_ps(bi + k, _mm_sub_ps(ui, ti));
+      }
+#endif
+      for (; k < span; ++k) {
+        float tr = br[k] * tw_cos[k] - bi[k] * tw_sin[k];
+        float ti = br[k] * tw_sin[k] + bi[k] * tw_cos[k];
+        float ur = ar[k];
+        float ui = ai[k];
+        ar[k] = ur + tr;
+        ai[k] = ui + ti;
+        br[k] = ur - tr;
+        bi[k] = ui - ti;
+      }
+    }
+    tw_cos += span;
+    tw_sin += span;
+  }
+}
+
+void RealFft::power(const float *input, float *out) {
+  for (size_t i = 0; i < half; ++i) {
+    size_t j = bit_reverse[i];
+    re[j] = input[2 * i];
+    im[j] = input[2 * i + 1];
+  }
+
+  transform();
+
+  // X[k] = E[k] + W^k O[k], where E and O are the spectra of the even and odd
+  // samples recovered from Z[k] and conj(Z[half - k]).
+  for (size_t k = 0; k <= half; ++k) {
+    size_t a = k == half ? 0 : k;
+    size_t b = k == 0 ? 0 : half - k;
+    float zr = re[a], zi = im[a];
+    float cr = re[b], ci = -im[b];
+
+    float er = 0.5f * (zr + cr);
+    float ei = 0.5f * (zi + ci);
+    float or_ = 0.5f * (zi - ci);
+    float oi = -0.5f * (zr - cr);
+
+    float wr = unpack_cos[k], wi = unpack_sin[k];
+    float xr = er + or_ * wr - oi * wi;
+    float xi = ei + or_ * wi + oi * wr;
+    out[k] = xr * xr + xi * xi;
+  }
+}
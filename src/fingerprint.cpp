@@ -0,0 +1,250 @@
+#include "fingerprint.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <unordered_map>
+
+static const size_t smooth_radius = 2;
+static const int max_shift = 16;
+static const size_t min_overlap = 24;
+static const int bands = 80;
+static const int rows = 4;
+// The neighbouring-pitch-class bits: the part of a word that survives a
+// shifted frame grid best, and so the part two copies share most exactly.
+static const std::uint32_t shape_bits = 0xfff;
+// Shapes are paired with the one this many frames later; a single shape
+// has too few values to tell unrelated songs in the same key apart.
+static const size_t shingle_gap = 4;
+static const int max_bucket_tracks = 64;
+
+static inline std::uint64_t mix(std::uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// The compiler's popcount is a library call unless the target has the
+// instruction, so count the bits of the 32-bit differences by hand.
+static inline int bit_count(std::uint32_t x) {
+  x -= (x >> 1) & 0x55555555u;
+  x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+  x = (x + (x >> 4)) & 0x0f0f0f0fu;
+  return static_cast<int>((x * 0x01010101u) >> 24);
+}
+
+std::vector<std::uint32_t>
+chroma_fingerprint(const std::vector<float> &chroma) {
+  size_t n = chroma.size() / 12;
+  std::vector<std::array<float, 12>> unit(n);
+  for (size_t t = 0; t < n; ++t) {
+    const float *c = &chroma[t * 12];
+    float sum = 1e-9f;
+    for (int k = 0; k < 12; ++k) {
+      sum += c[k];
+    }
+    for (int k = 0; k < 12; ++k) {
+      unit[t][k] = c[k] / sum;
+    }
+  }
+
+  // Averaging over five frames (about a second) makes the words insensitive
+  // to where the frame grid happens to fall, which differs between copies
+  // with different encoder delay or leading silence.
+  std::vector<std::array<float, 12>> smooth(n);
+  for (size_t t = 0; t < n; ++t) {
+    size_t lo = t > smooth_radius ? t - smooth_radius : 0;
+    size_t hi = std::min(n - 1, t + smooth_radius);
+    for (int k = 0; k < 12; ++k) {
+      float sum = 0.0f;
+      for (size_t u = lo; u <= hi; ++u) {
+        sum += unit[u][k];
+      }
+      smooth[t][k] = sum / (hi - lo + 1);
+    }
+  }
+
+  // Bits 0-11 compare each pitch class with the next, 12-23 with itself
+  // two frames back, and 24-31 with the pitch class a fifth above.
+  std::vector<std::uint32_t> words;
+  for (size_t t = 2; t < n; ++t) {
+    const auto &s = smooth[t];
+    const auto &p = smooth[t - 2];
+    std::uint32_t w = 0;
+    for (int k = 0; k < 12; ++k) {
+      w |= static_cast<std::uint32_t>(s[k] > s[(k + 1) % 12]) << k;
+      w |= static_cast<std::uint32_t>(s[k] > p[k]) << (12 + k);
+    }
+    for (int k = 0; k < 8; ++k) {
+      w |= static_cast<std::uint32_t>(s[k] > s[(k + 7) % 12]) << (24 + k);
+    }
+    words.push_back(w);
+  }
+  return words;
+}
+
+double fingerprint_similarity(const std::vector<std::uint32_t> &a,
+                              const std::vector<std::uint32_t> &b,
+                              double floor) {
+  double best = 0.0;
+  for (int shift = -max_shift; shift <= max_shift; ++shift) {
+    size_t ia = shift > 0 ? shift : 0;
+    size_t ib = shift < 0 ? -shift : 0;
+    if (ia >= a.size() || ib >= b.size()) {
+      continue;
+    }
+    size_t overlap = std::min(a.size() - ia, b.size() - ib);
+    if (overlap < min_overlap) {
+      continue;
+    }
+    // Unrelated alignments differ in half their bits, so most are abandoned
+    // well before the end of the overlap.
+    double bits = 32.0 * overlap;
+    long long allowed =
+        static_cast<long long>((1.0 - std::max(best, floor)) * bits);
+    long long differing = 0;
+    size_t i = 0;
+    for (; i < overlap && differing <= allowed; ++i) {
+      differing += bit_count(a[ia + i] ^ b[ib + i]);
+    }
+    if (i == overlap) {
+      best = std::max(best, 1.0 - differing / bits);
+    }
+  }
+  return best;
+}
+
+std::vector<std::int64_t>
+fingerprint_buckets(const std::vector<std::uint32_t> &fingerprint) {
+  std::vector<std::int64_t> keys;
+  if (fingerprint.size() < min_overlap) {
+    return keys;
+  }
+
+  std::vector<std::uint32_t> shapes;
+  shapes.reserve(fingerprint.size());
+  for (size_t t = 0; t + shingle_gap < fingerprint.size(); ++t) {
+    shapes.push_back((fingerprint[t] & shape_bits) << 12 |
+                     (fingerprint[t + shingle_gap] & shape_bits));
+  }
+  std::sort(shapes.begin(), shapes.end());
+  shapes.erase(std::unique(shapes.begin(), shapes.end()), shapes.end());
+
+  std::uint64_t minima[bands * rows];
+  std::fill(minima, minima + bands * rows, ~0ULL);
+  for (std::uint32_t shape : shapes) {
+    for (int h = 0; h < bands * rows; ++h) {
+      minima[h] =
+          std::min(minima[h], mix(shape ^ (0x9e3779b97f4a7c15ULL * (h + 1))));
+    }
+  }
+
+  for (int b = 0; b < bands; ++b) {
+    std::uint64_t key = b;
+    for (int r = 0; r < rows; ++r) {
+      key = mix(key ^ minima[b * rows + r]);
+    }
+    keys.push_back(static_cast<std::int64_t>(key));
+  }
+  return keys;
+}
+
+DuplicateFinder::DuplicateFinder(const std::string &db_path,
+                                 double min_similarity)
+    : db_path(db_path), min_similarity(min_similarity) {}
+
+DuplicateFinder::~DuplicateFinder() {
+  stopping = true;
+  if (worker.joinable()) {
+    worker.join();
+  }
+}
+
+bool DuplicateFinder::start() {
+  if (running) {
+    return false;
+  }
+  if (worker.joinable()) {
+    worker.join();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    report = DuplicateReport();
+    report.running = true;
+  }
+  running = true;
+  worker = std::thread(&DuplicateFinder::run, this);
+  return true;
+}
+
+DuplicateReport DuplicateFinder::get_report() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return report;
+}
+
+void DuplicateFinder::run() {
+  auto start = std::chrono::steady_clock::now();
+  Database db(db_path.c_str());
+  DuplicateReport result;
+  result.fingerprinted = db.count_fingerprints();
+
+  std::vector<std::pair<int, int>> candidates =
+      db.get_fingerprint_candidates(max_bucket_tracks);
+  result.candidates = static_cast<int>(candidates.size());
+
+  std::unordered_map<int, std::vector<std::uint32_t>> prints;
+  auto load = [&](int id) -> const std::vector<std::uint32_t> & {
+    auto it = prints.find(id);
+    if (it == prints.end()) {
+      it = prints.emplace(id, std::vector<std::uint32_t>()).first;
+      db.get_track_fingerprint(id, it->second);
+    }
+    return it->second;
+  };
+
+  std::vector<std::pair<int, int>> matches;
+  std::vector<double> similarities;
+  for (const auto &c : candidates) {
+    if (stopping) {
+      break;
+    }
+    double similarity =
+        fingerprint_similarity(load(c.first), load(c.second), min_similarity);
+    if (similarity >= min_similarity) {
+      matches.push_back(c);
+      similarities.push_back(similarity);
+    }
+  }
+
+  if (!matches.empty()) {
+    std::unordered_map<int, Track> tracks;
+    for (auto &t : db.get_all_tracks()) {
+      tracks.emplace(t.id, std::move(t));
+    }
+    for (size_t i = 0; i < matches.size(); ++i) {
+      DuplicatePair pair;
+      pair.first = tracks[matches[i].first];
+      pair.second = tracks[matches[i].second];
+      pair.similarity = similarities[i];
+      result.pairs.push_back(std::move(pair));
+    }
+    std::sort(result.pairs.begin(), result.pairs.end(),
+              [](const DuplicatePair &a, const DuplicatePair &b) {
+                return a.similarity > b.similarity;
+              });
+  }
+
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  result.finished = !stopping;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  report = std::move(result);
+  running = false;
+}
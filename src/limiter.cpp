@@ -0,0 +1,174 @@
+#include "limiter.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+static const size_t chunk_frames = 256;
+
+ma_node_vtable Limiter::vtable = {on_process, NULL, 1, 1, 0};
+
+Limiter::~Limiter() { uninit(); }
+
+ma_result Limiter::init(ma_engine *engine, ma_node *output,
+                        float lookahead_ms) {
+  channels = ma_engine_get_channels(engine);
+  sample_rate = ma_engine_get_sample_rate(engine);
+
+  lookahead = std::max<size_t>(
+      1, static_cast<size_t>(lookahead_ms / 1000.0f * sample_rate + 0.5f));
+  detector.init(static_cast<int>(channels));
+  // A peak shows up in the detector up to TruePeak::latency frames late, so
+  // the audio is held back by that much more and the hold window covers both.
+  hold.init(lookahead + TruePeak::latency + 2);
+  delay_frames = lookahead + TruePeak::latency;
+  delay.assign(delay_frames * channels, 0.0f);
+  smooth.assign(lookahead, 1.0f);
+  smooth_sum = static_cast<double>(lookahead);
+  unity_run = lookahead;
+
+  ma_uint32 input_channels[1] = {channels};
+  ma_uint32 output_channels[1] = {channels};
+  ma_node_config config = ma_node_config_init();
+  config.vtable = &vtable;
+  config.pInputChannels = input_channels;
+  config.pOutputChannels = output_channels;
+
+  ma_result result = ma_node_init(ma_engine_get_node_graph(engine), &config,
+                                  NULL, &base);
+  if (result != MA_SUCCESS) {
+    return result;
+  }
+  initialized = true;
+
+  return ma_node_attach_output_bus(&base, 0, output, 0);
+}
+
+void Limiter::uninit() {
+  if (initialized) {
+    ma_node_uninit(&base, NULL);
+    initialized = false;
+  }
+}
+
+void Limiter::set_ceiling(float db) {
+  ceiling_db.store(std::max(-24.0f, std::min(0.0f, db)));
+}
+
+void Limiter::set_release(float ms) {
+  release_ms.store(std::max(1.0f, std::min(5000.0f, ms)));
+}
+
+void Limiter::on_process(ma_node *node, const float **frames_in,
+                         ma_uint32 *frame_count_in, float **frames_out,
+                         ma_uint32 *frame_count_out) {
+  ma_uint32 count = *frame_count_out;
+  if (*frame_count_in < count) {
+    count = *frame_count_in;
+  }
+
+  reinterpret_cast<Limiter *>(node)->process(frames_in[0], frames_out[0],
+                                             count);
+  *frame_count_in = count;
+  *frame_count_out = count;
+}
+
+void Limiter::process(const float *frames_in, float *frames_out,
+                      ma_uint32 count) {
+  auto started = std::chrono::steady_clock::now();
+
+  const float ceiling =
+      static_cast<float>(from_db(ceiling_db.load(std::memory_order_relaxed)));
+  const float release =
+      1.0f - std::exp(-1000.0f /
+                      (release_ms.load(std::memory_order_relaxed) *
+                       sample_rate));
+  const double inv_lookahead = 1.0 / static_cast<double>(lookahead);
+
+  float peaks[chunk_frames];
+  float held[chunk_frames];
+  float min_gain = 1.0f;
+  long long limited = 0;
+
+  for (ma_uint32 start = 0; start < count; start += chunk_frames) {
+    size_t n = std::min<size_t>(chunk_frames, count - start);
+    const float *in = frames_in + (size_t)start * channels;
+    float *out = frames_out + (size_t)start * channels;
+
+    detector.frame_peaks(in, n, peaks);
+    hold.process(peaks, held, n);
+
+    for (size_t i = 0; i < n; ++i) {
+      float target = held[i] > ceiling ? ceiling / held[i] : 1.0f;
+      if (target < envelope) {
+        envelope = target;
+      } else {
+        envelope += (target - envelope) * release;
+        if (target - envelope < 1e-5f) {
+          envelope = target;
+        }
+      }
+      unity_run = envelope == 1.0f ? std::min(unity_run + 1, lookahead) : 0;
+
+      smooth_sum += envelope - smooth[smooth_pos];
+      smooth[smooth_pos] = envelope;
+      smooth_pos = smooth_pos + 1 == lookahead ? 0 : smooth_pos + 1;
+
+      // Once the whole smoothing window is at unity, pass audio through
+      // untouched and drop whatever rounding the running sum picked up.
+      float gain = 1.0f;
+      if (unity_run == lookahead) {
+        smooth_sum = static_cast<double>(lookahead);
+      } else {
+        gain = std::min(1.0f, static_cast<float>(smooth_sum * inv_lookahead));
+      }
+
+      float *line = &delay[delay_pos * channels];
+      const float *x = in + i * channels;
+      float *y = out + i * channels;
+      for (ma_uint32 c = 0; c < channels; ++c) {
+        float delayed = line[c];
+        line[c] = x[c];
+        y[c] = delayed * gain;
+      }
+      delay_pos = delay_pos + 1 == delay_frames ? 0 : delay_pos + 1;
+
+      if (gain < 1.0f) {
+        ++limited;
+        min_gain = std::min(min_gain, gain);
+      }
+    }
+  }
+
+  float reduction =
+      min_gain < 1.0f ? static_cast<float>(-to_db(min_gain)) : 0.0f;
+  gain_reduction_db.store(reduction, std::memory_order_relaxed);
+  if (reduction > max_reduction_db.load(std::memory_order_relaxed)) {
+    max_reduction_db.store(reduction, std::memory_order_relaxed);
+  }
+
+  long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - started)
+                     .count();
+  limited_frames.fetch_add(limited, std::memory_order_relaxed);
+  total_frames.fetch_add(count, std::memory_order_relaxed);
+  total_ns.fetch_add(ns, std::memory_order_relaxed);
+}
+
+LimiterStats Limiter::get_stats() const {
+  LimiterStats s;
+  s.ceiling_db = ceiling_db.load(std::memory_order_relaxed);
+  s.release_ms = release_ms.load(std::memory_order_relaxed);
+  s.lookahead_ms = lookahead * 1000.0f / sample_rate;
+  s.gain_reduction_db = gain_reduction_db.load(std::memory_order_relaxed);
+  s.max_reduction_db = max_reduction_db.load(std::memory_order_relaxed);
+  s.limited_seconds =
+      static_cast<double>(limited_frames.load(std::memory_order_relaxed)) /
+      sample_rate;
+  long long tf = total_frames.load(std::memory_order_relaxed);
+  if (tf > 0) {
+    s.us_per_second = total_ns.load(std::memory_order_relaxed) / 1000.0 /
+                      (static_cast<double>(tf) / sample_rate);
+  }
+  return s;
+}
@@ -0,0 +1,263 @@
+#include "loudness.hpp"
+
+#include "miniaudio/miniaudio.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+static const double absolute_gate_lufs = -70.0;
+static const double relative_gate_lu = -10.0;
+static const double reference_lufs = -18.0;
+static const double peak_ceiling_dbtp = -1.0;
+static const double max_boost_db = 12.0;
+static const double max_cut_db = -24.0;
+static const ma_uint64 read_frames = 4096;
+// Dither and encoder noise floors sit below this; fade-outs reach it within
+// a fraction of a second of true silence.
+static const double silence_threshold_db = -60.0;
+
+static double block_lufs(double power) {
+  return power > 0.0 ? -0.691 + 10.0 * std::log10(power) : -HUGE_VAL;
+}
+
+LoudnessMeter::LoudnessMeter(int channels, double sample_rate)
+    : channels(channels) {
+  filter.init(channels, sample_rate);
+  true_peak.init(channels);
+  step_frames = static_cast<size_t>(sample_rate / 10.0 + 0.5);
+  step_sums.assign(channels, 0.0);
+
+  // BS.1770 channel weights for a 5.1 layout: LFE ignored, surrounds +1.5 dB.
+  weights.assign(channels, 1.0);
+  if (channels == 6) {
+    weights[3] = 0.0;
+    weights[4] = 1.41;
+    weights[5] = 1.41;
+  }
+}
+
+void LoudnessMeter::add(const float *frames, size_t count) {
+  true_peak.process(frames, count);
+
+  while (count > 0) {
+    size_t n = step_frames - step_filled;
+    if (n > count) {
+      n = count;
+    }
+    filter.process(frames, n, step_sums.data());
+    frames += n * channels;
+    count -= n;
+    step_filled += n;
+
+    if (step_filled == step_frames) {
+      finish_step();
+    }
+  }
+}
+
+void LoudnessMeter::finish_step() {
+  double power = 0.0;
+  for (int c = 0; c < channels; ++c) {
+    power += weights[c] * step_sums[c];
+    step_sums[c] = 0.0;
+  }
+  steps.push_back(power / step_frames);
+  step_filled = 0;
+
+  // Each 400 ms block is the last four 100 ms steps, i.e. 75% overlap.
+  size_t n = steps.size();
+  if (n >= 4) {
+    blocks.push_back((steps[n - 1] + steps[n - 2] + steps[n - 3] +
+                      steps[n - 4]) /
+                     4.0);
+  }
+}
+
+double LoudnessMeter::integrated_lufs() const {
+  std::vector<double> gated;
+  const std::vector<double> &source = blocks.empty() ? steps : blocks;
+
+  double sum = 0.0;
+  for (double power : source) {
+    if (block_lufs(power) > absolute_gate_lufs) {
+      gated.push_back(power);
+      sum += power;
+    }
+  }
+  if (gated.empty()) {
+    return absolute_gate_lufs;
+  }
+
+  double threshold = block_lufs(sum / gated.size()) + relative_gate_lu;
+  double kept_sum = 0.0;
+  size_t kept = 0;
+  for (double power : gated) {
+    if (block_lufs(power) > threshold) {
+      kept_sum += power;
+      ++kept;
+    }
+  }
+  return kept > 0 ? block_lufs(kept_sum / kept) : absolute_gate_lufs;
+}
+
+bool measure_loudness(const std::string &path, LoudnessResult &result,
+                      const std::atomic<bool> *cancel) {
+  ma_decoder decoder;
+  ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 0, 0);
+  if (ma_decoder_init_file(path.c_str(), &config, &decoder) != MA_SUCCESS) {
+    std::cerr << "Failed to open for loudness analysis: " << path << std::endl;
+    return false;
+  }
+
+  int channels = static_cast<int>(decoder.outputChannels);
+  double rate = decoder.outputSampleRate;
+  if (channels <= 0 || rate <= 0.0) {
+    ma_decoder_uninit(&decoder);
+    return false;
+  }
+
+  LoudnessMeter meter(channels, rate);
+  std::vector<float> buffer(read_frames * channels);
+  ma_uint64 total = 0;
+  const float threshold = static_cast<float>(from_db(silence_threshold_db));
+  bool heard = false;
+  ma_uint64 first_audible = 0;
+  ma_uint64 audible_end = 0;
+
+  while (cancel == nullptr || !*cancel) {
+    ma_uint64 frames = 0;
+    ma_result r = ma_decoder_read_pcm_frames(&decoder, buffer.data(),
+                                             read_frames, &frames);
+    if (frames > 0) {
+      meter.add(buffer.data(), static_cast<size_t>(frames));
+
+      size_t samples = static_cast<size_t>(frames) * channels;
+      if (!heard) {
+        size_t first = first_above(buffer.data(), samples, threshold);
+        if (first < samples) {
+          heard = true;
+          first_audible = total + first / channels;
+        }
+      }
+      if (heard) {
+        size_t end = end_above(buffer.data(), samples, threshold);
+        if (end > 0) {
+          audible_end = total + (end - 1) / channels + 1;
+        }
+      }
+      total += frames;
+    }
+    if (r != MA_SUCCESS || frames < read_frames) {
+      break;
+    }
+  }
+  ma_decoder_uninit(&decoder);
+
+  if (total == 0 || (cancel != nullptr && *cancel)) {
+    return false;
+  }
+
+  result.integrated_lufs = meter.integrated_lufs();
+  result.true_peak_dbtp = meter.true_peak_dbtp();
+  result.seconds = total / rate;
+  result.audible_start = heard ? first_audible / rate : 0.0;
+  result.audible_end = heard ? audible_end / rate : 0.0;
+  return true;
+}
+
+float loudness_gain(const TrackLoudness &loudness, GainMode mode) {
+  if (mode == GainMode::Off || !loudness.analyzed) {
+    return 1.0f;
+  }
+
+  bool album = mode == GainMode::Album && loudness.has_album;
+  double lufs = album ? loudness.album_lufs : loudness.track_lufs;
+  double peak = album ? loudness.album_peak_dbtp : loudness.track_peak_dbtp;
+
+  double gain = reference_lufs - lufs;
+  if (gain > 0.0) {
+    double headroom = peak_ceiling_dbtp - peak;
+    gain = std::min(gain, std::max(0.0, headroom));
+  }
+  gain = std::max(max_cut_db, std::min(max_boost_db, gain));
+  return static_cast<float>(from_db(gain));
+}
+
+LoudnessAnalyzer::LoudnessAnalyzer(const std::string &db_path,
+                                   WorkerPool &pool)
+    : pool(pool), db(db_path.c_str()) {
+  stats.workers = pool.size();
+}
+
+LoudnessAnalyzer::~LoudnessAnalyzer() {
+  stopping = true;
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [this] { return in_flight == 0; });
+}
+
+void LoudnessAnalyzer::rescan() {
+  std::vector<Track> tracks;
+  {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    tracks = db.get_tracks_without_loudness();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const auto &t : tracks) {
+    if (queued.count(t.id) != 0 || failed_ids.count(t.id) != 0) {
+      continue;
+    }
+    queued.insert(t.id);
+    ++stats.pending;
+    ++in_flight;
+
+    int id = t.id;
+    std::string path = t.file_path;
+    pool.submit([this, id, path] { analyze(id, path); });
+  }
+}
+
+void LoudnessAnalyzer::analyze(int track_id, const std::string &path) {
+  LoudnessResult result;
+  bool ok = false;
+  auto start = std::chrono::steady_clock::now();
+
+  if (!stopping) {
+    ok = measure_loudness(path, result, &stopping);
+    if (ok) {
+      AudioMetadata metadata = db.get_metadata(path.c_str());
+      std::lock_guard<std::mutex> lock(db_mutex);
+      db.fill_track_album(track_id, metadata.album);
+      ok = db.set_track_loudness(track_id, result.integrated_lufs,
+                                 result.true_peak_dbtp) == 0 &&
+           db.set_track_audible_range(track_id, result.audible_start,
+                                      result.audible_end) == 0;
+    }
+  }
+
+  double busy = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  queued.erase(track_id);
+  --stats.pending;
+  if (ok) {
+    ++stats.analyzed;
+    stats.audio_seconds += result.seconds;
+    stats.busy_seconds += busy;
+  } else if (!stopping) {
+    ++stats.failed;
+    failed_ids.insert(track_id);
+  }
+
+  --in_flight;
+  idle.notify_all();
+}
+
+LoudnessStats LoudnessAnalyzer::get_stats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
@@ -0,0 +1,252 @@
+#include "maintenance.hpp"
+
+#include <sqlite3.h>
+
+#include <filesystem>
+#include <iostream>
+
+MaintenanceScheduler::MaintenanceScheduler(const std::string path,
+                                           int budget_ms)
+    : db_path(path), budget_ms(budget_ms) {
+  last_activity_ms = now_ms();
+  last_optimize = std::chrono::steady_clock::now();
+}
+
+MaintenanceScheduler::~MaintenanceScheduler() { stop(); }
+
+void MaintenanceScheduler::start() {
+  if (worker.joinable()) {
+    return;
+  }
+
+  if (sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr) !=
+      SQLITE_OK) {
+    std::cerr << "Maintenance disabled: " << sqlite3_errmsg(db) << std::endl;
+    sqlite3_close(db);
+    db = nullptr;
+    return;
+  }
+  sqlite3_exec(db, "PRAGMA analysis_limit=400;", nullptr, nullptr, nullptr);
+  sqlite3_progress_handler(db, 1000, &MaintenanceScheduler::progress_handler,
+                           this);
+
+  stop_requested = false;
+  worker = std::thread(&MaintenanceScheduler::run, this);
+}
+
+void MaintenanceScheduler::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop_requested = true;
+  }
+  wake.notify_all();
+  if (worker.joinable()) {
+    worker.join();
+  }
+
+  if (db != nullptr) {
+    sqlite3_exec(db, "PRAGMA optimize;", nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+    db = nullptr;
+  }
+}
+
+void MaintenanceScheduler::touch() { last_activity_ms = now_ms(); }
+
+MaintenanceStats MaintenanceScheduler::get_stats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+void MaintenanceScheduler::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stop_requested) {
+    wake.wait_for(lock, std::chrono::seconds(1));
+    if (stop_requested) {
+      break;
+    }
+    if (now_ms() - last_activity_ms < quiet_period_ms) {
+      continue;
+    }
+
+    lock.unlock();
+    run_due_tasks();
+    lock.lock();
+  }
+}
+
+void MaintenanceScheduler::run_due_tasks() {
+  MaintenanceStats s = get_stats();
+  auto started = std::chrono::steady_clock::now();
+  deadline = started + std::chrono::milliseconds(budget_ms);
+
+  std::error_code ec;
+  std::uintmax_t wal_bytes = std::filesystem::file_size(db_path + "-wal", ec);
+  s.wal_bytes = ec ? 0 : static_cast<long long>(wal_bytes);
+  s.freelist_pages = pragma_int("PRAGMA freelist_count;");
+  s.auto_vacuum = pragma_int("PRAGMA auto_vacuum;");
+
+  if (s.auto_vacuum == 0 && !migration_failed &&
+      now_ms() - last_activity_ms >= migrate_quiet_period_ms) {
+    enable_incremental_vacuum(s);
+    std::lock_guard<std::mutex> lock(mutex);
+    stats = s;
+    return;
+  }
+
+  bool ran = false;
+  if (s.wal_bytes >= checkpoint_wal_bytes) {
+    checkpoint(s);
+    ran = true;
+  }
+  if (!over_budget() && started - last_optimize >=
+                            std::chrono::seconds(optimize_interval_s)) {
+    optimize(s);
+    last_optimize = started;
+    ran = true;
+  }
+  if (!over_budget() && s.auto_vacuum == 2 &&
+      s.freelist_pages >= vacuum_min_free_pages) {
+    incremental_vacuum(s);
+    ran = true;
+  }
+
+  if (ran) {
+    std::chrono::duration<double, std::milli> took =
+        std::chrono::steady_clock::now() - started;
+    s.last_run_ms = took.count();
+    s.total_run_ms += took.count();
+    if (took.count() > budget_ms) {
+      s.budget_overruns++;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  stats = s;
+}
+
+void MaintenanceScheduler::checkpoint(MaintenanceStats &s) {
+  int log_frames = 0;
+  int checkpointed = 0;
+  int rc = sqlite3_wal_checkpoint_v2(db, nullptr, SQLITE_CHECKPOINT_PASSIVE,
+                                     &log_frames, &checkpointed);
+  // The truncate waits for readers to finish, so it is left to a later tick
+  // once the passive step has used up the budget.
+  bool truncate = rc == SQLITE_OK && log_frames > 0 &&
+                  checkpointed == log_frames;
+  if (truncate && over_budget()) {
+    s.budget_overruns++;
+  } else if (truncate) {
+    rc = sqlite3_wal_checkpoint_v2(db, nullptr, SQLITE_CHECKPOINT_TRUNCATE,
+                                   &log_frames, &checkpointed);
+  }
+  if (rc != SQLITE_OK && rc != SQLITE_BUSY) {
+    std::cerr << "Checkpoint failed: " << sqlite3_errmsg(db) << std::endl;
+    return;
+  }
+
+  s.checkpoints++;
+  s.wal_frames_checkpointed = checkpointed;
+}
+
+void MaintenanceScheduler::optimize(MaintenanceStats &s) {
+  int rc = sqlite3_exec(db, "PRAGMA optimize;", nullptr, nullptr, nullptr);
+  if (rc == SQLITE_INTERRUPT) {
+    s.budget_overruns++;
+    return;
+  }
+  if (rc != SQLITE_OK) {
+    std::cerr << "Optimize failed: " << sqlite3_errmsg(db) << std::endl;
+    return;
+  }
+  s.optimizes++;
+}
+
+void MaintenanceScheduler::incremental_vacuum(MaintenanceStats &s) {
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db, "PRAGMA incremental_vacuum;", -1, &stmt,
+                         nullptr) != SQLITE_OK) {
+    std::cerr << "Failed to prepare statement: " << sqlite3_errmsg(db)
+              << std::endl;
+    return;
+  }
+
+  if (sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) !=
+      SQLITE_OK) {
+    sqlite3_finalize(stmt);
+    return;
+  }
+
+  int freed = 0;
+  while (!over_budget() && sqlite3_step(stmt) == SQLITE_ROW) {
+    freed++;
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+
+  s.vacuums++;
+  s.pages_reclaimed += freed;
+  s.freelist_pages = pragma_int("PRAGMA freelist_count;");
+}
+
+// auto_vacuum=INCREMENTAL only takes effect on an existing database once a
+// VACUUM rebuilds it. That rewrites the whole file, so it waits for a longer
+// quiet period, ignores the per-tick budget, and is interrupted and retried
+// later if the UI is used or the app closes meanwhile.
+void MaintenanceScheduler::enable_incremental_vacuum(MaintenanceStats &s) {
+  auto started = std::chrono::steady_clock::now();
+  migration_activity_ms = last_activity_ms;
+  migrating = true;
+  int rc = sqlite3_exec(db, "PRAGMA auto_vacuum=INCREMENTAL; VACUUM;",
+                        nullptr, nullptr, nullptr);
+  migrating = false;
+  if (rc == SQLITE_INTERRUPT || rc == SQLITE_BUSY) {
+    return;
+  }
+  if (rc != SQLITE_OK) {
+    std::cerr << "Vacuum failed: " << sqlite3_errmsg(db) << std::endl;
+    migration_failed = true;
+    return;
+  }
+
+  std::chrono::duration<double, std::milli> took =
+      std::chrono::steady_clock::now() - started;
+  s.vacuum_migrated = true;
+  s.migration_ms = took.count();
+  s.auto_vacuum = pragma_int("PRAGMA auto_vacuum;");
+  s.freelist_pages = pragma_int("PRAGMA freelist_count;");
+}
+
+int MaintenanceScheduler::pragma_int(const char *sql) {
+  sqlite3_stmt *stmt;
+  int value = 0;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+      value = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+  }
+  return value;
+}
+
+bool MaintenanceScheduler::over_budget() const {
+  return std::chrono::steady_clock::now() >= deadline;
+}
+
+int MaintenanceScheduler::progress_handler(void *self) {
+  auto *scheduler = static_cast<MaintenanceScheduler *>(self);
+  if (scheduler->migrating) {
+    return scheduler->stop_requested ||
+                   scheduler->last_activity_ms !=
+                       scheduler->migration_activity_ms
+               ? 1
+               : 0;
+  }
+  return scheduler->over_budget() && !scheduler->stop_requested ? 1 : 0;
+}
+
+long long MaintenanceScheduler::now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
@@ -0,0 +1,495 @@
+#include "mmap_vfs.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+
+#ifndef _WIN32
+#include <csetjmp>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const std::uintmax_t default_readahead_bytes = 8ULL << 20;
+static const size_t prefetch_chunk_bytes = 256 << 10;
+static const int prefetch_interval_ms = 20;
+static const long long slow_read_us = 5000;
+
+static ma_result result_from_errno(int e) {
+  switch (e) {
+  case ENOENT:
+    return MA_DOES_NOT_EXIST;
+  case EACCES:
+  case EPERM:
+    return MA_ACCESS_DENIED;
+  case ENOMEM:
+    return MA_OUT_OF_MEMORY;
+  default:
+    return MA_ERROR;
+  }
+}
+
+#ifndef _WIN32
+// Touching a page past the end of a file that shrank, or one the NFS server
+// can no longer supply, raises SIGBUS. Copies out of a mapping run with a
+// jump target set, so the handler turns that into a failed read of the one
+// file; a SIGBUS anywhere else gets the previous handler.
+// Volatile so the stores around the copy are not folded away.
+static thread_local sigjmp_buf *volatile fault_jump = nullptr;
+static struct sigaction previous_sigbus;
+
+static void on_sigbus(int sig, siginfo_t *info, void *context) {
+  (void)context;
+  if (fault_jump != nullptr && info->si_code > 0) {
+    siglongjmp(*fault_jump, 1);
+  }
+  // Returning retries a faulting access, which now goes to the old handler;
+  // a signal that was sent rather than raised by a fault is passed on.
+  sigaction(SIGBUS, &previous_sigbus, nullptr);
+  if (info->si_code <= 0) {
+    raise(sig);
+  }
+}
+
+static void install_sigbus_handler() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_sigbus;
+    // The jump skips the handler's return, so keep SIGBUS unblocked in it.
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, &previous_sigbus);
+  });
+}
+
+static bool guarded_copy(void *dst, const unsigned char *src, size_t n) {
+  sigjmp_buf jump;
+  if (sigsetjmp(jump, 0) != 0) {
+    fault_jump = nullptr;
+    return false;
+  }
+  fault_jump = &jump;
+  std::memcpy(dst, src, n);
+  fault_jump = nullptr;
+  return true;
+}
+
+static bool guarded_touch(const unsigned char *data, size_t from, size_t end,
+                          size_t page) {
+  sigjmp_buf jump;
+  if (sigsetjmp(jump, 0) != 0) {
+    fault_jump = nullptr;
+    return false;
+  }
+  fault_jump = &jump;
+  volatile unsigned char sink = 0;
+  for (size_t offset = from; offset < end; offset += page) {
+    sink = sink + data[offset];
+  }
+  (void)sink;
+  fault_jump = nullptr;
+  return true;
+}
+
+static ma_result map_file(const char *path, const unsigned char **data,
+                          size_t *size) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return result_from_errno(errno);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int e = errno;
+    close(fd);
+    return result_from_errno(e);
+  }
+
+  *size = static_cast<size_t>(st.st_size);
+  if (*size > 0) {
+    void *mapped = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      int e = errno;
+      close(fd);
+      return result_from_errno(e);
+    }
+    madvise(mapped, *size, MADV_SEQUENTIAL);
+    *data = static_cast<const unsigned char *>(mapped);
+  }
+  close(fd);
+  return MA_SUCCESS;
+}
+#endif
+
+static bool seek_stream(std::FILE *stream, size_t offset) {
+#ifdef _WIN32
+  return _fseeki64(stream, static_cast<long long>(offset), SEEK_SET) == 0;
+#else
+  return fseeko(stream, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+std::uintmax_t readahead_from_env() {
+  const char *value = std::getenv("MUSIC_PLAYR_READAHEAD_MB");
+  if (value != nullptr) {
+    long long mb = std::atoll(value);
+    if (mb >= 0) {
+      return static_cast<std::uintmax_t>(mb) << 20;
+    }
+  }
+  return default_readahead_bytes;
+}
+
+MmapVfs::MappedFile::~MappedFile() {
+#ifndef _WIN32
+  if (data != nullptr) {
+    munmap(const_cast<unsigned char *>(data), size);
+  }
+#endif
+  if (stream != nullptr) {
+    std::fclose(stream);
+  }
+}
+
+MmapVfs::MmapVfs(std::uintmax_t readahead_bytes)
+    : readahead_bytes(readahead_bytes) {
+#ifndef _WIN32
+  install_sigbus_handler();
+#endif
+  ma_vfs_callbacks &cb = callbacks.cb;
+  callbacks.self = this;
+  cb.onOpen = on_open;
+  cb.onOpenW = on_open_w;
+  cb.onClose = on_close;
+  cb.onRead = on_read;
+  cb.onWrite = on_write;
+  cb.onSeek = on_seek;
+  cb.onTell = on_tell;
+  cb.onInfo = on_info;
+
+  prefetcher = std::thread(&MmapVfs::run, this);
+}
+
+MmapVfs::~MmapVfs() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop_requested = true;
+  }
+  wake.notify_all();
+  if (prefetcher.joinable()) {
+    prefetcher.join();
+  }
+}
+
+void MmapVfs::set_readahead(std::uintmax_t bytes) {
+  readahead_bytes = bytes;
+  wake.notify_all();
+}
+
+MmapVfsStats MmapVfs::get_stats() const {
+  MmapVfsStats s;
+  s.opens = opens;
+  s.slow_reads = slow_reads;
+  s.max_read_ms = max_read_us / 1000.0;
+  s.readahead_bytes = readahead_bytes;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  s.open_files = static_cast<int>(files.size());
+  for (const auto &file : files) {
+    if (file->data == nullptr) {
+      continue;
+    }
+    size_t cursor = file->cursor;
+    size_t prefetched_to = file->prefetched_to;
+    size_t ahead = prefetched_to > cursor ? prefetched_to - cursor : 0;
+    size_t wanted =
+        std::min<std::uintmax_t>(s.readahead_bytes, file->size - cursor);
+
+    s.mapped_bytes += file->size;
+    s.buffered_bytes += ahead;
+    if (wanted > 0) {
+      s.min_fill = std::min(s.min_fill, std::min(1.0, (double)ahead / wanted));
+    }
+  }
+  return s;
+}
+
+// Touching one byte per page makes the fault, and any wait on storage, happen
+// here. MADV_WILLNEED first lets the kernel issue the whole chunk as one
+// readahead request instead of a fault per page.
+bool MmapVfs::prefetch(MappedFile &file, size_t window) {
+#ifdef _WIN32
+  (void)file;
+  (void)window;
+  return true;
+#else
+  static const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+  size_t cursor = file.cursor;
+  size_t from = file.prefetched_to;
+  if (cursor < file.prefetched_from || cursor > from) {
+    from = cursor - cursor % page;
+    file.prefetched_from = from;
+    file.prefetched_to = from;
+  }
+
+  size_t target = std::min(file.size, cursor + window);
+  while (from < target && !stop_requested) {
+    size_t end = std::min(target, from + prefetch_chunk_bytes);
+    madvise(const_cast<unsigned char *>(file.data) + from, end - from,
+            MADV_WILLNEED);
+    if (!guarded_touch(file.data, from, end, page)) {
+      file.faulted = true;
+      return true;
+    }
+
+    from = end;
+    file.prefetched_to = from;
+  }
+  return from >= target;
+#endif
+}
+
+// Sleeps without a timeout once every open file has a full window, so a
+// paused player costs no wakeups here. Reads wake it as the window drains.
+void MmapVfs::run() {
+  bool pending = false;
+  while (true) {
+    std::vector<std::shared_ptr<MappedFile>> current;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (stop_requested) {
+        return;
+      }
+      if (pending) {
+        wake.wait_for(lock, std::chrono::milliseconds(prefetch_interval_ms));
+      } else {
+        wake.wait(lock);
+      }
+      if (stop_requested) {
+        return;
+      }
+      current = files;
+    }
+
+    size_t window = static_cast<size_t>(readahead_bytes.load());
+    pending = false;
+    if (window == 0) {
+      continue;
+    }
+    for (const auto &file : current) {
+      if (file->data != nullptr && !file->faulted &&
+          !prefetch(*file, window)) {
+        pending = true;
+      }
+    }
+  }
+}
+
+void MmapVfs::note_read(MappedFile &file, size_t end, long long us) {
+  if (us >= slow_read_us) {
+    ++slow_reads;
+  }
+
+  long long max = max_read_us;
+  while (us > max && !max_read_us.compare_exchange_weak(max, us)) {
+  }
+
+  size_t window = static_cast<size_t>(readahead_bytes.load());
+  if (file.data != nullptr && file.prefetched_to < end + window / 2 &&
+      file.prefetched_to < file.size) {
+    wake.notify_one();
+  }
+}
+
+MmapVfs *MmapVfs::owner(ma_vfs *vfs) {
+  return static_cast<Callbacks *>(vfs)->self;
+}
+
+ma_result MmapVfs::on_open(ma_vfs *vfs, const char *path, ma_uint32 mode,
+                           ma_vfs_file *file) {
+  if (path == NULL || file == NULL) {
+    return MA_INVALID_ARGS;
+  }
+  *file = NULL;
+  if ((mode & MA_OPEN_MODE_WRITE) != 0) {
+    return MA_INVALID_OPERATION;
+  }
+
+  auto mapped = std::make_shared<MappedFile>();
+  ma_result result = MA_NOT_IMPLEMENTED;
+#ifndef _WIN32
+  result = map_file(path, &mapped->data, &mapped->size);
+  if (result == MA_DOES_NOT_EXIST || result == MA_ACCESS_DENIED) {
+    return result;
+  }
+#endif
+  // Some filesystems cannot be mapped; read those the ordinary way.
+  if (result != MA_SUCCESS) {
+    std::error_code ec;
+    std::uintmax_t size = std::filesystem::file_size(path, ec);
+    if (ec) {
+      return MA_DOES_NOT_EXIST;
+    }
+    mapped->stream = std::fopen(path, "rb");
+    if (mapped->stream == nullptr) {
+      return result_from_errno(errno);
+    }
+    mapped->size = static_cast<size_t>(size);
+  }
+
+  MmapVfs *self = owner(vfs);
+  ++self->opens;
+  {
+    std::lock_guard<std::mutex> lock(self->mutex);
+    self->files.push_back(mapped);
+  }
+  self->wake.notify_one();
+  *file = mapped.get();
+  return MA_SUCCESS;
+}
+
+ma_result MmapVfs::on_open_w(ma_vfs *vfs, const wchar_t *path, ma_uint32 mode,
+                             ma_vfs_file *file) {
+  (void)vfs;
+  (void)path;
+  (void)mode;
+  (void)file;
+  return MA_NOT_IMPLEMENTED;
+}
+
+// The prefetcher may still hold a reference, in which case the mapping is
+// released when it finishes with the file.
+ma_result MmapVfs::on_close(ma_vfs *vfs, ma_vfs_file file) {
+  if (file == NULL) {
+    return MA_INVALID_ARGS;
+  }
+
+  MmapVfs *self = owner(vfs);
+  std::lock_guard<std::mutex> lock(self->mutex);
+  auto it = std::find_if(
+      self->files.begin(), self->files.end(),
+      [file](const std::shared_ptr<MappedFile> &f) { return f.get() == file; });
+  if (it == self->files.end()) {
+    return MA_INVALID_ARGS;
+  }
+  self->files.erase(it);
+  return MA_SUCCESS;
+}
+
+ma_result MmapVfs::on_read(ma_vfs *vfs, ma_vfs_file file, void *dst,
+                           size_t bytes, size_t *bytes_read) {
+  MappedFile *mapped = static_cast<MappedFile *>(file);
+  if (bytes_read != NULL) {
+    *bytes_read = 0;
+  }
+  if (mapped == NULL || dst == NULL) {
+    return MA_INVALID_ARGS;
+  }
+
+  if (mapped->faulted) {
+    return MA_IO_ERROR;
+  }
+
+  size_t cursor = mapped->cursor;
+  size_t available = mapped->size - cursor;
+  size_t n = bytes < available ? bytes : available;
+  if (n > 0) {
+    auto start = std::chrono::steady_clock::now();
+    if (mapped->stream != nullptr) {
+      if (mapped->stream_at != cursor &&
+          !seek_stream(mapped->stream, cursor)) {
+        return MA_IO_ERROR;
+      }
+      n = std::fread(dst, 1, n, mapped->stream);
+      mapped->stream_at = cursor + n;
+      if (n == 0) {
+        return std::ferror(mapped->stream) ? MA_IO_ERROR : MA_AT_END;
+      }
+    } else {
+#ifndef _WIN32
+      if (!guarded_copy(dst, mapped->data + cursor, n)) {
+        mapped->faulted = true;
+        return MA_IO_ERROR;
+      }
+#endif
+    }
+    long long us = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    mapped->cursor = cursor + n;
+    owner(vfs)->note_read(*mapped, cursor + n, us);
+  }
+  if (bytes_read != NULL) {
+    *bytes_read = n;
+  }
+  return n == 0 && bytes > 0 ? MA_AT_END : MA_SUCCESS;
+}
+
+ma_result MmapVfs::on_write(ma_vfs *vfs, ma_vfs_file file, const void *src,
+                            size_t bytes, size_t *bytes_written) {
+  (void)vfs;
+  (void)file;
+  (void)src;
+  (void)bytes;
+  if (bytes_written != NULL) {
+    *bytes_written = 0;
+  }
+  return MA_INVALID_OPERATION;
+}
+
+ma_result MmapVfs::on_seek(ma_vfs *vfs, ma_vfs_file file, ma_int64 offset,
+                           ma_seek_origin origin) {
+  MappedFile *mapped = static_cast<MappedFile *>(file);
+  if (mapped == NULL) {
+    return MA_INVALID_ARGS;
+  }
+
+  ma_int64 base = 0;
+  if (origin == ma_seek_origin_current) {
+    base = static_cast<ma_int64>(mapped->cursor.load());
+  } else if (origin == ma_seek_origin_end) {
+    base = static_cast<ma_int64>(mapped->size);
+  }
+
+  ma_int64 target = base + offset;
+  if (target < 0 || target > static_cast<ma_int64>(mapped->size)) {
+    return MA_BAD_SEEK;
+  }
+
+  size_t to = static_cast<size_t>(target);
+  bool jumped = to > mapped->prefetched_to;
+  mapped->cursor = to;
+  if (jumped && mapped->data != nullptr) {
+    owner(vfs)->wake.notify_one();
+  }
+  return MA_SUCCESS;
+}
+
+ma_result MmapVfs::on_tell(ma_vfs *vfs, ma_vfs_file file, ma_int64 *cursor) {
+  (void)vfs;
+  MappedFile *mapped = static_cast<MappedFile *>(file);
+  if (mapped == NULL || cursor == NULL) {
+    return MA_INVALID_ARGS;
+  }
+  *cursor = static_cast<ma_int64>(mapped->cursor.load());
+  return MA_SUCCESS;
+}
+
+ma_result MmapVfs::on_info(ma_vfs *vfs, ma_vfs_file file, ma_file_info *info) {
+  (void)vfs;
+  MappedFile *mapped = static_cast<MappedFile *>(file);
+  if (mapped == NULL || info == NULL) {
+    return MA_INVALID_ARGS;
+  }
+  info->sizeInBytes = mapped->size;
+  return MA_SUCCESS;
+}
@@ -0,0 +1,152 @@
+#include "pcm_cache.hpp"
+
+#include <iostream>
+
+PcmCache::PcmCache(std::uintmax_t budget_bytes, ma_vfs *vfs)
+    : budget_bytes(budget_bytes), vfs(vfs) {
+  worker = std::thread(&PcmCache::run, this);
+}
+
+PcmCache::~PcmCache() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop_requested = true;
+  }
+  wake.notify_all();
+  if (worker.joinable()) {
+    worker.join();
+  }
+}
+
+std::shared_ptr<const CachedPcm> PcmCache::get(int track_id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = index.find(track_id);
+  if (it == index.end()) {
+    ++misses;
+    return nullptr;
+  }
+
+  lru.splice(lru.begin(), lru, it->second);
+  ++hits;
+  return it->second->pcm;
+}
+
+void PcmCache::request(int track_id, const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = index.find(track_id);
+  if (it != index.end()) {
+    lru.splice(lru.begin(), lru, it->second);
+    return;
+  }
+
+  for (const auto &r : pending) {
+    if (r.track_id == track_id) {
+      return;
+    }
+  }
+  pending.push_back({track_id, path});
+  wake.notify_one();
+}
+
+void PcmCache::set_budget(std::uintmax_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  budget_bytes = bytes;
+  evict_to(budget_bytes);
+}
+
+std::uintmax_t PcmCache::get_used_bytes() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return used_bytes;
+}
+
+PcmCacheStats PcmCache::get_stats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  PcmCacheStats s;
+  s.hits = hits;
+  s.misses = misses;
+  s.evictions = evictions;
+  s.entries = static_cast<int>(lru.size());
+  s.bytes = used_bytes;
+  s.budget_bytes = budget_bytes;
+  return s;
+}
+
+void PcmCache::evict_to(std::uintmax_t limit) {
+  while (used_bytes > limit && !lru.empty()) {
+    Entry &victim = lru.back();
+    used_bytes -= victim.pcm->data.size();
+    index.erase(victim.track_id);
+    lru.pop_back();
+    ++evictions;
+  }
+}
+
+void PcmCache::insert(int track_id, std::shared_ptr<const CachedPcm> pcm) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (index.count(track_id) != 0 || pcm->data.size() > budget_bytes / 2) {
+    return;
+  }
+
+  evict_to(budget_bytes - pcm->data.size());
+  lru.push_front({track_id, pcm});
+  index[track_id] = lru.begin();
+  used_bytes += pcm->data.size();
+}
+
+std::shared_ptr<CachedPcm> PcmCache::decode(const std::string &path,
+                                            std::uintmax_t max_bytes) {
+  ma_decoder decoder;
+  ma_decoder_config config = ma_decoder_config_init(ma_format_unknown, 0, 0);
+  ma_result result =
+      vfs != nullptr
+          ? ma_decoder_init_vfs(vfs, path.c_str(), &config, &decoder)
+          : ma_decoder_init_file(path.c_str(), &config, &decoder);
+  if (result != MA_SUCCESS) {
+    std::cerr << "Failed to open for caching: " << path << std::endl;
+    return nullptr;
+  }
+
+  auto pcm = std::make_shared<CachedPcm>();
+  ma_uint64 length = 0;
+  if (ma_decoder_get_data_format(&decoder, &pcm->format, &pcm->channels,
+                                 &pcm->sample_rate, NULL, 0) != MA_SUCCESS ||
+      ma_decoder_get_length_in_pcm_frames(&decoder, &length) != MA_SUCCESS ||
+      length == 0) {
+    ma_decoder_uninit(&decoder);
+    return nullptr;
+  }
+
+  ma_uint32 frame_bytes = ma_get_bytes_per_frame(pcm->format, pcm->channels);
+  if (length * frame_bytes > max_bytes) {
+    ma_decoder_uninit(&decoder);
+    return nullptr;
+  }
+
+  pcm->data.resize(length * frame_bytes);
+  ma_decoder_read_pcm_frames(&decoder, pcm->data.data(), length, &pcm->frames);
+  pcm->data.resize(pcm->frames * frame_bytes);
+  ma_decoder_uninit(&decoder);
+  return pcm->frames > 0 ? pcm : nullptr;
+}
+
+void PcmCache::run() {
+  while (true) {
+    Request r;
+    std::uintmax_t max_bytes;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this] { return stop_requested || !pending.empty(); });
+      if (stop_requested) {
+        return;
+      }
+      r = pending.front();
+      pending.pop_front();
+      max_bytes = budget_bytes / 2;
+    }
+
+    std::shared_ptr<CachedPcm> pcm = decode(r.path, max_bytes);
+    if (pcm != nullptr) {
+      insert(r.track_id, pcm);
+    }
+  }
+}
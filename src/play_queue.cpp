@@ -0,0 +1,97 @@
+#include "play_queue.hpp"
+
+int PlayQueue::index_of(int track_id) const {
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    if (tracks[i].id == track_id) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+int PlayQueue::pick_next() {
+  if (tracks.empty()) {
+    return -1;
+  }
+
+  if (repeat && current_idx >= 0) {
+    return current_idx;
+  }
+
+  if (shuffle) {
+    std::uniform_int_distribution<int> pick(
+        0, static_cast<int>(tracks.size()) - 1);
+    int new_idx;
+    do {
+      new_idx = pick(rng);
+    } while (new_idx == current_idx && tracks.size() > 1);
+    return new_idx;
+  }
+
+  return (current_idx + 1) % tracks.size();
+}
+
+void PlayQueue::set_tracks(const std::vector<Track> &all_tracks) {
+  std::lock_guard<std::mutex> lock(mutex);
+  int current_id = current_idx >= 0 ? tracks[current_idx].id : -1;
+  int next_id = next_idx >= 0 ? tracks[next_idx].id : -1;
+
+  tracks = all_tracks;
+  current_idx = index_of(current_id);
+  next_idx = index_of(next_id);
+}
+
+void PlayQueue::set_modes(bool s, bool r) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (s != shuffle || r != repeat) {
+    next_idx = -1;
+  }
+  shuffle = s;
+  repeat = r;
+}
+
+void PlayQueue::set_current(int track_id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  current_idx = index_of(track_id);
+  next_idx = -1;
+}
+
+bool PlayQueue::peek_next(Track &track) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (next_idx < 0) {
+    next_idx = pick_next();
+  }
+  if (next_idx < 0) {
+    return false;
+  }
+
+  track = tracks[next_idx];
+  return true;
+}
+
+bool PlayQueue::advance(Track &track) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (next_idx < 0) {
+    next_idx = pick_next();
+  }
+  if (next_idx < 0) {
+    return false;
+  }
+
+  current_idx = next_idx;
+  next_idx = -1;
+  track = tracks[current_idx];
+  return true;
+}
+
+bool PlayQueue::step_back(Track &track) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (tracks.empty()) {
+    return false;
+  }
+
+  current_idx = (current_idx - 1 + (int)tracks.size()) % tracks.size();
+  next_idx = -1;
+  track = tracks[current_idx];
+  return true;
+}
@@ -1,9 +1,13 @@
 #include "../include/player.hpp"
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
+#include <fstream>
+#include <memory>
 #include <stdio.h>
 #include <string>
 #include <string_view>
@@ -12,11 +16,19 @@
 #include <vector>
 
 #include "audio.hpp"
+#include "backup.hpp"
 #include "db.hpp"
+#include "fingerprint.hpp"
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
+#include "loudness.hpp"
+#include "maintenance.hpp"
+#include "play_queue.hpp"
 #include "player.hpp"
+#include "playlist_io.hpp"
+#include "query_stats.hpp"
+#include "tempo.hpp"
 #define IMGUI_IMPL_OPENGL_LOADER_GLAD
 
 int main_window() {
@@ -55,19 +67,36 @@ int main_window() {
   ImGui_ImplOpenGL3_Init("#version 330");
 
   Database main_database;
-  Music main_player;
+  PlayQueue play_queue;
+  Music main_player(&play_queue);
+  SpectrumAnalyzer spectrum;
   AppState state = main_database.load_app_state();
   main_player.set_volume(state.volume);
+  main_player.set_gain_mode(static_cast<GainMode>(state.normalization));
+  main_player.set_skip_silence(state.skip_silence);
+  main_player.set_speed(state.playback_speed);
+  DatabaseBackup library_backup(main_database.path(),
+                                std::string(main_database.path()) + ".bak");
+  double backup_age = library_backup.hours_since_last_backup();
+  if (backup_age < 0.0 || backup_age >= 24.0) {
+    library_backup.start();
+  }
+  MaintenanceScheduler maintenance(main_database.path());
+  maintenance.start();
+  WorkerPool analysis_pool;
+  LoudnessAnalyzer loudness(main_database.path(), analysis_pool);
+  TempoKeyAnalyzer tempo(main_database.path(), analysis_pool);
+  DuplicateFinder duplicates(main_database.path());
+  WaveformCache waveforms(waveform_dir_from_env(main_database.path()),
+                          analysis_pool);
   std::vector<Track> ALL_TRACKS = main_database.get_all_tracks();
   std::vector<Playlist> ALL_PLAYLISTS = main_database.get_all_playlist();
-  Track current_song;
-  int current_idx = -1;
+  Track current_song{};
   bool found = false;
 
-  for (int i = 0; i < ALL_TRACKS.size(); ++i) {
+  for (size_t i = 0; i < ALL_TRACKS.size(); ++i) {
     if (ALL_TRACKS[i].id == state.last_track_id) {
       current_song = ALL_TRACKS[i];
-      current_idx = i;
       found = true;
       break;
     }
@@ -75,38 +104,28 @@ int main_window() {
 
   if (!found && !ALL_TRACKS.empty()) {
     current_song = ALL_TRACKS.front();
-    current_idx = 0;
     found = true;
   }
 
-  auto play_next_track = [&]() {
-    if (ALL_TRACKS.empty()) {
-      return;
-    }
-
-    if (state.is_repeat) {
-      main_player.stop();
-      main_player.play(current_song.file_path, current_song.id);
-    } else if (state.if_shuffled) {
-      int new_idx;
-      do {
-        new_idx = rand() % ALL_TRACKS.size();
-      } while (new_idx == current_idx && ALL_TRACKS.size() > 1);
-
-      current_idx = new_idx;
-      current_song = ALL_TRACKS[current_idx];
-      state.last_track_id = current_song.id;
-      main_player.stop();
-      main_player.play(current_song.file_path, current_song.id);
-    } else {
-      current_idx = (current_idx + 1) % ALL_TRACKS.size();
-      current_song = ALL_TRACKS[current_idx];
-      state.last_track_id = current_song.id;
-      main_player.stop();
-      main_player.play(current_song.file_path, current_song.id);
+  play_queue.set_tracks(ALL_TRACKS);
+  play_queue.set_current(current_song.id);
+  play_queue.set_modes(state.if_shuffled, state.is_repeat);
+  size_t queued_tracks = ALL_TRACKS.size();
+  loudness.rescan();
+  tempo.rescan();
+
+  auto follow_advance = [&](int track_id) {
+    for (size_t i = 0; i < ALL_TRACKS.size(); ++i) {
+      if (ALL_TRACKS[i].id == track_id) {
+        current_song = ALL_TRACKS[i];
+        state.last_track_id = track_id;
+        return;
+      }
     }
   };
 
+  int last_song_id = current_song.id;
+
   const int target_fps = 28;
   const auto frame_duration = std::chrono::milliseconds(1000 / target_fps);
 
@@ -115,8 +134,30 @@ int main_window() {
 
     glfwPollEvents();
 
-    if (main_player.is_finished() && found) {
-      play_next_track();
+    if (ALL_TRACKS.size() != queued_tracks) {
+      play_queue.set_tracks(ALL_TRACKS);
+      queued_tracks = ALL_TRACKS.size();
+      loudness.rescan();
+      tempo.rescan();
+    }
+    for (const auto &r : tempo.take_finished()) {
+      for (auto &track : ALL_TRACKS) {
+        if (track.id == r.track_id) {
+          track.bpm = r.bpm;
+          track.musical_key = r.key;
+          break;
+        }
+      }
+      if (current_song.id == r.track_id) {
+        current_song.bpm = r.bpm;
+        current_song.musical_key = r.key;
+      }
+    }
+    play_queue.set_modes(state.if_shuffled, state.is_repeat);
+
+    int advanced_id = main_player.take_advanced();
+    if (advanced_id >= 0) {
+      follow_advance(advanced_id);
     }
 
     ImGui_ImplOpenGL3_NewFrame();
@@ -137,26 +178,24 @@ int main_window() {
       main_player.play(current_song.file_path, current_song.id);
     }
     ImGui::SameLine();
-    ImGui::Text("State: %s",
-                main_player.get_state() == PlaybackState::Playing  ? "Playing"
-                : main_player.get_state() == PlaybackState::Paused ? "Paused"
-                                                                   : "Stopped");
+    PlaybackState playback = main_player.get_state();
+    ImGui::Text("State: %s", playback == PlaybackState::Playing   ? "Playing"
+                             : playback == PlaybackState::Paused  ? "Paused"
+                             : playback == PlaybackState::Loading ? "Loading"
+                                                                  : "Stopped");
 
     ImGui::SameLine();
     if (ImGui::Button("Next")) {
       if (state.is_repeat) {
         state.is_repeat = false;
+        play_queue.set_modes(state.if_shuffled, state.is_repeat);
       }
-      play_next_track();
+      main_player.next();
     }
 
     ImGui::SameLine();
     if (ImGui::Button("Previous")) {
-      main_player.stop();
-      current_idx = (current_idx - 1 + ALL_TRACKS.size()) % ALL_TRACKS.size();
-      current_song = ALL_TRACKS[current_idx];
-      state.last_track_id = current_song.id;
-      main_player.play(current_song.file_path, current_song.id);
+      main_player.previous();
     }
 
     ImGui::Separator();
@@ -167,6 +206,55 @@ int main_window() {
     }
     state.volume = vol;
 
+    float speed = main_player.get_speed();
+    if (ImGui::SliderFloat("Speed", &speed, TimeStretchSource::min_speed,
+                           TimeStretchSource::max_speed, "%.2fx")) {
+      main_player.set_speed(speed);
+    }
+    state.playback_speed = speed;
+
+    float crossfade = main_player.get_crossfade();
+    int curve = static_cast<int>(main_player.get_crossfade_curve());
+    const char *curves[] = {"Linear", "Equal power"};
+    if (ImGui::SliderFloat("Crossfade", &crossfade, 0.0f, 12.0f, "%.1f s") |
+        ImGui::Combo("Curve", &curve, curves, IM_ARRAYSIZE(curves))) {
+      main_player.set_crossfade(crossfade,
+                                static_cast<CrossfadeCurve>(curve));
+    }
+
+    const char *gain_modes[] = {"Off", "Track gain", "Album gain"};
+    if (ImGui::Combo("Normalize", &state.normalization, gain_modes,
+                     IM_ARRAYSIZE(gain_modes))) {
+      main_player.set_gain_mode(static_cast<GainMode>(state.normalization));
+    }
+    if (ImGui::Checkbox("Skip leading and trailing silence",
+                        &state.skip_silence)) {
+      main_player.set_skip_silence(state.skip_silence);
+    }
+
+    LimiterStats limiter = main_player.get_limiter_stats();
+    if (ImGui::SliderFloat("Ceiling", &limiter.ceiling_db, -12.0f, 0.0f,
+                           "%.1f dBTP")) {
+      main_player.set_limiter_ceiling(limiter.ceiling_db);
+    }
+    if (ImGui::SliderFloat("Release", &limiter.release_ms, 10.0f, 1000.0f,
+                           "%.0f ms", ImGuiSliderFlags_Logarithmic)) {
+      main_player.set_limiter_release(limiter.release_ms);
+    }
+    char reduction[32];
+    std::snprintf(reduction, sizeof(reduction), "-%.1f dB",
+                  limiter.gain_reduction_db);
+    ImGui::ProgressBar(limiter.gain_reduction_db / 12.0f, ImVec2(0.0f, 0.0f),
+                       reduction);
+    ImGui::SameLine();
+    if (ImGui::SmallButton("Limiting")) {
+      main_player.reset_limiter_meter();
+    }
+    if (ImGui::IsItemHovered()) {
+      ImGui::SetTooltip("Most gain reduction so far: %.1f dB (click to reset)",
+                        limiter.max_reduction_db);
+    }
+
     static float seek_value = 0.0f;
     static bool is_seeking = false;
 
@@ -181,11 +269,20 @@ int main_window() {
 
     ImGui::Separator();
 
-    if (ImGui::SliderFloat("##float", &seek_value, 0.0f, total)) {
+    // Draw the waveform once its peaks are ready; until then, or for a
+    // track other than the one playing, fall back to a plain slider.
+    std::shared_ptr<const WaveformView> waveform;
+    if (found && main_player.snapshot().track_id == current_song.id) {
+      waveform = waveforms.get(current_song.file_path);
+    }
+    bool seek_edited =
+        waveform ? render_waveform_seek(*waveform, &seek_value, total)
+                 : ImGui::SliderFloat("##float", &seek_value, 0.0f, total);
+    if (seek_edited) {
       is_seeking = true;
     }
 
-    if (ImGui::IsItemDeactivatedAfterEdit()) {
+    if (is_seeking && ImGui::IsItemDeactivated()) {
       main_player.set_position(seek_value);
       is_seeking = false;
     } else if (!ImGui::IsItemActive()) {
@@ -196,6 +293,9 @@ int main_window() {
     ImGui::Text("%s / %s", format_time(live).c_str(),
                 format_time(total).c_str());
 
+    spectrum.update(main_player.get_output_tap(), io.DeltaTime);
+    render_spectrum(spectrum);
+
     ImGui::Checkbox("Shuffle", &state.if_shuffled);
     ImGui::Checkbox("Repeat", &state.is_repeat);
     if (ImGui::IsItemEdited()) {
@@ -204,6 +304,28 @@ int main_window() {
 
     ImGui::Separator();
 
+    BackupProgress backup = library_backup.progress();
+    if (ImGui::Button("Backup Library")) {
+      library_backup.start();
+    }
+    ImGui::SameLine();
+    if (backup.running) {
+      float done = backup.total_pages > 0
+                       ? 1.0f - static_cast<float>(backup.remaining_pages) /
+                                    backup.total_pages
+                       : 0.0f;
+      char overlay[32];
+      snprintf(overlay, sizeof(overlay), "%.1f MB/s",
+               backup.bytes_per_second / (1024.0 * 1024.0));
+      ImGui::ProgressBar(done, ImVec2(-1.0f, 0.0f), overlay);
+    } else if (backup.failed) {
+      ImGui::Text("Backup failed");
+    } else if (backup.finished) {
+      ImGui::Text("Backup complete");
+    }
+
+    ImGui::Separator();
+
     if (ImGui::Button("Exit")) {
       state.last_track_id = current_song.id;
       state.volume = main_player.get_volume();
@@ -395,6 +517,102 @@ int main_window() {
 
     ImGui::Separator();
 
+    static char bufio[256];
+    static PlaylistImportResult import_result;
+    ImGui::InputText("Playlist file", bufio, IM_ARRAYSIZE(bufio), flags);
+    std::string_view io_path(bufio);
+
+    if (ImGui::Button("Import Playlist")) {
+      import_result = PlaylistImportResult();
+      if (io_path.empty()) {
+        ImGui::OpenPopup("Empty");
+      } else if (import_playlist(main_database, bufio, import_result) != 0) {
+        ImGui::OpenPopup("Import Failed");
+      } else {
+        ALL_PLAYLISTS.clear();
+        ALL_PLAYLISTS = main_database.get_all_playlist();
+        ImGui::OpenPopup("Imported");
+      }
+    }
+
+    if (ImGui::BeginPopupModal("Imported", NULL,
+                               ImGuiWindowFlags_AlwaysAutoResize)) {
+      ImGui::Text("Imported %d of %d entries", import_result.matched,
+                  import_result.entries);
+      if (!import_result.unmatched.empty()) {
+        ImGui::Separator();
+        ImGui::Text("Not in library:");
+        for (size_t i = 0; i < import_result.unmatched.size() && i < 10; ++i) {
+          ImGui::Bullet();
+          ImGui::TextUnformatted(import_result.unmatched[i].c_str());
+        }
+      }
+      ImGui::Separator();
+      if (ImGui::Button("OK", ImVec2(120, 0))) {
+        ImGui::CloseCurrentPopup();
+      }
+      ImGui::EndPopup();
+    } else if (ImGui::BeginPopupModal("Import Failed", NULL,
+                                      ImGuiWindowFlags_AlwaysAutoResize)) {
+      ImGui::Text("Could not import %s", bufio);
+      ImGui::Separator();
+      if (ImGui::Button("OK", ImVec2(120, 0))) {
+        ImGui::CloseCurrentPopup();
+      }
+      ImGui::EndPopup();
+    }
+
+    ImGui::SameLine();
+    if (ImGui::Button("Export Playlist")) {
+      if (io_path.empty()) {
+        ImGui::OpenPopup("Empty");
+      } else {
+        ImGui::OpenPopup("Export Playlist");
+      }
+    }
+
+    if (ImGui::BeginPopupModal("Export Playlist", NULL,
+                               ImGuiWindowFlags_AlwaysAutoResize)) {
+
+      static Playlist temp;
+      if (!ALL_PLAYLISTS.empty() && temp.id == 0) {
+        temp = ALL_PLAYLISTS.front();
+      }
+
+      if (ImGui::BeginCombo("Playlists", temp.name.c_str())) {
+        for (auto &playlist : ALL_PLAYLISTS) {
+          bool is_selected = (temp.id == playlist.id);
+          if (ImGui::Selectable(playlist.name.c_str(), is_selected)) {
+            temp = playlist;
+          }
+          if (is_selected) {
+            ImGui::SetItemDefaultFocus();
+          }
+        }
+        ImGui::EndCombo();
+      }
+
+      ImGui::Text("Save to: %s", bufio);
+      ImGui::Separator();
+
+      if (ImGui::Button("OK", ImVec2(120, 0))) {
+        for (const auto &playlist : ALL_PLAYLISTS) {
+          if (playlist.id == temp.id) {
+            export_playlist(playlist, bufio);
+          }
+        }
+        ImGui::CloseCurrentPopup();
+      }
+      ImGui::SetItemDefaultFocus();
+      ImGui::SameLine();
+      if (ImGui::Button("Cancel", ImVec2(120, 0))) {
+        ImGui::CloseCurrentPopup();
+      }
+      ImGui::EndPopup();
+    }
+
+    ImGui::Separator();
+
     render_playlist(main_database, main_player, ALL_PLAYLISTS, ALL_TRACKS,
                     current_song);
 
@@ -405,6 +623,16 @@ int main_window() {
 
     ImGui::End();
 
+    render_diagnostics(main_database, maintenance, main_player, loudness, tempo,
+                       spectrum, waveforms);
+    render_equalizer(main_player);
+    render_duplicates(duplicates, main_player, current_song);
+
+    if (ImGui::IsAnyItemActive() || current_song.id != last_song_id) {
+      maintenance.touch();
+      last_song_id = current_song.id;
+    }
+
     ImGui::Render();
     int display_w, display_h;
     glfwGetFramebufferSize(window, &display_w, &display_h);
@@ -434,20 +662,53 @@ void render_track_list(Database &main_database, Music &main_player,
                        std::vector<Track> &ALL_TRACKS,
                        std::vector<Playlist> &ALL_PLAYLISTS,
                        Track &current_song) {
-  for (const auto &track : ALL_TRACKS) {
+  static float bpm_range[2] = {0.0f, 0.0f};
+  static bool sort_by_tempo = false;
+  ImGui::SetNextItemWidth(200);
+  ImGui::DragFloatRange2("BPM", &bpm_range[0], &bpm_range[1], 0.5f, 0.0f,
+                         250.0f, "%.0f", "%.0f");
+  ImGui::SameLine();
+  ImGui::Checkbox("Sort by tempo", &sort_by_tempo);
+
+  // A zero upper bound leaves the filter off.
+  bool filtering = bpm_range[1] > 0.0f;
+  std::vector<size_t> order;
+  order.reserve(ALL_TRACKS.size());
+  for (size_t i = 0; i < ALL_TRACKS.size(); ++i) {
+    double bpm = ALL_TRACKS[i].bpm;
+    if (!filtering || (bpm >= bpm_range[0] && bpm <= bpm_range[1])) {
+      order.push_back(i);
+    }
+  }
+  if (sort_by_tempo) {
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return ALL_TRACKS[a].bpm < ALL_TRACKS[b].bpm;
+    });
+  }
+
+  for (size_t i : order) {
+    if (i >= ALL_TRACKS.size()) {
+      break;
+    }
+    const Track &track = ALL_TRACKS[i];
     if (ImGui::TreeNode(track.title.c_str())) {
       ImGui::Text("Artist: %s", track.artist.c_str());
       ImGui::Text("Duration: %s", format_time(track.duration).c_str());
+      if (track.bpm > 0.0) {
+        ImGui::Text("Tempo: %.1f BPM", track.bpm);
+      } else {
+        ImGui::Text("Tempo: -");
+      }
+      if (track.musical_key >= 0) {
+        ImGui::Text("Key: %s (%s)", key_name(track.musical_key),
+                    camelot_name(track.musical_key));
+      } else {
+        ImGui::Text("Key: -");
+      }
 
       if (ImGui::Button(("Play##" + std::to_string(track.id)).c_str())) {
         current_song = track;
-        if ((main_player.get_state() == PlaybackState::Playing) ||
-            (main_player.get_state() == PlaybackState::Paused)) {
-          main_player.stop();
-          main_player.play(current_song.file_path, current_song.id);
-        } else if (main_player.get_state() == PlaybackState::Stopped) {
-          main_player.play(current_song.file_path, current_song.id);
-        }
+        main_player.play_track(current_song.file_path, current_song.id);
       }
 
       ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, ImVec2(2, 2));
@@ -552,13 +813,7 @@ void render_playlist_track_list(Database &main_database, Music &main_player,
 
       if (ImGui::Button(("Play##" + std::to_string(track.id)).c_str())) {
         current_song = track;
-        if ((main_player.get_state() == PlaybackState::Playing) ||
-            (main_player.get_state() == PlaybackState::Paused)) {
-          main_player.stop();
-          main_player.play(current_song.file_path, current_song.id);
-        } else if (main_player.get_state() == PlaybackState::Stopped) {
-          main_player.play(current_song.file_path, current_song.id);
-        }
+        main_player.play_track(current_song.file_path, current_song.id);
       }
 
       ImGui::SameLine();
@@ -594,6 +849,390 @@ void render_playlist_track_list(Database &main_database, Music &main_player,
   }
 }
 
+void render_duplicates(DuplicateFinder &finder, Music &main_player,
+                       Track &current_song) {
+  ImGui::Begin("Duplicates");
+
+  // The finished report is copied once and kept; only its status is polled
+  // while the search runs.
+  static DuplicateReport report;
+  if (report.running) {
+    report = finder.get_report();
+  }
+  if (ImGui::Button("Find duplicates") && finder.start()) {
+    report = finder.get_report();
+  }
+
+  ImGui::SameLine();
+  if (report.running) {
+    ImGui::Text("Searching...");
+  } else if (report.finished) {
+    ImGui::Text("%zu pairs among %d fingerprinted tracks (%d candidates, "
+                "%.2f s)",
+                report.pairs.size(), report.fingerprinted, report.candidates,
+                report.seconds);
+  }
+
+  if (!report.pairs.empty() &&
+      ImGui::BeginTable("duplicates", 3,
+                        ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg |
+                            ImGuiTableFlags_Resizable |
+                            ImGuiTableFlags_ScrollY)) {
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Match", ImGuiTableColumnFlags_WidthFixed);
+    ImGui::TableSetupColumn("Track");
+    ImGui::TableSetupColumn("Duplicate");
+    ImGui::TableHeadersRow();
+
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(report.pairs.size()));
+    while (clipper.Step()) {
+      for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+        const DuplicatePair &pair = report.pairs[i];
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("%.0f%%", pair.similarity * 100.0);
+        for (const Track *track : {&pair.first, &pair.second}) {
+          ImGui::TableNextColumn();
+          ImGui::PushID(track->id);
+          if (ImGui::SmallButton("Play")) {
+            current_song = *track;
+            main_player.play_track(track->file_path, track->id);
+          }
+          ImGui::PopID();
+          ImGui::SameLine();
+          ImGui::Text("%s", track->title.c_str());
+          if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("%s", track->file_path.c_str());
+          }
+        }
+      }
+    }
+    ImGui::EndTable();
+  }
+
+  ImGui::End();
+}
+
+void render_equalizer(Music &main_player) {
+  ImGui::Begin("Equalizer");
+
+  bool enabled = main_player.get_eq_enabled();
+  if (ImGui::Checkbox("Enabled", &enabled)) {
+    main_player.set_eq_enabled(enabled);
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Flat")) {
+    main_player.reset_eq();
+  }
+
+  static const char *filter_types[] = {"Peak", "Low shelf", "High shelf"};
+
+  if (ImGui::BeginTable("eq_bands", 5,
+                        ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+    ImGui::TableSetupColumn("On", ImGuiTableColumnFlags_WidthFixed);
+    ImGui::TableSetupColumn("Type");
+    ImGui::TableSetupColumn("Frequency");
+    ImGui::TableSetupColumn("Gain");
+    ImGui::TableSetupColumn("Q");
+    ImGui::TableHeadersRow();
+
+    for (int i = 0; i < Equalizer::band_count; ++i) {
+      EqBand band = main_player.get_eq_band(i);
+      int type = static_cast<int>(band.type);
+      bool changed = false;
+
+      ImGui::PushID(i);
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      changed |= ImGui::Checkbox("##on", &band.enabled);
+      ImGui::TableNextColumn();
+      ImGui::SetNextItemWidth(-FLT_MIN);
+      if (ImGui::Combo("##type", &type, filter_types,
+                       IM_ARRAYSIZE(filter_types))) {
+        band.type = static_cast<FilterType>(type);
+        changed = true;
+      }
+      ImGui::TableNextColumn();
+      ImGui::SetNextItemWidth(-FLT_MIN);
+      changed |= ImGui::SliderFloat("##freq", &band.frequency, 20.0f, 20000.0f,
+                                    "%.0f Hz", ImGuiSliderFlags_Logarithmic);
+      ImGui::TableNextColumn();
+      ImGui::SetNextItemWidth(-FLT_MIN);
+      changed |= ImGui::SliderFloat("##gain", &band.gain_db, -12.0f, 12.0f,
+                                    "%+.1f dB");
+      ImGui::TableNextColumn();
+      ImGui::SetNextItemWidth(-FLT_MIN);
+      changed |= ImGui::SliderFloat("##q", &band.q, 0.1f, 10.0f, "%.2f",
+                                    ImGuiSliderFlags_Logarithmic);
+      ImGui::PopID();
+
+      if (changed) {
+        main_player.set_eq_band(i, band);
+      }
+    }
+    ImGui::EndTable();
+  }
+
+  ImGui::End();
+}
+
+bool render_waveform_seek(const WaveformView &waveform, float *value,
+                          float total) {
+  static float zoom = 1.0f;
+  static float view_start = 0.0f;
+
+  ImVec2 size(ImGui::GetContentRegionAvail().x, 56.0f);
+  if (size.x < 16.0f) {
+    size.x = 16.0f;
+  }
+  ImVec2 origin = ImGui::GetCursorScreenPos();
+  ImGui::InvisibleButton("##waveform", size);
+  bool active = ImGui::IsItemActive();
+
+  ImDrawList *draw = ImGui::GetWindowDrawList();
+  ImVec2 corner(origin.x + size.x, origin.y + size.y);
+  draw->AddRectFilled(origin, corner, ImGui::GetColorU32(ImGuiCol_FrameBg));
+
+  // A track that is still loading has no length yet to lay out.
+  if (total <= 0.0f) {
+    return false;
+  }
+
+  ImGuiIO &io = ImGui::GetIO();
+  if (ImGui::IsItemHovered() && io.MouseWheel != 0.0f) {
+    zoom *= std::pow(1.25f, io.MouseWheel);
+    zoom = zoom < 1.0f ? 1.0f : (zoom > 256.0f ? 256.0f : zoom);
+  }
+
+  // Follow the playhead unless the user is dragging inside the view.
+  float visible = total / zoom;
+  if (!active) {
+    view_start = *value - visible * 0.5f;
+  }
+  view_start = std::max(0.0f, std::min(view_start, total - visible));
+
+  bool changed = false;
+  if (active) {
+    float x = (io.MousePos.x - origin.x) / size.x;
+    x = x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+    *value = view_start + x * visible;
+    changed = true;
+  }
+
+  float mid = origin.y + size.y * 0.5f;
+  float half = size.y * 0.5f - 1.0f;
+  int columns = static_cast<int>(size.x);
+  float per_column = visible / columns;
+  ImU32 played = ImGui::GetColorU32(ImGuiCol_PlotHistogram);
+  ImU32 unplayed = ImGui::GetColorU32(ImGuiCol_PlotLines);
+  ImU32 body = ImGui::GetColorU32(ImGuiCol_Text);
+  ImU32 loudness = ImGui::GetColorU32(ImGuiCol_Text, 0.5f);
+
+  for (int x = 0; x < columns; ++x) {
+    float t = view_start + x * per_column;
+    WaveformSpan s = waveform.span(t, t + per_column);
+    float px = origin.x + x + 0.5f;
+    ImU32 color = t < *value ? played : unplayed;
+    draw->AddLine(ImVec2(px, mid - s.max * half),
+                  ImVec2(px, mid - s.min * half), color);
+    draw->AddLine(ImVec2(px, mid - s.rms * half),
+                  ImVec2(px, mid + s.rms * half), loudness);
+  }
+
+  float head = origin.x + (*value - view_start) / visible * size.x;
+  draw->AddLine(ImVec2(head, origin.y), ImVec2(head, corner.y), body, 2.0f);
+
+  if (zoom > 1.0f) {
+    char label[16];
+    std::snprintf(label, sizeof(label), "%.0fx", zoom);
+    draw->AddText(ImVec2(origin.x + 4.0f, origin.y + 2.0f), body, label);
+  }
+  return changed;
+}
+
+void render_spectrum(const SpectrumAnalyzer &spectrum) {
+  ImGui::PlotHistogram("##spectrum", spectrum.get_bands(),
+                       SpectrumAnalyzer::band_count, 0, nullptr,
+                       SpectrumAnalyzer::floor_db, 0.0f,
+                       ImVec2(-FLT_MIN, 80.0f));
+
+  const char *names[2] = {"L", "R"};
+  for (int c = 0; c < 2; ++c) {
+    float rms = spectrum.get_rms_db(c);
+    float peak = spectrum.get_peak_db(c);
+    char label[48];
+    std::snprintf(label, sizeof(label), "%s %.1f dB (peak %.1f)", names[c],
+                  rms, peak);
+    ImGui::ProgressBar((rms + 60.0f) / 60.0f, ImVec2(-FLT_MIN, 0.0f), label);
+  }
+}
+
+void render_diagnostics(Database &main_database,
+                        MaintenanceScheduler &maintenance, Music &main_player,
+                        LoudnessAnalyzer &loudness, TempoKeyAnalyzer &tempo,
+                        const SpectrumAnalyzer &spectrum,
+                        WaveformCache &waveforms) {
+  ImGui::Begin("Diagnostics");
+
+  if (ImGui::CollapsingHeader("Playback")) {
+    CrossfadeStats x = main_player.get_crossfade_stats();
+    ImGui::Text("Crossfades: %lld (%.1f s of audio)", x.fades, x.fade_seconds);
+    ImGui::Text("Mixer cost: %.1f us/s while fading, %.1f us/s overall",
+                x.fade_us_per_second, x.total_us_per_second);
+    EqualizerStats eq = main_player.get_eq_stats();
+    ImGui::Text("Equalizer cost: %.1f us/s (%d bands active at %u Hz)",
+                eq.us_per_second, eq.active_bands, eq.sample_rate);
+    LimiterStats lim = main_player.get_limiter_stats();
+    ImGui::Text("Limiter cost: %.1f us/s, %.0f ms lookahead, limited %.1f s",
+                lim.us_per_second, lim.lookahead_ms, lim.limited_seconds);
+    WaveformStats w = waveforms.get_stats();
+    ImGui::Text("Waveforms: %d mapped (%.1f KiB), %d built in %.1f s, %d "
+                "loaded, %d pending, %d failed",
+                w.mapped, w.mapped_bytes / 1024.0, w.built, w.build_seconds,
+                w.loaded, w.pending, w.failed);
+    SpectrumStats sa = spectrum.get_stats();
+    ImGui::Text("Spectrum analyzer: %.1f us per frame, %.2f%% of a core",
+                sa.us_per_update, sa.core_percent);
+    TimeStretchStats ts = main_player.get_stretch_stats();
+    ImGui::Text("Time stretch: %.2fx, %.1f us/s over %.1f s stretched",
+                ts.speed, ts.us_per_second, ts.stretched_seconds);
+    ImGui::Text("Last track advance: %.2f ms after end of track",
+                main_player.get_advance_lag_ms());
+    ImGui::Text("Last track open: %.1f ms", main_player.get_last_open_ms());
+    SeekIndexStats seek = main_player.get_seek_stats();
+    ImGui::Text("Seek indexes: %d built in %.1f s, %d pending, %d failed",
+                seek.built, seek.busy_seconds, seek.pending, seek.failed);
+    PlaybackSnapshot playback = main_player.snapshot();
+    ImGui::Text("Audio device: %s (stopped %lld times while idle)",
+                playback.device_running ? "running" : "stopped",
+                playback.device_stops);
+
+    AudioMemoryStats mem = main_player.get_memory_stats();
+    ImGui::Text("Audio memory: %.1f of %.0f MiB",
+                mem.resident_bytes / (1024.0 * 1024.0),
+                mem.budget_bytes / (1024.0 * 1024.0));
+    for (int deck = 0; deck < 2; ++deck) {
+      if (mem.decks[deck].loaded) {
+        ImGui::BulletText("Deck %d: %s, %.1f MiB", deck + 1,
+                          decode_mode_name(mem.decks[deck].mode),
+                          mem.decks[deck].resident_bytes / (1024.0 * 1024.0));
+      }
+    }
+
+    LoudnessStats l = loudness.get_stats();
+    ImGui::Text("Loudness analysis: %d done, %d pending, %d failed "
+                "(%d workers)",
+                l.analyzed, l.pending, l.failed, l.workers);
+    ImGui::Text("Analysis speed: %.0fx realtime per worker",
+                l.busy_seconds > 0.0 ? l.audio_seconds / l.busy_seconds : 0.0);
+    ImGui::Text("Current track gain: %+.1f dB", playback.track_gain_db);
+    ImGui::Text("Silence skipped on current track: %.1f s",
+                playback.skipped_seconds);
+    TempoKeyStats t = tempo.get_stats();
+    ImGui::Text("Tempo/key analysis: %d done, %d pending, %d failed (%d "
+                "workers)",
+                t.analyzed, t.pending, t.failed, t.workers);
+    ImGui::Text("Tempo/key speed: %.0fx realtime, %.0f%% of a core each",
+                t.busy_seconds > 0.0 ? t.audio_seconds / t.busy_seconds : 0.0,
+                t.cpu_percent);
+
+    PcmCacheStats cache = main_player.get_cache_stats();
+    ImGui::Text("PCM cache: %d tracks, %.1f of %.0f MiB", cache.entries,
+                cache.bytes / (1024.0 * 1024.0),
+                cache.budget_bytes / (1024.0 * 1024.0));
+    ImGui::Text("Cache hits: %lld, misses: %lld, evictions: %lld", cache.hits,
+                cache.misses, cache.evictions);
+
+    MmapVfsStats files = main_player.get_vfs_stats();
+    ImGui::Text("Mapped files: %d open, %.1f MiB mapped, %lld opens",
+                files.open_files, files.mapped_bytes / (1024.0 * 1024.0),
+                files.opens);
+    ImGui::Text("Read-ahead: %.1f MiB buffered, lowest fill %.0f%% of %.0f MiB",
+                files.buffered_bytes / (1024.0 * 1024.0),
+                files.min_fill * 100.0,
+                files.readahead_bytes / (1024.0 * 1024.0));
+    ImGui::Text("Slow reads (>5 ms): %lld, slowest: %.1f ms",
+                files.slow_reads, files.max_read_ms);
+  }
+
+  if (ImGui::CollapsingHeader("Database Maintenance")) {
+    MaintenanceStats m = maintenance.get_stats();
+    ImGui::Text("WAL size: %.1f KiB", m.wal_bytes / 1024.0);
+    ImGui::Text("Checkpoints: %d (last %d frames)", m.checkpoints,
+                m.wal_frames_checkpointed);
+    ImGui::Text("Optimize runs: %d", m.optimizes);
+    ImGui::Text("Vacuum runs: %d, pages reclaimed: %d, free pages: %d%s",
+                m.vacuums, m.pages_reclaimed, m.freelist_pages,
+                m.auto_vacuum == 2 ? "" : " (auto_vacuum off)");
+    if (m.vacuum_migrated) {
+      ImGui::Text("Enabled incremental auto_vacuum: full VACUUM in %.1f ms",
+                  m.migration_ms);
+    }
+    ImGui::Text("Last run: %.2f ms, total: %.1f ms, over budget: %d",
+                m.last_run_ms, m.total_run_ms, m.budget_overruns);
+  }
+
+  QueryStats &query_stats = QueryStats::instance();
+  main_database.explain_pending_queries();
+
+  if (ImGui::CollapsingHeader("Queries")) {
+    bool debug = query_stats.get_debug();
+    if (ImGui::Checkbox("Log full-scan query plans", &debug)) {
+      query_stats.set_debug(debug);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Reset")) {
+      query_stats.reset();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Dump")) {
+      std::ofstream out("query_stats.txt");
+      query_stats.dump(out);
+    }
+
+    if (ImGui::BeginTable("queries", 7,
+                          ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg |
+                              ImGuiTableFlags_Resizable |
+                              ImGuiTableFlags_ScrollY,
+                          ImVec2(0.0f, 240.0f))) {
+      ImGui::TableSetupScrollFreeze(0, 1);
+      ImGui::TableSetupColumn("Statement", ImGuiTableColumnFlags_WidthStretch);
+      ImGui::TableSetupColumn("Calls");
+      ImGui::TableSetupColumn("Rows");
+      ImGui::TableSetupColumn("Avg ms");
+      ImGui::TableSetupColumn("p95 ms");
+      ImGui::TableSetupColumn("Max ms");
+      ImGui::TableSetupColumn("Total ms");
+      ImGui::TableHeadersRow();
+
+      for (const auto &stat : query_stats.snapshot()) {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(stat.sql.c_str());
+        if (stat.fullscan_steps > 0 && ImGui::IsItemHovered()) {
+          ImGui::SetTooltip("Full scan steps: %lld", stat.fullscan_steps);
+        }
+        ImGui::TableNextColumn();
+        ImGui::Text("%lld", stat.calls);
+        ImGui::TableNextColumn();
+        ImGui::Text("%lld", stat.rows);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", stat.calls ? stat.total_ms / stat.calls : 0.0);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", QueryStats::percentile_ms(stat, 0.95));
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", stat.max_ms);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.2f", stat.total_ms);
+      }
+      ImGui::EndTable();
+    }
+  }
+
+  ImGui::End();
+}
+
 std::string format_time(float seconds) {
   int mins = static_cast<int>(seconds) / 60;
   int secs = static_cast<int>(seconds) % 60;
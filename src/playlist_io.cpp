@@ -0,0 +1,410 @@
+#include "playlist_io.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+static std::string lowercase(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return s;
+}
+
+static void trim(std::string &s) {
+  size_t begin = s.find_first_not_of(" \t\r\n");
+  if (begin == std::string::npos) {
+    s.clear();
+    return;
+  }
+  size_t end = s.find_last_not_of(" \t\r\n");
+  s = s.substr(begin, end - begin + 1);
+}
+
+static std::string percent_decode(const std::string &s) {
+  std::string out;
+  out.reserve(s.size());
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '%' && i + 2 < s.size() &&
+        std::isxdigit(static_cast<unsigned char>(s[i + 1])) &&
+        std::isxdigit(static_cast<unsigned char>(s[i + 2]))) {
+      out += static_cast<char>(std::strtol(s.substr(i + 1, 2).c_str(),
+                                           nullptr, 16));
+      i += 2;
+    } else {
+      out += s[i];
+    }
+  }
+  return out;
+}
+
+static std::string percent_encode(const std::string &s) {
+  static const char *hex = "0123456789ABCDEF";
+  std::string out;
+  out.reserve(s.size());
+  for (unsigned char c : s) {
+    if (std::isalnum(c) || c == '/' || c == '-' || c == '_' || c == '.' ||
+        c == '~') {
+      out += static_cast<char>(c);
+    } else {
+      out += '%';
+      out += hex[c >> 4];
+      out += hex[c & 0xF];
+    }
+  }
+  return out;
+}
+
+static std::string xml_decode(const std::string &s) {
+  std::string out;
+  out.reserve(s.size());
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] != '&') {
+      out += s[i];
+      continue;
+    }
+    size_t end = s.find(';', i);
+    if (end == std::string::npos) {
+      out += s[i];
+      continue;
+    }
+    std::string entity = s.substr(i + 1, end - i - 1);
+    if (entity == "amp") {
+      out += '&';
+    } else if (entity == "lt") {
+      out += '<';
+    } else if (entity == "gt") {
+      out += '>';
+    } else if (entity == "quot") {
+      out += '"';
+    } else if (entity == "apos") {
+      out += '\'';
+    } else if (!entity.empty() && entity[0] == '#') {
+      long code = entity.size() > 1 && (entity[1] == 'x' || entity[1] == 'X')
+                      ? std::strtol(entity.c_str() + 2, nullptr, 16)
+                      : std::strtol(entity.c_str() + 1, nullptr, 10);
+      if (code < 0x80) {
+        out += static_cast<char>(code);
+      } else if (code < 0x800) {
+        out += static_cast<char>(0xC0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+      } else if (code < 0x10000) {
+        out += static_cast<char>(0xE0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+      } else {
+        out += static_cast<char>(0xF0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+      }
+    } else {
+      out += s.substr(i, end - i + 1);
+    }
+    i = end;
+  }
+  return out;
+}
+
+static std::string xml_encode(const std::string &s) {
+  std::string out;
+  out.reserve(s.size());
+  for (char c : s) {
+    switch (c) {
+    case '&':
+      out += "&amp;";
+      break;
+    case '<':
+      out += "&lt;";
+      break;
+    case '>':
+      out += "&gt;";
+      break;
+    case '"':
+      out += "&quot;";
+      break;
+    default:
+      out += c;
+    }
+  }
+  return out;
+}
+
+static std::string xml_element(const std::string &block, const char *tag) {
+  std::string open = std::string("<") + tag;
+  std::string close = std::string("</") + tag + ">";
+  size_t begin = block.find(open);
+  if (begin == std::string::npos) {
+    return "";
+  }
+  begin = block.find('>', begin);
+  size_t end = block.find(close, begin);
+  if (begin == std::string::npos || end == std::string::npos) {
+    return "";
+  }
+  std::string value = xml_decode(block.substr(begin + 1, end - begin - 1));
+  trim(value);
+  return value;
+}
+
+static std::string resolve_location(const std::string &location,
+                                    const fs::path &base_dir) {
+  std::string path = location;
+  if (lowercase(path.substr(0, 7)) == "file://") {
+    path = percent_decode(path.substr(7));
+    if (path.size() > 2 && path[0] == '/' && path[2] == ':') {
+      path.erase(0, 1);
+    }
+  } else if (path.find("://") != std::string::npos) {
+    return "";
+  }
+
+  fs::path p(path);
+  if (p.is_relative()) {
+    p = base_dir / p;
+  }
+  return p.lexically_normal().string();
+}
+
+PlaylistFormat playlist_format_from_path(const std::string &path) {
+  std::string ext = lowercase(fs::path(path).extension().string());
+  if (ext == ".m3u" || ext == ".m3u8") {
+    return PlaylistFormat::M3U;
+  }
+  if (ext == ".pls") {
+    return PlaylistFormat::PLS;
+  }
+  if (ext == ".xspf") {
+    return PlaylistFormat::XSPF;
+  }
+  return PlaylistFormat::Unknown;
+}
+
+static void parse_m3u(std::istream &in,
+                      const std::function<void(const PlaylistEntry &)> &emit) {
+  PlaylistEntry entry;
+  std::string line;
+  bool first = true;
+  while (std::getline(in, line)) {
+    if (first && line.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+      line.erase(0, 3);
+    }
+    first = false;
+    trim(line);
+    if (line.empty()) {
+      continue;
+    }
+
+    if (line.compare(0, 8, "#EXTINF:") == 0) {
+      size_t comma = line.find(',');
+      entry.duration = std::atoi(line.c_str() + 8);
+      entry.title = comma == std::string::npos ? "" : line.substr(comma + 1);
+    } else if (line[0] != '#') {
+      entry.location = line;
+      emit(entry);
+      entry = PlaylistEntry();
+    }
+  }
+}
+
+static void parse_pls(std::istream &in,
+                      const std::function<void(const PlaylistEntry &)> &emit) {
+  PlaylistEntry entry;
+  int current = -1;
+  std::string line;
+  while (std::getline(in, line)) {
+    trim(line);
+    size_t eq = line.find('=');
+    if (eq == std::string::npos) {
+      continue;
+    }
+
+    std::string key = lowercase(line.substr(0, eq));
+    std::string value = line.substr(eq + 1);
+    const char *fields[] = {"file", "title", "length"};
+    for (int field = 0; field < 3; ++field) {
+      size_t len = std::char_traits<char>::length(fields[field]);
+      if (key.compare(0, len, fields[field]) != 0 || key.size() == len ||
+          !std::isdigit(static_cast<unsigned char>(key[len]))) {
+        continue;
+      }
+
+      int number = std::atoi(key.c_str() + len);
+      if (number != current) {
+        if (!entry.location.empty()) {
+          emit(entry);
+        }
+        entry = PlaylistEntry();
+        current = number;
+      }
+
+      if (field == 0) {
+        entry.location = value;
+      } else if (field == 1) {
+        entry.title = value;
+      } else {
+        entry.duration = std::atoi(value.c_str());
+      }
+      break;
+    }
+  }
+  if (!entry.location.empty()) {
+    emit(entry);
+  }
+}
+
+static void parse_xspf(std::istream &in,
+                       const std::function<void(const PlaylistEntry &)> &emit) {
+  std::string buffer;
+  char chunk[64 * 1024];
+  size_t scan_from = 0;
+  while (in.read(chunk, sizeof(chunk)) || in.gcount() > 0) {
+    buffer.append(chunk, static_cast<size_t>(in.gcount()));
+
+    size_t consumed = 0;
+    size_t end;
+    while ((end = buffer.find("</track>", scan_from)) != std::string::npos) {
+      size_t begin = buffer.rfind("<track", end);
+      if (begin != std::string::npos && begin >= consumed) {
+        std::string block = buffer.substr(begin, end - begin);
+        PlaylistEntry entry;
+        entry.location = xml_element(block, "location");
+        entry.title = xml_element(block, "title");
+        std::string duration = xml_element(block, "duration");
+        if (!duration.empty()) {
+          entry.duration = std::atoi(duration.c_str()) / 1000;
+        }
+        if (!entry.location.empty()) {
+          emit(entry);
+        }
+      }
+      consumed = end + 8;
+      scan_from = consumed;
+    }
+
+    buffer.erase(0, consumed);
+    scan_from = buffer.size() > 8 ? buffer.size() - 8 : 0;
+  }
+}
+
+int parse_playlist(const std::string &path,
+                   const std::function<void(const PlaylistEntry &)> &on_entry) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    std::cerr << "Failed to open playlist: " << path << std::endl;
+    return 1;
+  }
+
+  switch (playlist_format_from_path(path)) {
+  case PlaylistFormat::M3U:
+    parse_m3u(in, on_entry);
+    break;
+  case PlaylistFormat::PLS:
+    parse_pls(in, on_entry);
+    break;
+  case PlaylistFormat::XSPF:
+    parse_xspf(in, on_entry);
+    break;
+  default:
+    std::cerr << "Unsupported playlist format: " << path << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int import_playlist(Database &db, const std::string &path,
+                    PlaylistImportResult &result) {
+  std::unordered_map<std::string, int> index = db.get_track_path_index();
+  fs::path base_dir = fs::absolute(path).parent_path();
+  std::vector<int> track_ids;
+
+  int rc = parse_playlist(path, [&](const PlaylistEntry &entry) {
+    result.entries++;
+    auto it = index.find(resolve_location(entry.location, base_dir));
+    if (it == index.end()) {
+      result.unmatched.push_back(entry.location);
+      return;
+    }
+    track_ids.push_back(it->second);
+  });
+  if (rc != 0) {
+    return rc;
+  }
+
+  std::string name = fs::path(path).stem().string();
+  if (db.add_playlist(name.c_str(), &result.playlist_id) != 0) {
+    return 1;
+  }
+  if (db.add_tracks_to_playlist(result.playlist_id, track_ids) != 0) {
+    db.delete_playlist(result.playlist_id);
+    result.playlist_id = -1;
+    return 1;
+  }
+
+  result.matched = static_cast<int>(track_ids.size());
+  return 0;
+}
+
+int export_playlist(const Playlist &playlist, const std::string &path) {
+  PlaylistFormat format = playlist_format_from_path(path);
+  if (format == PlaylistFormat::Unknown) {
+    std::cerr << "Unsupported playlist format: " << path << std::endl;
+    return 1;
+  }
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    std::cerr << "Failed to write playlist: " << path << std::endl;
+    return 1;
+  }
+
+  if (format == PlaylistFormat::M3U) {
+    out << "#EXTM3U\n";
+    for (const auto &track : playlist.tracks) {
+      out << "#EXTINF:" << track.duration << ',';
+      if (!track.artist.empty()) {
+        out << track.artist << " - ";
+      }
+      out << track.title << '\n' << track.file_path << '\n';
+    }
+  } else if (format == PlaylistFormat::PLS) {
+    out << "[playlist]\n";
+    int n = 0;
+    for (const auto &track : playlist.tracks) {
+      ++n;
+      out << "File" << n << '=' << track.file_path << '\n';
+      out << "Title" << n << '=' << track.title << '\n';
+      out << "Length" << n << '=' << track.duration << '\n';
+    }
+    out << "NumberOfEntries=" << n << "\nVersion=2\n";
+  } else {
+    out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        << "<playlist version=\"1\" xmlns=\"http://xspf.org/ns/0/\">\n"
+        << "  <title>" << xml_encode(playlist.name) << "</title>\n"
+        << "  <trackList>\n";
+    for (const auto &track : playlist.tracks) {
+      std::string location =
+          fs::path(track.file_path).is_absolute()
+              ? "file://" + percent_encode(track.file_path)
+              : percent_encode(track.file_path);
+      out << "    <track>\n"
+          << "      <location>" << xml_encode(location) << "</location>\n"
+          << "      <title>" << xml_encode(track.title) << "</title>\n"
+          << "      <creator>" << xml_encode(track.artist) << "</creator>\n"
+          << "      <duration>" << track.duration * 1000 << "</duration>\n"
+          << "    </track>\n";
+    }
+    out << "  </trackList>\n</playlist>\n";
+  }
+
+  if (!out) {
+    std::cerr << "Failed to write playlist: " << path << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,195 @@
+#include "query_stats.hpp"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+QueryStats &QueryStats::instance() {
+  static QueryStats stats;
+  static bool from_env = [] {
+    const char *env = std::getenv("MUSIC_PLAYR_SQL_DEBUG");
+    stats.set_debug(env != nullptr && env[0] != '\0' && env[0] != '0');
+    return true;
+  }();
+  (void)from_env;
+  return stats;
+}
+
+int QueryStats::bucket_for(double ms) {
+  int bucket = 0;
+  double upper = 0.01;
+  while (ms > upper && bucket < QUERY_HISTOGRAM_BUCKETS - 1) {
+    upper *= 2.0;
+    bucket++;
+  }
+  return bucket;
+}
+
+double QueryStats::bucket_upper_ms(int bucket) {
+  double upper = 0.01;
+  for (int i = 0; i < bucket; ++i) {
+    upper *= 2.0;
+  }
+  return upper;
+}
+
+double QueryStats::percentile_ms(const QueryStat &stat, double q) {
+  long long target = static_cast<long long>(stat.calls * q);
+  long long seen = 0;
+  for (int i = 0; i < QUERY_HISTOGRAM_BUCKETS; ++i) {
+    seen += stat.histogram[i];
+    if (seen > target) {
+      return std::min(bucket_upper_ms(i), stat.max_ms);
+    }
+  }
+  return stat.max_ms;
+}
+
+void QueryStats::attach(sqlite3 *db) {
+  auto connection = std::make_unique<TracedConnection>();
+  connection->owner = this;
+  sqlite3_trace_v2(db,
+                   SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE | SQLITE_TRACE_ROW,
+                   &QueryStats::trace, connection.get());
+
+  std::lock_guard<std::mutex> lock(mutex);
+  connections[db] = std::move(connection);
+}
+
+void QueryStats::detach(sqlite3 *db) {
+  sqlite3_trace_v2(db, 0, nullptr, nullptr);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  connections.erase(db);
+}
+
+int QueryStats::trace(unsigned type, void *context, void *p, void *x) {
+  auto *connection = static_cast<TracedConnection *>(context);
+  auto *stmt = static_cast<sqlite3_stmt *>(p);
+
+  if (type == SQLITE_TRACE_STMT) {
+    RunningQuery &query = connection->running[stmt];
+    query.started = std::chrono::steady_clock::now();
+    query.rows = 0;
+  } else if (type == SQLITE_TRACE_ROW) {
+    connection->running[stmt].rows++;
+  } else if (type == SQLITE_TRACE_PROFILE) {
+    connection->owner->record(*connection, stmt,
+                              *static_cast<sqlite3_int64 *>(x));
+  }
+  return 0;
+}
+
+void QueryStats::record(TracedConnection &connection, sqlite3_stmt *stmt,
+                        long long ns) {
+  auto finished = std::chrono::steady_clock::now();
+  double ms = ns / 1e6;
+  long long rows = 0;
+
+  // SQLite's own profile time comes from the VFS clock, which only has
+  // millisecond resolution, so prefer the steady clock when we saw the start.
+  auto query = connection.running.find(stmt);
+  if (query != connection.running.end()) {
+    ms = std::chrono::duration<double, std::milli>(finished -
+                                                   query->second.started)
+             .count();
+    rows = query->second.rows;
+    connection.running.erase(query);
+  }
+
+  const char *sql = sqlite3_sql(stmt);
+  if (sql == nullptr || sqlite3_stmt_isexplain(stmt)) {
+    return;
+  }
+  int fullscan = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  QueryStat &stat = stats[sql];
+  if (stat.sql.empty()) {
+    stat.sql = sql;
+  }
+  stat.rows += rows;
+
+  stat.calls++;
+  stat.total_ms += ms;
+  stat.max_ms = std::max(stat.max_ms, ms);
+  stat.histogram[bucket_for(ms)]++;
+  stat.fullscan_steps += fullscan;
+
+  if (debug && fullscan > 0 && explained.insert(stat.sql).second) {
+    pending_plans.push_back(stat.sql);
+  }
+}
+
+// Every connection opens the same database file, so a plan prepared here
+// matches the one the statement got on the connection that ran it.
+void QueryStats::explain_pending(sqlite3 *db) {
+  std::vector<std::string> plans;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    plans.swap(pending_plans);
+  }
+
+  for (const auto &plan : plans) {
+    std::string sql = "EXPLAIN QUERY PLAN " + plan;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) !=
+        SQLITE_OK) {
+      continue;
+    }
+
+    std::cerr << "Full scan: " << plan << '\n';
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      const unsigned char *detail = sqlite3_column_text(stmt, 3);
+      std::cerr << "  "
+                << (detail ? reinterpret_cast<const char *>(detail) : "")
+                << '\n';
+    }
+    sqlite3_finalize(stmt);
+  }
+}
+
+std::vector<QueryStat> QueryStats::snapshot() {
+  std::vector<QueryStat> out;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    out.reserve(stats.size());
+    for (const auto &entry : stats) {
+      out.push_back(entry.second);
+    }
+  }
+  std::sort(out.begin(), out.end(), [](const QueryStat &a, const QueryStat &b) {
+    return a.total_ms > b.total_ms;
+  });
+  return out;
+}
+
+void QueryStats::reset() {
+  std::lock_guard<std::mutex> lock(mutex);
+  stats.clear();
+  explained.clear();
+}
+
+void QueryStats::dump(std::ostream &out) {
+  out << std::fixed << std::setprecision(3);
+  for (const auto &stat : snapshot()) {
+    out << stat.sql << '\n'
+        << "  calls=" << stat.calls << " rows=" << stat.rows
+        << " total_ms=" << stat.total_ms
+        << " avg_ms=" << (stat.calls ? stat.total_ms / stat.calls : 0.0)
+        << " p95_ms=" << percentile_ms(stat, 0.95) << " max_ms=" << stat.max_ms
+        << " fullscan_steps=" << stat.fullscan_steps
+        << '\n'
+        << "  histogram:";
+    for (int i = 0; i < QUERY_HISTOGRAM_BUCKETS; ++i) {
+      if (stat.histogram[i] > 0) {
+        out << " <=" << bucket_upper_ms(i) << "ms:" << stat.histogram[i];
+      }
+    }
+    out << '\n';
+  }
+}
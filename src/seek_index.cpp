@@ -0,0 +1,103 @@
+#include "seek_index.hpp"
+#include "worker_pool.hpp"
+
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+
+static const double points_per_second = 1.0;
+
+bool supports_seek_index(const std::string &path) {
+  std::string ext = std::filesystem::path(path).extension().string();
+  for (auto &c : ext) {
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  }
+  return ext == ".mp3";
+}
+
+SeekIndexer::SeekIndexer(const char *db_path) : db(db_path) {
+  worker = std::thread(&SeekIndexer::run, this);
+}
+
+SeekIndexer::~SeekIndexer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop_requested = true;
+  }
+  wake.notify_all();
+  if (worker.joinable()) {
+    worker.join();
+  }
+}
+
+void SeekIndexer::request(int track_id, const std::string &path) {
+  if (!supports_seek_index(path)) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (done.count(track_id) != 0) {
+    return;
+  }
+  for (const auto &r : pending) {
+    if (r.track_id == track_id) {
+      return;
+    }
+  }
+  pending.push_back({track_id, path});
+  stats.pending = static_cast<int>(pending.size());
+  wake.notify_one();
+}
+
+SeekIndexStats SeekIndexer::get_stats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+void SeekIndexer::run() {
+  lower_thread_priority();
+
+  while (true) {
+    Request r;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this] { return stop_requested || !pending.empty(); });
+      if (stop_requested) {
+        return;
+      }
+      r = pending.front();
+      pending.pop_front();
+      stats.pending = static_cast<int>(pending.size());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::error_code ec;
+    std::uintmax_t bytes = std::filesystem::file_size(r.path, ec);
+
+    SeekIndex index;
+    bool ok = false;
+    if (!ec && db.get_seek_index(r.track_id, index) &&
+        index.file_bytes == bytes) {
+      ok = true;
+    } else if (!ec && build_mp3_seek_index(r.path, index, points_per_second)) {
+      index.file_bytes = bytes;
+      ok = db.set_seek_index(r.track_id, index) == 0;
+    } else {
+      std::cerr << "Failed to index for seeking: " << r.path << std::endl;
+    }
+
+    double busy = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    done.insert(r.track_id);
+    if (ok) {
+      ++stats.built;
+      stats.busy_seconds += busy;
+    } else {
+      ++stats.failed;
+    }
+  }
+}
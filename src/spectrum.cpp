@@ -0,0 +1,139 @@
+#include "spectrum.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const double pi = 3.14159265358979323846;
+static const float fall_db_per_second = 30.0f;
+static const float lowest_band_hz = 20.0f;
+
+static float power_db(float p) {
+  return p > 0.0f ? 10.0f * std::log10(p) : SpectrumAnalyzer::floor_db;
+}
+
+SpectrumAnalyzer::SpectrumAnalyzer()
+    : fft(fft_size), window(fft_size), frames(fft_size * 2), mono(fft_size),
+      power(fft_size / 2 + 1) {
+  // Hann window scaled so a full-scale sine peaks at 0 dB in its bin.
+  for (size_t i = 0; i < fft_size; ++i) {
+    double w = 0.5 - 0.5 * std::cos(2.0 * pi * i / fft_size);
+    window[i] = static_cast<float>(w * 4.0 / fft_size);
+  }
+  std::fill(bands, bands + band_count, floor_db);
+}
+
+void SpectrumAnalyzer::layout_bands(ma_uint32 sample_rate) {
+  band_rate = sample_rate;
+  band_edges.assign(band_count + 1, 0);
+
+  double bin_hz = static_cast<double>(sample_rate) / fft_size;
+  double top = std::min(20000.0, sample_rate / 2.0);
+  size_t last_bin = fft_size / 2;
+  for (int b = 0; b <= band_count; ++b) {
+    double hz = lowest_band_hz * std::pow(top / lowest_band_hz,
+                                          static_cast<double>(b) / band_count);
+    size_t bin = static_cast<size_t>(hz / bin_hz + 0.5);
+    if (b > 0 && bin <= band_edges[b - 1]) {
+      bin = band_edges[b - 1] + 1;
+    }
+    band_edges[b] = std::min(bin, last_bin);
+  }
+}
+
+void SpectrumAnalyzer::measure_levels(const float *recent, size_t count,
+                                      float dt) {
+  float fall = fall_db_per_second * dt;
+  for (int c = 0; c < 2; ++c) {
+    float sum = 0.0f;
+    float peak = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+      float x = recent[2 * i + c];
+      sum += x * x;
+      peak = std::max(peak, std::fabs(x));
+    }
+    float rms = count > 0 ? power_db(sum / count) : floor_db;
+    float pk = power_db(peak * peak);
+    rms_db[c] = std::max(std::max(rms, floor_db), rms_db[c] - fall);
+    peak_db[c] = std::max(std::max(pk, floor_db), peak_db[c] - fall);
+  }
+}
+
+void SpectrumAnalyzer::update(const AudioTap &tap, float dt) {
+  auto started = std::chrono::steady_clock::now();
+  if (updates == 0) {
+    first_update = started;
+  }
+  ++updates;
+
+  if (tap.get_sample_rate() != band_rate) {
+    layout_bands(tap.get_sample_rate());
+  }
+
+  std::uint64_t end = tap.frames_written();
+  size_t fresh = static_cast<size_t>(std::min<std::uint64_t>(
+      end - last_written, fft_size));
+  last_written = end;
+
+  float fall = fall_db_per_second * dt;
+  if (fresh == 0 || !tap.read_latest(frames.data(), fft_size)) {
+    // Nothing played since the last frame (or the device is stopped): let
+    // the display fall away rather than freeze.
+    for (int b = 0; b < band_count; ++b) {
+      bands[b] = std::max(floor_db, bands[b] - fall);
+    }
+    measure_levels(nullptr, 0, dt);
+  } else {
+    measure_levels(frames.data() + (fft_size - fresh) * 2, fresh, dt);
+
+    const float *in = frames.data();
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 half = _mm_set1_ps(0.5f);
+    for (; i + 4 <= fft_size; i += 4) {
+      __m128 a = _mm_loadu_ps(in + 2 * i);
+      __m128 b = _mm_loadu_ps(in + 2 * i + 4);
+      __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+      __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+      __m128 mid = _mm_mul_ps(_mm_add_ps(left, right), half);
+      _mm_storeu_ps(&mono[i], _mm_mul_ps(mid, _mm_loadu_ps(&window[i])));
+    }
+#endif
+    for (; i < fft_size; ++i) {
+      mono[i] = 0.5f * (in[2 * i] + in[2 * i + 1]) * window[i];
+    }
+
+    fft.power(mono.data(), power.data());
+
+    for (int b = 0; b < band_count; ++b) {
+      float p = 0.0f;
+      for (size_t k = band_edges[b]; k < band_edges[b + 1]; ++k) {
+        p = std::max(p, power[k]);
+      }
+      float db = std::max(power_db(p), floor_db);
+      bands[b] = std::max(db, bands[b] - fall);
+    }
+  }
+
+  busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now() - started)
+                 .count();
+}
+
+SpectrumStats SpectrumAnalyzer::get_stats() const {
+  SpectrumStats s;
+  s.updates = updates;
+  if (updates > 0) {
+    s.us_per_update = busy_ns / 1000.0 / updates;
+    double wall = std::chrono::duration<double, std::nano>(
+                      std::chrono::steady_clock::now() - first_update)
+                      .count();
+    if (wall > 0.0) {
+      s.core_percent = busy_ns * 100.0 / wall;
+    }
+  }
+  return s;
+}
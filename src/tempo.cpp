@@ -0,0 +1,531 @@
+#include "tempo.hpp"
+
+#include "fingerprint.hpp"
+#include "miniaudio/miniaudio.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <thread>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const double pi = 3.14159265358979323846;
+static const double min_bpm = 60.0;
+static const double max_bpm = 200.0;
+static const double prior_bpm = 120.0;
+static const int lag_multiples = 8;
+static const double min_beat_strength = 0.05;
+static const double min_seconds = 8.0;
+static const double min_key_correlation = 0.5;
+static const double onset_low_hz = 30.0;
+static const double chroma_low_hz = 100.0;
+static const double chroma_high_hz = 2500.0;
+static const double audible_chroma = 1e-3;
+static const double default_cpu_percent = 50.0;
+static const ma_uint64 read_frames = 4096;
+
+static const double major_profile[12] = {6.35, 2.23, 3.48, 2.33, 4.38, 4.09,
+                                         2.52, 5.19, 2.39, 3.66, 2.29, 2.88};
+static const double minor_profile[12] = {6.33, 2.68, 3.52, 5.38, 2.60, 3.53,
+                                         2.54, 4.75, 3.98, 2.69, 3.34, 3.17};
+
+static const char *key_names[24] = {
+    "C",  "Db",  "D",  "Eb",  "E",  "F",  "F#",  "G",  "Ab",  "A",  "Bb",
+    "B",  "Cm",  "C#m", "Dm", "Ebm", "Em", "Fm", "F#m", "Gm", "G#m", "Am",
+    "Bbm", "Bm"};
+static const char *camelot_names[24] = {
+    "8B", "3B", "10B", "5B", "12B", "7B", "2B", "9B", "4B", "11B", "6B", "1B",
+    "5A", "12A", "7A", "2A", "9A", "4A", "11A", "6A", "1A", "8A", "3A", "10A"};
+
+const char *key_name(int key) {
+  return key >= 0 && key < 24 ? key_names[key] : "-";
+}
+
+const char *camelot_name(int key) {
+  return key >= 0 && key < 24 ? camelot_names[key] : "-";
+}
+
+static double dot(const float *a, const float *b, size_t n) {
+  size_t i = 0;
+  double sum = 0.0;
+#if defined(__SSE2__)
+  __m128 acc0 = _mm_setzero_ps();
+  __m128 acc1 = _mm_setzero_ps();
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm_add_ps(acc0,
+                      _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    acc1 = _mm_add_ps(
+        acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+  sum = static_cast<double>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+#endif
+  for (; i < n; ++i) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+static double interpolate(const std::vector<double> &r, double lag) {
+  size_t i = static_cast<size_t>(lag);
+  if (i + 1 >= r.size()) {
+    return r.back();
+  }
+  double t = lag - i;
+  return r[i] * (1.0 - t) + r[i + 1] * t;
+}
+
+static std::vector<float> hann(size_t n) {
+  std::vector<float> w(n);
+  for (size_t i = 0; i < n; ++i) {
+    w[i] = static_cast<float>((0.5 - 0.5 * std::cos(2.0 * pi * i / n)) * 2.0 /
+                              n);
+  }
+  return w;
+}
+
+TempoKeyDetector::TempoKeyDetector()
+    : onset_fft(onset_size), chroma_fft(chroma_size),
+      onset_window(hann(onset_size)), chroma_window(hann(chroma_size)),
+      frame(chroma_size), power(chroma_size / 2 + 1),
+      last_log(onset_bands, 0.0f), bin_band(onset_size / 2 + 1, -1),
+      bin_class(chroma_size / 2 + 1, -1),
+      bin_weight(chroma_size / 2 + 1, 0.0f) {
+  // Log-spaced bands, so the many bins of a hi-hat count no more than the
+  // few of a kick drum.
+  double onset_bin_hz = static_cast<double>(analysis_rate) / onset_size;
+  for (size_t k = 1; k <= onset_size / 2; ++k) {
+    double hz = k * onset_bin_hz;
+    if (hz < onset_low_hz) {
+      continue;
+    }
+    double position = std::log(hz / onset_low_hz) /
+                      std::log(analysis_rate / 2.0 / onset_low_hz);
+    bin_band[k] = std::min(onset_bands - 1,
+                           static_cast<int>(position * onset_bands));
+  }
+
+  // Each bin counts toward its nearest pitch class, fading out toward the
+  // quarter-tone boundary where the choice is ambiguous.
+  double bin_hz = static_cast<double>(analysis_rate) / chroma_size;
+  for (size_t k = 1; k <= chroma_size / 2; ++k) {
+    double hz = k * bin_hz;
+    if (hz < chroma_low_hz || hz > chroma_high_hz) {
+      continue;
+    }
+    double midi = 69.0 + 12.0 * std::log2(hz / 440.0);
+    double nearest = std::round(midi);
+    bin_class[k] = static_cast<int>(nearest) % 12;
+    bin_weight[k] = static_cast<float>(1.0 - 2.0 * std::fabs(midi - nearest));
+  }
+}
+
+void TempoKeyDetector::onset_frame(const float *x) {
+  for (size_t i = 0; i < onset_size; ++i) {
+    frame[i] = x[i] * onset_window[i];
+  }
+  onset_fft.power(frame.data(), power.data());
+
+  float bands[onset_bands] = {};
+  for (size_t k = 1; k <= onset_size / 2; ++k) {
+    if (bin_band[k] >= 0) {
+      bands[bin_band[k]] += power[k];
+    }
+  }
+
+  float flux = 0.0f;
+  for (int b = 0; b < onset_bands; ++b) {
+    float level = std::log1p(1000.0f * std::sqrt(bands[b]));
+    flux += std::max(0.0f, level - last_log[b]);
+    last_log[b] = level;
+  }
+  envelope.push_back(flux);
+}
+
+void TempoKeyDetector::chroma_frame(const float *x) {
+  for (size_t i = 0; i < chroma_size; ++i) {
+    frame[i] = x[i] * chroma_window[i];
+  }
+  chroma_fft.power(frame.data(), power.data());
+
+  double c[12] = {};
+  for (size_t k = 1; k <= chroma_size / 2; ++k) {
+    if (bin_class[k] >= 0) {
+      c[bin_class[k]] += bin_weight[k] * std::sqrt(power[k]);
+    }
+  }
+
+  double peak = *std::max_element(c, c + 12);
+  if ((!print_chroma.empty() || peak > audible_chroma) &&
+      print_chroma.size() < max_print_frames * 12) {
+    print_chroma.insert(print_chroma.end(), c, c + 12);
+  }
+
+  // Normalizing each frame keeps loud passages from outvoting quiet ones.
+  if (peak > 1e-5) {
+    for (int i = 0; i < 12; ++i) {
+      chroma[i] += c[i] / peak;
+    }
+  }
+}
+
+void TempoKeyDetector::add(const float *mono, size_t count) {
+  samples.insert(samples.end(), mono, mono + count);
+
+  while (onset_pos + onset_size <= samples.size()) {
+    onset_frame(&samples[onset_pos]);
+    onset_pos += onset_hop;
+  }
+  while (chroma_pos + chroma_size <= samples.size()) {
+    chroma_frame(&samples[chroma_pos]);
+    chroma_pos += chroma_hop;
+  }
+
+  size_t consumed = std::min(onset_pos, chroma_pos);
+  if (consumed >= chroma_size * 4) {
+    samples.erase(samples.begin(), samples.begin() + consumed);
+    onset_pos -= consumed;
+    chroma_pos -= consumed;
+  }
+}
+
+double TempoKeyDetector::bpm() const {
+  double fps = static_cast<double>(analysis_rate) / onset_hop;
+  size_t n = envelope.size();
+  if (n < fps * min_seconds) {
+    return 0.0;
+  }
+
+  // Subtract a half-second moving average so sustained loudness does not
+  // read as onsets, keep the rises, then remove the mean.
+  size_t half = static_cast<size_t>(fps / 4.0);
+  std::vector<double> prefix(n + 1, 0.0);
+  for (size_t i = 0; i < n; ++i) {
+    prefix[i + 1] = prefix[i] + envelope[i];
+  }
+  std::vector<float> onsets(n);
+  double mean = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    size_t lo = i > half ? i - half : 0;
+    size_t hi = std::min(n, i + half + 1);
+    double local = (prefix[hi] - prefix[lo]) / (hi - lo);
+    onsets[i] = static_cast<float>(std::max(0.0, envelope[i] - local));
+    mean += onsets[i];
+  }
+  mean /= n;
+  for (auto &v : onsets) {
+    v -= static_cast<float>(mean);
+  }
+
+  size_t min_lag = static_cast<size_t>(std::floor(fps * 60.0 / max_bpm));
+  size_t max_lag = static_cast<size_t>(std::ceil(fps * 60.0 / min_bpm));
+  size_t last_lag = std::min(n / 2, (max_lag + 1) * lag_multiples);
+  if (last_lag <= max_lag + 1) {
+    return 0.0;
+  }
+
+  std::vector<double> r(last_lag + 1);
+  for (size_t lag = 0; lag <= last_lag; ++lag) {
+    r[lag] = dot(onsets.data(), onsets.data() + lag, n - lag) / (n - lag);
+  }
+  if (r[0] <= 0.0) {
+    return 0.0;
+  }
+
+  auto comb = [&](double lag) {
+    double sum = 0.0;
+    int terms = 0;
+    for (int k = 1; k <= lag_multiples && k * lag < last_lag; ++k) {
+      sum += interpolate(r, k * lag);
+      ++terms;
+    }
+    return terms > 0 ? sum / terms : 0.0;
+  };
+
+  // Multiples drift off the peaks unless the lag is fractional, so the
+  // search steps in twentieths of a frame.
+  double best_score = -HUGE_VAL;
+  double best_lag = 0.0;
+  for (double lag = min_lag; lag <= max_lag; lag += 0.05) {
+    double octaves = std::log2(60.0 * fps / lag / prior_bpm);
+    double prior = std::exp(-0.5 * octaves * octaves);
+    double score = comb(lag) * prior;
+    if (score > best_score) {
+      best_score = score;
+      best_lag = lag;
+    }
+  }
+  if (best_lag <= 0.0 || comb(best_lag) / r[0] < min_beat_strength) {
+    return 0.0;
+  }
+
+  // Locate the autocorrelation peak near each multiple of the lag to a
+  // fraction of a frame and fit the period through all of them; errors
+  // shrink with the number of beats the longest multiple spans.
+  double num = 0.0;
+  double den = 0.0;
+  for (int k = 1; k <= lag_multiples; ++k) {
+    size_t center = static_cast<size_t>(std::lround(k * best_lag));
+    if (center + 3 > last_lag) {
+      break;
+    }
+    size_t peak = center;
+    for (size_t i = center - 2; i <= center + 2; ++i) {
+      if (r[i] > r[peak]) {
+        peak = i;
+      }
+    }
+    double a = r[peak - 1];
+    double b = r[peak];
+    double c = r[peak + 1];
+    double curve = a - 2.0 * b + c;
+    double offset = curve < 0.0 ? 0.5 * (a - c) / curve : 0.0;
+    num += k * (peak + offset);
+    den += static_cast<double>(k) * k;
+  }
+  double refined = den > 0.0 ? num / den : best_lag;
+  return 60.0 * fps / refined;
+}
+
+int TempoKeyDetector::key() const {
+  double total = 0.0;
+  for (double c : chroma) {
+    total += c;
+  }
+  if (total <= 0.0) {
+    return -1;
+  }
+
+  auto correlate = [&](const double *profile, int tonic) {
+    double mx = 0.0, my = 0.0;
+    for (int i = 0; i < 12; ++i) {
+      mx += chroma[(i + tonic) % 12];
+      my += profile[i];
+    }
+    mx /= 12.0;
+    my /= 12.0;
+    double sxy = 0.0, sxx = 0.0, syy = 0.0;
+    for (int i = 0; i < 12; ++i) {
+      double x = chroma[(i + tonic) % 12] - mx;
+      double y = profile[i] - my;
+      sxy += x * y;
+      sxx += x * x;
+      syy += y * y;
+    }
+    return sxx > 0.0 ? sxy / std::sqrt(sxx * syy) : 0.0;
+  };
+
+  int best = -1;
+  double best_r = 0.0;
+  for (int tonic = 0; tonic < 12; ++tonic) {
+    double major = correlate(major_profile, tonic);
+    double minor = correlate(minor_profile, tonic);
+    if (major > best_r) {
+      best_r = major;
+      best = tonic;
+    }
+    if (minor > best_r) {
+      best_r = minor;
+      best = 12 + tonic;
+    }
+  }
+  // Noise and speech correlate weakly with every key.
+  return best_r >= min_key_correlation ? best : -1;
+}
+
+static double thread_cpu_seconds() {
+#if defined(_WIN32)
+  FILETIME created, exited, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) {
+    return 0.0;
+  }
+  ULARGE_INTEGER k, u;
+  k.LowPart = kernel.dwLowDateTime;
+  k.HighPart = kernel.dwHighDateTime;
+  u.LowPart = user.dwLowDateTime;
+  u.HighPart = user.dwHighDateTime;
+  // FILETIME counts 100 ns ticks.
+  return (k.QuadPart + u.QuadPart) / 1e7;
+#else
+  timespec ts{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+CpuThrottle::CpuThrottle(double share)
+    : share(share), last_cpu(thread_cpu_seconds()) {}
+
+void CpuThrottle::pace() {
+  if (share >= 1.0) {
+    return;
+  }
+  double now = thread_cpu_seconds();
+  owed += (now - last_cpu) * (1.0 / share - 1.0);
+  last_cpu = now;
+
+  // Sleeping in slices of at least 10 ms keeps the wakeups cheap.
+  if (owed >= 0.01) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(owed));
+    owed = 0.0;
+    last_cpu = thread_cpu_seconds();
+  }
+}
+
+double analysis_cpu_fraction_from_env() {
+  double percent = default_cpu_percent;
+  const char *value = std::getenv("MUSIC_PLAYR_ANALYSIS_CPU_PERCENT");
+  if (value != nullptr) {
+    double v = std::atof(value);
+    if (v > 0.0) {
+      percent = std::min(v, 100.0);
+    }
+  }
+  return percent / 100.0;
+}
+
+bool measure_tempo_key(const std::string &path, TempoKeyResult &result,
+                       const std::atomic<bool> *cancel, CpuThrottle *throttle) {
+  ma_decoder decoder;
+  ma_decoder_config config = ma_decoder_config_init(
+      ma_format_f32, 1, TempoKeyDetector::analysis_rate);
+  if (ma_decoder_init_file(path.c_str(), &config, &decoder) != MA_SUCCESS) {
+    std::cerr << "Failed to open for tempo analysis: " << path << std::endl;
+    return false;
+  }
+
+  TempoKeyDetector detector;
+  std::vector<float> buffer(read_frames);
+  ma_uint64 total = 0;
+
+  while (cancel == nullptr || !*cancel) {
+    ma_uint64 frames = 0;
+    ma_result r = ma_decoder_read_pcm_frames(&decoder, buffer.data(),
+                                             read_frames, &frames);
+    if (frames > 0) {
+      detector.add(buffer.data(), static_cast<size_t>(frames));
+      total += frames;
+    }
+    if (throttle != nullptr) {
+      throttle->pace();
+    }
+    if (r != MA_SUCCESS || frames < read_frames) {
+      break;
+    }
+  }
+  ma_decoder_uninit(&decoder);
+
+  if (total == 0 || (cancel != nullptr && *cancel)) {
+    return false;
+  }
+
+  result.bpm = detector.bpm();
+  result.key = detector.key();
+  result.fingerprint = chroma_fingerprint(detector.frame_chroma());
+  result.seconds = static_cast<double>(total) / TempoKeyDetector::analysis_rate;
+  return true;
+}
+
+TempoKeyAnalyzer::TempoKeyAnalyzer(const std::string &db_path,
+                                   WorkerPool &pool)
+    : pool(pool), db(db_path.c_str()) {
+  int cores =
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  worker_share = std::min(
+      1.0, analysis_cpu_fraction_from_env() * cores / std::max(1, pool.size()));
+  stats.workers = pool.size();
+}
+
+TempoKeyAnalyzer::~TempoKeyAnalyzer() {
+  stopping = true;
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [this] { return in_flight == 0; });
+}
+
+void TempoKeyAnalyzer::rescan() {
+  std::vector<Track> tracks;
+  {
+    std::lock_guard<std::mutex> lock(db_mutex);
+    tracks = db.get_tracks_without_tempo();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const auto &t : tracks) {
+    if (queued.count(t.id) != 0 || failed_ids.count(t.id) != 0) {
+      continue;
+    }
+    queued.insert(t.id);
+    ++stats.pending;
+    ++in_flight;
+
+    int id = t.id;
+    std::string path = t.file_path;
+    pool.submit([this, id, path] { analyze(id, path); });
+  }
+}
+
+void TempoKeyAnalyzer::analyze(int track_id, const std::string &path) {
+  TempoKeyResult result;
+  bool ok = false;
+  auto start = std::chrono::steady_clock::now();
+  double cpu_start = thread_cpu_seconds();
+
+  if (!stopping) {
+    CpuThrottle throttle(worker_share);
+    ok = measure_tempo_key(path, result, &stopping, &throttle);
+    if (ok) {
+      std::vector<std::int64_t> buckets =
+          fingerprint_buckets(result.fingerprint);
+      std::lock_guard<std::mutex> lock(db_mutex);
+      ok = db.set_track_tempo_key(track_id, result.bpm, result.key) == 0 &&
+           db.set_track_fingerprint(track_id, result.fingerprint, buckets) == 0;
+    }
+  }
+
+  double busy = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+  double cpu = thread_cpu_seconds() - cpu_start;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  queued.erase(track_id);
+  --stats.pending;
+  if (ok) {
+    ++stats.analyzed;
+    stats.audio_seconds += result.seconds;
+    stats.busy_seconds += busy;
+    stats.cpu_percent = busy > 0.0 ? 100.0 * cpu / busy : 0.0;
+    finished.push_back({track_id, result.bpm, result.key});
+  } else if (!stopping) {
+    ++stats.failed;
+    failed_ids.insert(track_id);
+  }
+
+  --in_flight;
+  idle.notify_all();
+}
+
+std::vector<TrackTempoKey> TempoKeyAnalyzer::take_finished() {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<TrackTempoKey> out;
+  out.swap(finished);
+  return out;
+}
+
+TempoKeyStats TempoKeyAnalyzer::get_stats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
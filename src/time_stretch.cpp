@@ -0,0 +1,438 @@
+#include "time_stretch.hpp"
+#include "dsp.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+// A 40 ms window moving by 20 ms, and up to 10 ms either way to find the
+// best match: long enough to hold a pitch period of a low voice, short enough
+// that consonants are not smeared.
+static const double hop_seconds = 0.02;
+static const double search_seconds = 0.01;
+static const size_t raw_chunk = 1024;
+static const double pi = 3.14159265358979323846;
+
+ma_data_source_vtable TimeStretchSource::vtable = {
+    on_read, on_seek, on_get_data_format, on_get_cursor, on_get_length, NULL,
+    0};
+
+ma_result TimeStretchSource::init(ma_data_source *source,
+                                  StretchTimings *timings) {
+  uninit();
+
+  ma_result result = ma_data_source_get_data_format(
+      source, &inner_format, &channels, &sample_rate, NULL, 0);
+  if (result != MA_SUCCESS) {
+    return result;
+  }
+  if (inner_format == ma_format_unknown || channels == 0 ||
+      sample_rate == 0) {
+    return MA_INVALID_DATA;
+  }
+
+  ma_data_source_config config = ma_data_source_config_init();
+  config.vtable = &vtable;
+  result = ma_data_source_init(&config, &base);
+  if (result != MA_SUCCESS) {
+    return result;
+  }
+
+  inner = source;
+  this->timings = timings;
+
+  // Multiples of four, so the decimated search lines up with the full one.
+  hop = std::max<size_t>(64, static_cast<size_t>(sample_rate * hop_seconds)) /
+        4 * 4;
+  search = std::max<size_t>(
+               16, static_cast<size_t>(sample_rate * search_seconds)) /
+           4 * 4;
+
+  ramp.resize(hop * channels);
+  for (size_t f = 0; f < hop; ++f) {
+    float w = static_cast<float>(0.5 - 0.5 * std::cos(pi * (f + 0.5) / hop));
+    for (ma_uint32 c = 0; c < channels; ++c) {
+      ramp[f * channels + c] = w;
+    }
+  }
+
+  // The oldest frame a step can reach is a hop and the search window behind
+  // the nominal position, the newest one and a half hops and the window
+  // ahead of it.
+  input_capacity = 4 * hop + 2 * search + 64;
+  input.assign(input_capacity * channels, 0.0f);
+  block.assign(input_capacity * channels, 0.0f);
+  if (inner_format != ma_format_f32) {
+    raw.resize(raw_chunk * ma_get_bytes_per_frame(inner_format, channels));
+  }
+
+  reference.resize(hop);
+  region.resize(2 * search + hop + 4);
+  coarse_reference.resize(hop / 4);
+  coarse_region.resize(region.size() / 4 + 1);
+  coarse_energy.resize(coarse_region.size() + 1);
+
+  reset();
+  position = 0;
+  initialized = true;
+  return MA_SUCCESS;
+}
+
+void TimeStretchSource::uninit() {
+  if (!initialized) {
+    return;
+  }
+  ma_data_source_uninit(&base);
+  inner = nullptr;
+  initialized = false;
+}
+
+void TimeStretchSource::set_speed(float s) {
+  s = std::clamp(s, min_speed, max_speed);
+  // Snap to 1x so that a slider dragged back lands on the straight read.
+  if (std::fabs(s - 1.0f) < 0.005f) {
+    s = 1.0f;
+  }
+  speed = s;
+}
+
+void TimeStretchSource::reset() {
+  engaged = false;
+  input_start = 0;
+  input_frames = 0;
+  input_ended = false;
+  first_step = true;
+  finished = false;
+  leaving = false;
+  block_frames = 0;
+  block_pos = 0;
+}
+
+void TimeStretchSource::engage() {
+  ma_uint64 cursor = 0;
+  ma_data_source_get_cursor_in_pcm_frames(inner, &cursor);
+  reset();
+  input_start = cursor;
+  tail = cursor;
+  nominal = static_cast<double>(cursor);
+  block_start = nominal;
+  position = cursor;
+  engaged = true;
+}
+
+ma_result TimeStretchSource::read_inner(float *frames, ma_uint64 count,
+                                        ma_uint64 *read) {
+  if (inner_format == ma_format_f32) {
+    return ma_data_source_read_pcm_frames(inner, frames, count, read);
+  }
+
+  ma_result result = MA_SUCCESS;
+  ma_uint64 done = 0;
+  while (done < count) {
+    ma_uint64 want = std::min<ma_uint64>(raw_chunk, count - done);
+    ma_uint64 got = 0;
+    result = ma_data_source_read_pcm_frames(inner, raw.data(), want, &got);
+    ma_pcm_convert(frames + done * channels, ma_format_f32, raw.data(),
+                   inner_format, got * channels, ma_dither_mode_none);
+    done += got;
+    if (result != MA_SUCCESS || got < want) {
+      break;
+    }
+  }
+  *read = done;
+  return done > 0 ? MA_SUCCESS : result;
+}
+
+void TimeStretchSource::fill(ma_uint64 end) {
+  while (!input_ended && input_start + input_frames < end) {
+    ma_uint64 want = std::min<ma_uint64>(input_capacity - input_frames,
+                                         end - input_start - input_frames);
+    if (want == 0) {
+      return;
+    }
+
+    ma_uint64 got = 0;
+    ma_result result =
+        read_inner(&input[input_frames * channels], want, &got);
+    input_frames += got;
+    if (result != MA_SUCCESS && result != MA_BUSY) {
+      input_ended = true;
+    }
+    // A stream still decoding comes up short; the next read tries again.
+    if (got < want) {
+      return;
+    }
+  }
+}
+
+void TimeStretchSource::mono(ma_uint64 from, size_t count, float *out) const {
+  const float *x = &input[(from - input_start) * channels];
+  if (channels == 2) {
+    for (size_t i = 0; i < count; ++i) {
+      out[i] = x[2 * i] + x[2 * i + 1];
+    }
+    return;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    float sum = 0.0f;
+    for (ma_uint32 c = 0; c < channels; ++c) {
+      sum += x[i * channels + c];
+    }
+    out[i] = sum;
+  }
+}
+
+// Candidates are scored by their correlation with the continuation divided
+// by their own energy, so a loud segment is not preferred for being loud.
+ma_uint64 TimeStretchSource::best_start(ma_uint64 lo, ma_uint64 hi) {
+  size_t candidates = static_cast<size_t>(hi - lo) + 1;
+  size_t span = candidates - 1 + hop;
+  mono(tail, hop, reference.data());
+  mono(lo, span, region.data());
+
+  size_t quarter = hop / 4;
+  for (size_t j = 0; j < quarter; ++j) {
+    const float *r = &reference[4 * j];
+    coarse_reference[j] = r[0] + r[1] + r[2] + r[3];
+  }
+  size_t coarse_span = span / 4;
+  coarse_energy[0] = 0.0;
+  for (size_t j = 0; j < coarse_span; ++j) {
+    const float *r = &region[4 * j];
+    float v = r[0] + r[1] + r[2] + r[3];
+    coarse_region[j] = v;
+    coarse_energy[j + 1] = coarse_energy[j] + static_cast<double>(v) * v;
+  }
+
+  size_t best = 0;
+  double best_score = -1e300;
+  for (size_t k = 0; 4 * k < candidates; ++k) {
+    double energy = coarse_energy[k + quarter] - coarse_energy[k];
+    double score = dot_product(coarse_reference.data(), &coarse_region[k],
+                               quarter) /
+                   std::sqrt(energy + 1e-9);
+    if (score > best_score) {
+      best_score = score;
+      best = 4 * k;
+    }
+  }
+
+  size_t first = best >= 3 ? best - 3 : 0;
+  size_t last = std::min(best + 3, candidates - 1);
+  best_score = -1e300;
+  for (size_t o = first; o <= last; ++o) {
+    const float *c = &region[o];
+    double score = dot_product(reference.data(), c, hop) /
+                   std::sqrt(dot_product(c, c, hop) + 1e-9);
+    if (score > best_score) {
+      best_score = score;
+      best = o;
+    }
+  }
+  return lo + best;
+}
+
+bool TimeStretchSource::step(float s) {
+  ma_uint64 lo = tail;
+  ma_uint64 hi = tail;
+  if (!first_step) {
+    ma_uint64 center = static_cast<ma_uint64>(std::llround(nominal));
+    lo = std::max(center > search ? center - search : 0, input_start);
+    hi = std::max(center + search, lo);
+  }
+
+  ma_uint64 need = std::max(tail, hi) + hop;
+  fill(need);
+  ma_uint64 end = input_start + input_frames;
+  if (need > end) {
+    if (!input_ended) {
+      return false;
+    }
+    // Too little left for another crossfade: play out the rest as it is.
+    if (tail + hop > end || lo + hop > end) {
+      hand_back();
+      finished = true;
+      return block_frames > 0;
+    }
+    hi = end - hop;
+  }
+
+  ma_uint64 start = lo == hi ? lo : best_start(lo, hi);
+  crossfade(&input[(tail - input_start) * channels],
+            &input[(start - input_start) * channels], ramp.data(),
+            block.data(), hop * channels);
+  block_frames = hop;
+  block_pos = 0;
+  block_start = nominal;
+  block_speed = s;
+  nominal += static_cast<double>(s) * hop;
+  tail = start + hop;
+  first_step = false;
+
+  // Drop what no later step can reach.
+  ma_uint64 center = static_cast<ma_uint64>(std::llround(nominal));
+  ma_uint64 keep = std::min(center > search ? center - search : 0, tail);
+  if (keep > input_start) {
+    size_t drop = static_cast<size_t>(
+        std::min<ma_uint64>(keep - input_start, input_frames));
+    std::memmove(input.data(), input.data() + drop * channels,
+                 (input_frames - drop) * channels * sizeof(float));
+    input_frames -= drop;
+    input_start += drop;
+  }
+  return true;
+}
+
+// Queues the frames already read past the last segment, which are its
+// natural continuation, so playback can go on from the wrapped source's own
+// cursor without a seek.
+void TimeStretchSource::hand_back() {
+  ma_uint64 end = input_start + input_frames;
+  size_t count = tail < end ? static_cast<size_t>(end - tail) : 0;
+  if (count > 0) {
+    std::memcpy(block.data(), &input[(tail - input_start) * channels],
+                count * channels * sizeof(float));
+  }
+  block_frames = count;
+  block_pos = 0;
+  block_start = static_cast<double>(tail);
+  block_speed = 1.0f;
+  input_start = end;
+  input_frames = 0;
+  tail = end;
+}
+
+ma_result TimeStretchSource::read(float *frames, ma_uint64 count,
+                                  ma_uint64 *read) {
+  auto started = std::chrono::steady_clock::now();
+  float s = speed.load(std::memory_order_relaxed);
+  if (!engaged && s != 1.0f) {
+    engage();
+  }
+  bool stretched = engaged;
+
+  ma_result result = MA_SUCCESS;
+  ma_uint64 done = 0;
+  while (done < count) {
+    if (!engaged) {
+      ma_uint64 got = 0;
+      result = read_inner(frames + done * channels, count - done, &got);
+      done += got;
+      break;
+    }
+
+    if (block_pos == block_frames) {
+      if (finished) {
+        result = MA_AT_END;
+        break;
+      }
+      if (leaving) {
+        leaving = false;
+        if (s != 1.0f) {
+          engage();
+        } else {
+          engaged = false;
+        }
+      } else if (s == 1.0f) {
+        hand_back();
+        leaving = true;
+      } else if (!step(s) && !finished) {
+        result = MA_BUSY;
+        break;
+      }
+      continue;
+    }
+
+    size_t n = static_cast<size_t>(
+        std::min<ma_uint64>(block_frames - block_pos, count - done));
+    std::memcpy(frames + done * channels, &block[block_pos * channels],
+                n * channels * sizeof(float));
+    block_pos += n;
+    done += n;
+  }
+
+  // The continuation handed back at 1x can start up to a hop behind where
+  // the stretched blocks had got to; hold the position rather than step back.
+  if (engaged) {
+    ma_uint64 at = std::min(
+        static_cast<ma_uint64>(
+            std::llround(block_start + block_pos * block_speed)),
+        input_start + input_frames);
+    if (at > position.load(std::memory_order_relaxed)) {
+      position = at;
+    }
+  }
+  if (stretched && timings != nullptr) {
+    timings->audio_us.fetch_add(done * 1000000 / sample_rate,
+                                std::memory_order_relaxed);
+    timings->busy_ns.fetch_add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - started)
+            .count(),
+        std::memory_order_relaxed);
+  }
+
+  *read = done;
+  if (done > 0) {
+    return MA_SUCCESS;
+  }
+  return result == MA_SUCCESS ? MA_AT_END : result;
+}
+
+ma_result TimeStretchSource::on_read(ma_data_source *source, void *frames,
+                                     ma_uint64 count, ma_uint64 *read) {
+  auto *self = reinterpret_cast<TimeStretchSource *>(source);
+  return self->read(static_cast<float *>(frames), count, read);
+}
+
+// Runs on the audio thread, like the reads.
+ma_result TimeStretchSource::on_seek(ma_data_source *source,
+                                     ma_uint64 frame) {
+  auto *self = reinterpret_cast<TimeStretchSource *>(source);
+  ma_result result = ma_data_source_seek_to_pcm_frame(self->inner, frame);
+  self->reset();
+  self->position = frame;
+  return result;
+}
+
+ma_result TimeStretchSource::on_get_data_format(ma_data_source *source,
+                                                ma_format *format,
+                                                ma_uint32 *channels,
+                                                ma_uint32 *sample_rate,
+                                                ma_channel *channel_map,
+                                                size_t channel_map_cap) {
+  auto *self = reinterpret_cast<TimeStretchSource *>(source);
+  if (format != NULL) {
+    *format = ma_format_f32;
+  }
+  if (channels != NULL) {
+    *channels = self->channels;
+  }
+  if (sample_rate != NULL) {
+    *sample_rate = self->sample_rate;
+  }
+  if (channel_map != NULL) {
+    return ma_data_source_get_data_format(self->inner, NULL, NULL, NULL,
+                                          channel_map, channel_map_cap);
+  }
+  return MA_SUCCESS;
+}
+
+// Read from the control thread while the audio thread plays; the position
+// is published after every read while stretching.
+ma_result TimeStretchSource::on_get_cursor(ma_data_source *source,
+                                           ma_uint64 *cursor) {
+  auto *self = reinterpret_cast<TimeStretchSource *>(source);
+  if (self->engaged) {
+    *cursor = self->position;
+    return MA_SUCCESS;
+  }
+  return ma_data_source_get_cursor_in_pcm_frames(self->inner, cursor);
+}
+
+ma_result TimeStretchSource::on_get_length(ma_data_source *source,
+                                           ma_uint64 *length) {
+  auto *self = reinterpret_cast<TimeStretchSource *>(source);
+  return ma_data_source_get_length_in_pcm_frames(self->inner, length);
+}
@@ -0,0 +1,425 @@
+#include "waveform.hpp"
+
+#include "miniaudio/miniaudio.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char waveform_magic[4] = {'M', 'P', 'W', 'F'};
+static const std::uint32_t waveform_version = 1;
+static const std::uint32_t bucket_frames = 256;
+static const size_t fingerprint_chunk = 64 << 10;
+static const size_t max_mapped = 16;
+static const std::chrono::seconds retry_failed_after(60);
+static const ma_uint64 read_frames = 4096;
+
+WaveformView::~WaveformView() {
+#ifndef _WIN32
+  if (data != nullptr && copy.empty()) {
+    munmap(const_cast<unsigned char *>(data), size);
+  }
+#endif
+}
+
+std::shared_ptr<const WaveformView>
+WaveformView::open(const std::string &file) {
+  std::shared_ptr<WaveformView> view(new WaveformView());
+#ifdef _WIN32
+  std::ifstream in(file, std::ios::binary | std::ios::ate);
+  if (!in) {
+    return nullptr;
+  }
+  std::streamoff length = in.tellg();
+  if (length < static_cast<std::streamoff>(sizeof(WaveformHeader))) {
+    return nullptr;
+  }
+  view->copy.resize(static_cast<size_t>(length));
+  in.seekg(0);
+  if (!in.read(reinterpret_cast<char *>(view->copy.data()), length)) {
+    return nullptr;
+  }
+  view->data = view->copy.data();
+  view->size = view->copy.size();
+#else
+  int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(WaveformHeader)) {
+    ::close(fd);
+    return nullptr;
+  }
+  void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    return nullptr;
+  }
+  view->data = static_cast<const unsigned char *>(map);
+  view->size = static_cast<size_t>(st.st_size);
+#endif
+  view->header = reinterpret_cast<const WaveformHeader *>(view->data);
+
+  const WaveformHeader &h = *view->header;
+  size_t table_end = sizeof(WaveformHeader) + h.levels * sizeof(WaveformLevel);
+  if (std::memcmp(h.magic, waveform_magic, 4) != 0 ||
+      h.version != waveform_version || h.levels == 0 || h.levels > 64 ||
+      h.sample_rate == 0 || h.bucket_frames == 0 || table_end > view->size) {
+    return nullptr;
+  }
+  view->levels = reinterpret_cast<const WaveformLevel *>(
+      view->data + sizeof(WaveformHeader));
+  view->buckets =
+      reinterpret_cast<const WaveformBucket *>(view->data + table_end);
+
+  std::uint64_t available = (view->size - table_end) / sizeof(WaveformBucket);
+  for (std::uint32_t l = 0; l < h.levels; ++l) {
+    if (view->levels[l].count == 0 ||
+        view->levels[l].first + view->levels[l].count > available) {
+      return nullptr;
+    }
+  }
+  return view;
+}
+
+double WaveformView::seconds() const {
+  return static_cast<double>(header->frames) / header->sample_rate;
+}
+
+WaveformSpan WaveformView::span(double from, double to) const {
+  WaveformSpan s;
+  double rate = header->sample_rate;
+  double first_frame = std::max(0.0, from * rate);
+  double frames = std::max(1.0, (to - from) * rate);
+
+  std::uint32_t level = 0;
+  while (level + 1 < header->levels &&
+         (static_cast<double>(header->bucket_frames) * (2ULL << level)) <=
+             frames) {
+    ++level;
+  }
+
+  const WaveformLevel &l = levels[level];
+  double width = static_cast<double>(header->bucket_frames) * (1ULL << level);
+  std::uint64_t begin = static_cast<std::uint64_t>(first_frame / width);
+  std::uint64_t end =
+      static_cast<std::uint64_t>(std::ceil((first_frame + frames) / width));
+  end = std::min<std::uint64_t>(end, l.count);
+  if (begin >= end) {
+    return s;
+  }
+
+  const WaveformBucket *b = buckets + l.first;
+  int lo = 127, hi = -128;
+  double squares = 0.0;
+  for (std::uint64_t i = begin; i < end; ++i) {
+    lo = std::min<int>(lo, b[i].min);
+    hi = std::max<int>(hi, b[i].max);
+    double r = b[i].rms / 255.0;
+    squares += r * r;
+  }
+  s.min = lo / 127.0f;
+  s.max = hi / 127.0f;
+  s.rms = static_cast<float>(std::sqrt(squares / (end - begin)));
+  return s;
+}
+
+std::string content_fingerprint(const std::string &path) {
+  std::error_code ec;
+  std::uintmax_t file_size = std::filesystem::file_size(path, ec);
+  std::ifstream in(path, std::ios::binary);
+  if (ec || !in) {
+    return std::string();
+  }
+
+  std::uint64_t hash = 1469598103934665603ULL;
+  auto mix = [&hash](const unsigned char *p, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      hash ^= p[i];
+      hash *= 1099511628211ULL;
+    }
+  };
+
+  std::uint64_t size = static_cast<std::uint64_t>(file_size);
+  mix(reinterpret_cast<const unsigned char *>(&size), sizeof(size));
+
+  std::vector<unsigned char> buffer(fingerprint_chunk);
+  std::uint64_t offsets[3] = {0, 0, 0};
+  if (size > fingerprint_chunk) {
+    offsets[1] = (size - fingerprint_chunk) / 2;
+    offsets[2] = size - fingerprint_chunk;
+  }
+  int chunks = size > fingerprint_chunk ? 3 : 1;
+  for (int c = 0; c < chunks; ++c) {
+    in.clear();
+    in.seekg(static_cast<std::streamoff>(offsets[c]));
+    in.read(reinterpret_cast<char *>(buffer.data()), buffer.size());
+    std::streamsize n = in.gcount();
+    if (n > 0) {
+      mix(buffer.data(), static_cast<size_t>(n));
+    }
+  }
+
+  char hex[17];
+  std::snprintf(hex, sizeof(hex), "%016llx",
+                static_cast<unsigned long long>(hash));
+  return hex;
+}
+
+static std::int8_t quantize_sample(float x) {
+  float v = std::round(std::max(-1.0f, std::min(1.0f, x)) * 127.0f);
+  return static_cast<std::int8_t>(v);
+}
+
+bool build_waveform(const std::string &audio_path, const std::string &out_file,
+                    const std::atomic<bool> *cancel) {
+  ma_decoder decoder;
+  ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 0, 0);
+  if (ma_decoder_init_file(audio_path.c_str(), &config, &decoder) !=
+      MA_SUCCESS) {
+    std::cerr << "Failed to open for waveform: " << audio_path << std::endl;
+    return false;
+  }
+
+  ma_uint32 channels = decoder.outputChannels;
+  ma_uint32 rate = decoder.outputSampleRate;
+  if (channels == 0 || rate == 0) {
+    ma_decoder_uninit(&decoder);
+    return false;
+  }
+
+  std::vector<float> buffer(read_frames * channels);
+  std::vector<WaveformBucket> pyramid;
+  std::uint64_t frames = 0;
+  float lo = 1.0f, hi = -1.0f;
+  double squares = 0.0;
+  std::uint32_t filled = 0;
+
+  auto flush = [&]() {
+    WaveformBucket b;
+    b.min = quantize_sample(lo);
+    b.max = quantize_sample(hi);
+    double rms = std::sqrt(squares / (static_cast<double>(filled) * channels));
+    b.rms = static_cast<std::uint8_t>(std::min(255.0, std::round(rms * 255.0)));
+    b.reserved = 0;
+    pyramid.push_back(b);
+    lo = 1.0f;
+    hi = -1.0f;
+    squares = 0.0;
+    filled = 0;
+  };
+
+  while (cancel == nullptr || !*cancel) {
+    ma_uint64 got = 0;
+    ma_result r =
+        ma_decoder_read_pcm_frames(&decoder, buffer.data(), read_frames, &got);
+    for (ma_uint64 i = 0; i < got; ++i) {
+      const float *frame = &buffer[i * channels];
+      for (ma_uint32 c = 0; c < channels; ++c) {
+        float x = frame[c];
+        lo = std::min(lo, x);
+        hi = std::max(hi, x);
+        squares += static_cast<double>(x) * x;
+      }
+      if (++filled == bucket_frames) {
+        flush();
+      }
+    }
+    frames += got;
+    if (r != MA_SUCCESS || got < read_frames) {
+      break;
+    }
+  }
+  ma_decoder_uninit(&decoder);
+
+  if (frames == 0 || (cancel != nullptr && *cancel)) {
+    return false;
+  }
+  if (filled > 0) {
+    flush();
+  }
+
+  // Each level halves the one below it; RMS merges as a mean of squares.
+  std::vector<WaveformLevel> levels;
+  levels.push_back({0, pyramid.size()});
+  while (levels.back().count > 1) {
+    WaveformLevel below = levels.back();
+    WaveformLevel level{pyramid.size(), (below.count + 1) / 2};
+    for (std::uint64_t i = 0; i < level.count; ++i) {
+      const WaveformBucket &a = pyramid[below.first + 2 * i];
+      const WaveformBucket &b = 2 * i + 1 < below.count
+                                    ? pyramid[below.first + 2 * i + 1]
+                                    : a;
+      WaveformBucket m;
+      m.min = std::min(a.min, b.min);
+      m.max = std::max(a.max, b.max);
+      double rms = std::sqrt(
+          (double(a.rms) * a.rms + double(b.rms) * b.rms) / 2.0);
+      m.rms = static_cast<std::uint8_t>(std::min(255.0, std::round(rms)));
+      m.reserved = 0;
+      pyramid.push_back(m);
+    }
+    levels.push_back(level);
+  }
+
+  WaveformHeader header{};
+  std::memcpy(header.magic, waveform_magic, 4);
+  header.version = waveform_version;
+  header.sample_rate = rate;
+  header.bucket_frames = bucket_frames;
+  header.frames = frames;
+  header.levels = static_cast<std::uint32_t>(levels.size());
+
+  // Write beside the target and rename so a reader never maps a partial file.
+  char suffix[32];
+  std::snprintf(suffix, sizeof(suffix), ".tmp%zu",
+                std::hash<std::thread::id>()(std::this_thread::get_id()));
+  std::string tmp = out_file + suffix;
+  FILE *out = std::fopen(tmp.c_str(), "wb");
+  if (out == nullptr) {
+    std::cerr << "Failed to write waveform: " << tmp << std::endl;
+    return false;
+  }
+  bool ok = std::fwrite(&header, sizeof(header), 1, out) == 1 &&
+            std::fwrite(levels.data(), sizeof(WaveformLevel), levels.size(),
+                        out) == levels.size() &&
+            std::fwrite(pyramid.data(), sizeof(WaveformBucket), pyramid.size(),
+                        out) == pyramid.size();
+  ok = std::fclose(out) == 0 && ok;
+  if (!ok || std::rename(tmp.c_str(), out_file.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::string waveform_dir_from_env(const std::string &db_path) {
+  const char *value = std::getenv("MUSIC_PLAYR_WAVEFORM_DIR");
+  if (value != nullptr && *value != '\0') {
+    return value;
+  }
+  return (std::filesystem::path(db_path).parent_path() / "waveforms").string();
+}
+
+WaveformCache::WaveformCache(const std::string &dir, WorkerPool &pool)
+    : pool(pool), dir(dir) {
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  if (ec) {
+    std::cerr << "Failed to create waveform cache " << dir << ": "
+              << ec.message() << std::endl;
+  }
+}
+
+WaveformCache::~WaveformCache() {
+  stopping = true;
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [this] { return in_flight == 0; });
+}
+
+std::shared_ptr<const WaveformView>
+WaveformCache::get(const std::string &audio_path) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = entries.find(audio_path);
+  if (it != entries.end()) {
+    Entry &e = it->second;
+    if (e.view) {
+      lru.splice(lru.begin(), lru, e.lru);
+    }
+    if (!e.failed || std::chrono::steady_clock::now() - e.failed_at <
+                         retry_failed_after) {
+      return e.view;
+    }
+    e.failed = false;
+    --stats.failed;
+  }
+
+  entries[audio_path].lru = lru.end();
+  ++stats.pending;
+  ++in_flight;
+  pool.submit([this, audio_path] { load(audio_path); }, true);
+  return nullptr;
+}
+
+void WaveformCache::load(const std::string &audio_path) {
+  std::shared_ptr<const WaveformView> view;
+  bool built = false;
+  auto start = std::chrono::steady_clock::now();
+
+  if (!stopping) {
+    std::string key = content_fingerprint(audio_path);
+    if (!key.empty()) {
+      std::string file =
+          (std::filesystem::path(dir) / (key + ".peaks")).string();
+      view = WaveformView::open(file);
+      if (!view && build_waveform(audio_path, file, &stopping)) {
+        view = WaveformView::open(file);
+        built = view != nullptr;
+      }
+    }
+  }
+
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  --stats.pending;
+  Entry &e = entries[audio_path];
+  if (view) {
+    e.view = view;
+    lru.push_front(audio_path);
+    e.lru = lru.begin();
+    ++stats.mapped;
+    stats.mapped_bytes += view->mapped_bytes();
+    if (built) {
+      ++stats.built;
+      stats.build_seconds += seconds;
+    } else {
+      ++stats.loaded;
+    }
+    evict();
+  } else if (!stopping) {
+    e.failed = true;
+    e.failed_at = std::chrono::steady_clock::now();
+    ++stats.failed;
+  } else {
+    entries.erase(audio_path);
+  }
+
+  --in_flight;
+  idle.notify_all();
+}
+
+void WaveformCache::evict() {
+  while (lru.size() > max_mapped) {
+    auto it = entries.find(lru.back());
+    if (it != entries.end()) {
+      --stats.mapped;
+      stats.mapped_bytes -= it->second.view->mapped_bytes();
+      entries.erase(it);
+    }
+    lru.pop_back();
+  }
+}
+
+WaveformStats WaveformCache::get_stats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
@@ -0,0 +1,92 @@
+#include "worker_pool.hpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#elif defined(__linux__)
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+
+void lower_thread_priority() {
+#if defined(_WIN32)
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#elif defined(__APPLE__)
+  pthread_set_qos_class_self_np(QOS_CLASS_BACKGROUND, 0);
+#elif defined(__linux__)
+  // On Linux both calls apply to the calling thread only.
+  sched_param param{};
+  if (sched_setscheduler(0, SCHED_IDLE, &param) != 0) {
+    setpriority(PRIO_PROCESS, 0, 19);
+  }
+#endif
+}
+
+WorkerPool::WorkerPool(int threads) {
+  if (threads < 1) {
+    threads = 1;
+  }
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back(&WorkerPool::run, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop_requested = true;
+    jobs.clear();
+  }
+  wake.notify_all();
+  for (auto &worker : workers) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+}
+
+int WorkerPool::default_threads() {
+  int cores = static_cast<int>(std::thread::hardware_concurrency());
+  return cores > 2 ? cores / 2 : 1;
+}
+
+void WorkerPool::submit(std::function<void()> job, bool urgent) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (urgent) {
+      jobs.push_front(std::move(job));
+    } else {
+      jobs.push_back(std::move(job));
+    }
+  }
+  wake.notify_one();
+}
+
+int WorkerPool::pending() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return static_cast<int>(jobs.size());
+}
+
+void WorkerPool::run() {
+  lower_thread_priority();
+
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this] { return stop_requested || !jobs.empty(); });
+      if (stop_requested) {
+        return;
+      }
+      job = std::move(jobs.front());
+      jobs.pop_front();
+      ++busy;
+    }
+
+    job();
+    --busy;
+  }
+}